@@ -36,6 +36,8 @@ inline void Async_Read(tapa::async_mmap<T1> &mmap_in,
 void SpElement_list_ptr_Loader(const INDEX_TYPE Batch_num,
                                const INDEX_TYPE M,
                                const INDEX_TYPE N,
+                               const INDEX_TYPE N_slices,
+                               const INDEX_TYPE A_format,
                                const INDEX_TYPE K, 
                                const INDEX_TYPE Iteration_num,
                                tapa::async_mmap<INDEX_TYPE> &SpElement_list_ptr,
@@ -47,12 +49,32 @@ void SpElement_list_ptr_Loader(const INDEX_TYPE Batch_num,
     PE_Param.write(N);
     PE_Param.write(K);
     PE_Param.write(Iteration_num);                           
+    PE_Param.write(N_slices);
+    PE_Param.write(A_format);
 
     const INDEX_TYPE Iteration_time = (Iteration_num == 0) ? 1 : Iteration_num;
     
     const INDEX_TYPE Batch_num_plus_1 = Batch_num + 1;
 
-    const INDEX_TYPE Iteration_time_N = Iteration_time * ((N + 7) >> 3);
+    // the codebook follows the batch pointers, every MMU keeps a copy
+    const INDEX_TYPE Codebook_len = (A_format == A_FORMAT_CODEBOOK) ? A_CODEBOOK_SIZE : 0;
+Load_codebook:
+    for(INDEX_TYPE i_request = 0, i_response = 0; i_response < Codebook_len;) {
+#pragma HLS loop_tripcount min=0 max=256
+#pragma HLS pipeline II=1
+        if((i_request < Codebook_len) & !SpElement_list_ptr.read_addr.full()) {
+            SpElement_list_ptr.read_addr.try_write(Batch_num_plus_1 + i_request);
+            ++i_request;
+        }
+        if(!PE_Param.full() & !SpElement_list_ptr.read_data.empty()) {
+            INDEX_TYPE temp;
+            SpElement_list_ptr.read_data.try_read(temp);
+            PE_Param.try_write(temp);
+            ++i_response;
+        }
+    }
+
+    const INDEX_TYPE Iteration_time_N = Iteration_time * Pass_num(N, N_slices);
 iter:
     for(INDEX_TYPE iter = 0; iter < Iteration_time_N; ++iter) {
 #pragma HLS loop_flatten off
@@ -73,25 +95,28 @@ iter:
 
 void Sparse_Matrix_Loader(const INDEX_TYPE Matrix_len,
                           const INDEX_TYPE N, 
+                          const INDEX_TYPE N_slices,
+                          const INDEX_TYPE A_format,
                           const INDEX_TYPE Iteration_num,
                           tapa::async_mmap<ap_uint<512>> &Matrix_A_data,
                           tapa::ostream<ap_uint<512>> &Matrix_A_Stream
                           ) {
 
+    const INDEX_TYPE Matrix_lines = A_format_lines(Matrix_len, A_format);
     const INDEX_TYPE Iteration_time = (Iteration_num == 0) ? 1 : Iteration_num;
-    const INDEX_TYPE Iteration_time_N = Iteration_time * ((N + 7) >> 3);
+    const INDEX_TYPE Iteration_time_N = Iteration_time * Pass_num(N, N_slices);
 iter:
     for(INDEX_TYPE iter = 0; iter < Iteration_time_N; ++iter) {
 #pragma HLS loop_flatten off
 #pragma HLS loop_tripcount min=1 max=16
 
     Load_A:
-        for(INDEX_TYPE i_request = 0, i_response = 0; i_response < Matrix_len;) {
+        for(INDEX_TYPE i_request = 0, i_response = 0; i_response < Matrix_lines;) {
 #pragma HLS loop_tripcount min=1 max=10000
 #pragma HLS pipeline II=1
             Async_Read(Matrix_A_data,
                        Matrix_A_Stream,
-                       Matrix_len,
+                       Matrix_lines,
                        i_request, 
                        i_response
                       );
@@ -118,28 +143,69 @@ Seg:
     }
 }
 
+// B in the order the MMUs fill it: per pass over A, per batch, the lines of
+// the batch window in every N-block of the pass
 void Dense_Matrix_Loader(const INDEX_TYPE K,
                          const INDEX_TYPE N,
+                         const INDEX_TYPE N_slices,
                          const INDEX_TYPE Iteration_num,
                          tapa::async_mmap<VALUE_TYPE_v16> & Matrix_B_data,
                          tapa::ostream<VALUE_TYPE_v16> & Matrix_B_Stream
                         ) {
     const INDEX_TYPE Iteration_time = (Iteration_num == 0) ? 1 : Iteration_num;
-    const int Iteration_num_B = ((K + 7) >> 3) * ((N + 7) >> 3);
+    const INDEX_TYPE B_lines = (K + 7) >> 3;
+    const INDEX_TYPE Block_num = (N + 7) >> 3;
+    const INDEX_TYPE Slice_lines = (Tile_WIDTH / N_slices) >> 3;
+    const INDEX_TYPE Iteration_time_N = Iteration_time * Pass_num(N, N_slices);
     
 iter:
-    for(INDEX_TYPE rp = 0; rp < Iteration_time; rp++) {
+    for(INDEX_TYPE rp = 0, block = 0; rp < Iteration_time_N; rp++) {
 #pragma HLS loop_flatten off
 #pragma HLS loop_tripcount min=1 max=16
+        const INDEX_TYPE Slices = (Block_num - block < N_slices) ? Block_num - block : N_slices;
+        const INDEX_TYPE Iteration_num_B = Slices * B_lines;
+
+        // batch window [batch_line, batch_line + batch_len) of N-block block + s
+        INDEX_TYPE batch_line = 0;
+        INDEX_TYPE batch_len = (B_lines < Slice_lines) ? B_lines : Slice_lines;
+        INDEX_TYPE slice_addr = block * B_lines;
+        INDEX_TYPE s = 0;
+        INDEX_TYPE j = 0;
+
     Load_B:
         for(INDEX_TYPE i_req = 0, i_resp = 0; i_resp < Iteration_num_B;) {
 #pragma HLS loop_tripcount min=1 max=500000
 #pragma HLS pipeline II=1
-            Async_Read(Matrix_B_data,
-                       Matrix_B_Stream,
-                       Iteration_num_B,
-                       i_req,
-                       i_resp);
+            if((i_req < Iteration_num_B) & !Matrix_B_data.read_addr.full()) {
+                Matrix_B_data.read_addr.try_write(slice_addr + batch_line + j);
+                ++i_req;
+                if(j + 1 < batch_len) {
+                    ++j;
+                }
+                else if(s + 1 < Slices) {
+                    j = 0;
+                    ++s;
+                    slice_addr += B_lines;
+                }
+                else {
+                    j = 0;
+                    s = 0;
+                    slice_addr = block * B_lines;
+                    batch_line += Slice_lines;
+                    batch_len = (B_lines - batch_line < Slice_lines) ? B_lines - batch_line : Slice_lines;
+                }
+            }
+            if(!Matrix_B_Stream.full() & !Matrix_B_data.read_data.empty()) {
+                VALUE_TYPE_v16 temp;
+                Matrix_B_data.read_data.try_read(temp);
+                Matrix_B_Stream.try_write(temp);
+                ++i_resp;
+            }
+        }
+
+        block += N_slices;
+        if(block >= Block_num) {
+            block = 0;
         }
     }
 }
@@ -148,6 +214,9 @@ void Dense_Matrix_Writer(const INDEX_TYPE M,
                          const INDEX_TYPE N,
                          const INDEX_TYPE Iteration_num,
                          tapa::istream<VALUE_TYPE_v16> & Matrix_C_Stream,
+#ifdef LEDA_PERF_COUNTERS
+                         tapa::ostream<INDEX_TYPE_v16> & Perf_Stream,
+#endif
                          tapa::async_mmap<VALUE_TYPE_v16> & Matrix_C_date
                         ) {
     const INDEX_TYPE Iteration_time = (Iteration_num == 0) ? 1 : Iteration_num;
@@ -157,6 +226,15 @@ iter:
     for(INDEX_TYPE rp = 0; rp < Iteration_time; rp++) {
 #pragma HLS loop_flatten off
 #pragma HLS loop_tripcount min=1 max=16
+#ifdef LEDA_PERF_COUNTERS
+        // one record per N-block of the first pass
+        INDEX_TYPE_v16 perf;
+        for(INDEX_TYPE f = 0; f < PERF_WORDS; ++f) {
+            perf[f] = 0;
+        }
+        perf[PERF_BATCH] = -1;
+        INDEX_TYPE perf_next = (M + 15) >> 4;
+#endif
     Write_C:
         for(INDEX_TYPE i_req = 0, i_resp = 0; i_resp < Iteration_num_C;) {
 #pragma HLS loop_tripcount min=1 max=500000
@@ -167,12 +245,39 @@ iter:
 		Matrix_C_Stream.try_read(tmpv);
                 Matrix_C_date.write_data.try_write(tmpv);
                 ++i_req;
+#ifdef LEDA_PERF_COUNTERS
+                ++perf[PERF_WRITE_ACTIVE];
+                if((rp == 0) & (i_req == perf_next) & (i_req < Iteration_num_C)) {
+                    Perf_Stream.write(perf);
+                    for(INDEX_TYPE f = PERF_WRITE_ACTIVE; f < PERF_WORDS; ++f) {
+                        perf[f] = 0;
+                    }
+                    ++perf[PERF_N_BLOCK];
+                    perf_next += (M + 15) >> 4;
+                }
+#endif
             }
+#ifdef LEDA_PERF_COUNTERS
+            else if(i_req >= Iteration_num_C) {
+                ++perf[PERF_WRITE_WAIT_RESP];
+            }
+            else if(Matrix_C_Stream.empty()) {
+                ++perf[PERF_WRITE_WAIT_C];
+            }
+            else {
+                ++perf[PERF_WRITE_WAIT_MEM];
+            }
+#endif
 	    uint8_t n_resp;
             if(Matrix_C_date.write_resp.try_read(n_resp)) {
                 i_resp += INDEX_TYPE(n_resp) + 1;
             }
         }
+#ifdef LEDA_PERF_COUNTERS
+        if(rp == 0) {
+            Perf_Stream.write(perf);
+        }
+#endif
     }
 }
 
@@ -200,12 +305,129 @@ void Outer_Product_Unit_Merge(ap_uint<14> B_row,
     B_row_old = B_row;
 }
 
+// one compressed A word in the 64-bit layout of A_FORMAT_FP32; A_tile are
+// the delta tile registers of the lane, window | row
+ap_uint<64> Decode_A_word(const INDEX_TYPE A_format,
+                          const ap_uint<42> w,
+                          const ap_uint<32> A_codebook[A_CODEBOOK_SIZE],
+                          ap_uint<27> A_tile[A_DELTA_TILES]
+                         ) {
+#pragma HLS inline
+    ap_uint<64> a = 0;
+    if(A_format == A_FORMAT_DELTA) {
+        ap_uint<4> t = w(40, 37);
+        if(w[41]) {
+            A_tile[t] = w(26, 0);
+            a(49, 32) = 0x3FFFF;
+        }
+        else {
+            ap_uint<27> tile = A_tile[t];
+            a(63, 55) = tile(26, 18);
+            a(54, 50) = w(36, 32);
+            a(49, 32) = tile(17, 0);
+            a(31,  0) = w(31, 0);
+        }
+    }
+    else if(A_format == A_FORMAT_PATTERN) {
+        a(63, 32) = w(31, 0);
+        a(31,  0) = 0x3F800000;
+    }
+    else if(A_format == A_FORMAT_CODEBOOK) {
+        ap_uint<8> idx = w(31, 24);
+        a(63, 50) = w(23, 12);
+        if(idx == A_CODEBOOK_SIZE - 1) {
+            a(49, 32) = 0x3FFFF;
+        }
+        else {
+            a(49, 32) = w(11, 0);
+        }
+        a(31,  0) = A_codebook[idx];
+    }
+    else {
+        ap_uint<16> h = w(41, 26);
+        a(63, 50) = w(25, 14);
+        if(w[13]) {
+            a(49, 32) = 0x3FFFF;
+        }
+        else {
+            a(49, 32) = w(12, 0);
+        }
+        if(A_format == A_FORMAT_BF16) {
+            a(31, 16) = h;
+        }
+        else {
+            // fp16 to float, the host encodes no subnormals
+            ap_uint<5> e = h(14, 10);
+            a(31, 31) = h(15, 15);
+            if(e == 0x1F) {
+                a(30, 23) = 0xFF;
+            }
+            else if(e != 0) {
+                a(30, 23) = e + 112;
+            }
+            if(e != 0) {
+                a(22, 13) = h(9, 0);
+            }
+        }
+    }
+    return a;
+}
+
+// the 4 lane words of slot phase of the current group: FP32 beats are the
+// slot itself, the 32-bit formats take slot 1 from the beat held since
+// slot 0, and the 42-bit formats take slot 1 from both beats and slot 2
+// from the held second beat
+void Decode_A_slot(const INDEX_TYPE A_format,
+                   const INDEX_TYPE phase,
+                   const ap_uint<256> &beat,
+                   ap_uint<256> &held,
+                   const ap_uint<32> A_codebook[4][A_CODEBOOK_SIZE],
+                   ap_uint<27> A_tile[4][A_DELTA_TILES],
+                   ap_uint<256> &a_pes
+                  ) {
+#pragma HLS inline
+    if(A_format == A_FORMAT_FP32) {
+        a_pes = beat;
+        return;
+    }
+    for(INDEX_TYPE p = 0; p < 4; ++p) {
+        ap_uint<42> w;
+        if(A_format < A_FORMAT_FP16) {
+            if(phase == 0) {
+                w = beat(31 + p * 32, p * 32);
+            }
+            else {
+                w = held(159 + p * 32, 128 + p * 32);
+            }
+        }
+        else if(phase == 0) {
+            w = beat(41 + p * 42, p * 42);
+        }
+        else if((phase == 1) & (p < 2)) {
+            w = held(209 + p * 42, 168 + p * 42);
+        }
+        else if(phase == 1) {
+            w = beat(41 + (p - 2) * 42, (p - 2) * 42);
+        }
+        else {
+            w = held(125 + p * 42, 84 + p * 42);
+        }
+        a_pes(63 + p * 64, p * 64) = Decode_A_word(A_format, w, A_codebook[p], A_tile[p]);
+    }
+    if(phase < A_format_beats(A_format)) {
+        held = beat;
+    }
+}
+
 void MMU(tapa::istream<INDEX_TYPE> &PE_Param_in,
          tapa::istream<ap_uint<256>> &Matrix_A_Stream_256,
          tapa::istreams<VALUE_TYPE_v16, HBM_CHANNEL_B_NUM> &Matrix_B_Stream_in, 
          tapa::ostream<INDEX_TYPE> &PE_Param_out,
          tapa::ostreams<VALUE_TYPE_v16, HBM_CHANNEL_B_NUM> &Matrix_B_Stream_out,
          tapa::ostream<INDEX_TYPE> &PE_Param_to_C,
+#ifdef LEDA_PERF_COUNTERS
+         tapa::ostream<INDEX_TYPE_v16> &Perf_Stream,
+#endif
          tapa::ostreams<Matrix_Mult, 4> &Matrix_Mult_Matrix_Stream
         ) {
     const INDEX_TYPE Batch_num = PE_Param_in.read();
@@ -213,46 +435,125 @@ void MMU(tapa::istream<INDEX_TYPE> &PE_Param_in,
     const INDEX_TYPE N = PE_Param_in.read();
     const INDEX_TYPE K = PE_Param_in.read();
     const INDEX_TYPE Iteration_num = PE_Param_in.read();
+    const INDEX_TYPE N_slices = PE_Param_in.read();
+    const INDEX_TYPE A_format = PE_Param_in.read();
 
     PE_Param_out.write(Batch_num);
     PE_Param_out.write(M);
     PE_Param_out.write(N);
     PE_Param_out.write(K);
     PE_Param_out.write(Iteration_num);
+    PE_Param_out.write(N_slices);
+    PE_Param_out.write(A_format);
+
+    ap_uint<32> A_codebook[4][A_CODEBOOK_SIZE];
+#pragma HLS array_partition variable=A_codebook complete dim=1
+
+    const INDEX_TYPE Codebook_len = (A_format == A_FORMAT_CODEBOOK) ? A_CODEBOOK_SIZE : 0;
+Load_codebook:
+    for(INDEX_TYPE i = 0; i < Codebook_len; ++i) {
+#pragma HLS loop_tripcount min=0 max=256
+#pragma HLS pipeline II=1
+        INDEX_TYPE val = PE_Param_in.read();
+        PE_Param_out.write(val);
+        for(INDEX_TYPE p = 0; p < 4; ++p) {
+            A_codebook[p][i] = val;
+        }
+    }
+    // a delta batch loads a tile register before its first use
+    ap_uint<27> A_tile[4][A_DELTA_TILES];
+#pragma HLS array_partition variable=A_tile complete dim=0
+
+    const INDEX_TYPE A_slots = A_format_slots(A_format);
+    const INDEX_TYPE A_beats = A_format_beats(A_format);
     
     PE_Param_to_C.write(Batch_num);
     PE_Param_to_C.write(M);
     PE_Param_to_C.write(N);
     PE_Param_to_C.write(Iteration_num);
+    PE_Param_to_C.write(N_slices);
 
     const INDEX_TYPE Iteration_time = (Iteration_num == 0) ? 1 : Iteration_num;
     
-    const INDEX_TYPE Iteration_time_N = Iteration_time * ((N + 7) >> 3);
+    const INDEX_TYPE Iteration_time_N = Iteration_time * Pass_num(N, N_slices);
+
+    const INDEX_TYPE Block_num = (N + 7) >> 3;
+    const INDEX_TYPE Slice_width = Tile_WIDTH / N_slices;
+    const INDEX_TYPE Slice_lines = Slice_width >> 3;
     
 iter:
-    for(INDEX_TYPE rp = 0; rp < Iteration_time_N; rp++) {
+    for(INDEX_TYPE rp = 0, block = 0; rp < Iteration_time_N; rp++) {
 #pragma HLS loop_flatten off
 #pragma HLS loop_tripcount min=1 max=16
+        // slice s of the on-chip B window holds N-block block + s
+        const INDEX_TYPE Slices = (Block_num - block < N_slices) ? Block_num - block : N_slices;
         
-        VALUE_TYPE Matrix_B_onchip[4/2][8][Tile_WIDTH];
+        // B windows: batch fill_i loads into buffer fill_i % B_BUFFERS while
+        // batch mult_i multiplies from buffer mult_i % B_BUFFERS, and a buffer
+        // is only refilled once its batch is done, so fill_i < mult_i + B_BUFFERS;
+        // with one buffer the fill and the multiply take turns
+        VALUE_TYPE Matrix_B_onchip[B_BUFFERS][4/2][8][Tile_WIDTH];
 #pragma HLS bind_storage variable=Matrix_B_onchip latency=2
 #pragma HLS array_partition variable=Matrix_B_onchip complete dim=1
 #pragma HLS array_partition variable=Matrix_B_onchip complete dim=2
-#pragma HLS array_partition variable=Matrix_B_onchip cyclic factor=B_PARTITION_FACTOR dim=3
+#pragma HLS array_partition variable=Matrix_B_onchip complete dim=3
+#pragma HLS array_partition variable=Matrix_B_onchip cyclic factor=B_PARTITION_FACTOR dim=4
         
         INDEX_TYPE start_32 = PE_Param_in.read();
         PE_Param_out.write(start_32);
         PE_Param_to_C.write(start_32);
-        
-    main:
-        for(INDEX_TYPE i = 0; i < Batch_num; ++i) {
-#pragma HLS loop_tripcount min=1 max=49
-            
-        Fill_B_onchip:
-            for(INDEX_TYPE j = 0; (j < (Tile_WIDTH >> 3)) && (j < ((K + 7) >> 3) - i * (Tile_WIDTH >> 3)); ) {
-#pragma HLS loop_tripcount min=1 max=512
-#pragma HLS pipeline II = 1
-                
+
+#ifdef LEDA_PERF_COUNTERS
+        // one record per batch, filled in by both engines
+        INDEX_TYPE_v16 perf[2];
+        for(INDEX_TYPE b = 0; b < 2; ++b) {
+            for(INDEX_TYPE f = 0; f < PERF_WORDS; ++f) {
+                perf[b][f] = 0;
+            }
+            perf[b][PERF_N_BLOCK] = rp;
+            perf[b][PERF_BATCH] = b;
+        }
+#endif
+
+        INDEX_TYPE fill_i = 0;
+        INDEX_TYPE fill_j = 0;
+        INDEX_TYPE fill_jj = 0;
+        INDEX_TYPE fill_line_base = 0;
+        INDEX_TYPE fill_len = ((K + 7) >> 3 < Slice_lines) ? (K + 7) >> 3 : Slice_lines;
+
+        INDEX_TYPE mult_i = 0;
+        bool mult_started = false;
+        INDEX_TYPE end_32 = start_32;
+        INDEX_TYPE j = start_32;
+        INDEX_TYPE s = 0;
+        INDEX_TYPE b_base = 0;
+
+        // a slot is decoded once and multiplied with every slice of B; the
+        // batches are whole groups, so every batch starts at phase 0
+        ap_uint<256> a_pes;
+        ap_uint<256> a_held;
+        INDEX_TYPE a_phase = 0;
+
+    Fill_and_mult:
+        for(; mult_i < Batch_num; ) {
+#pragma HLS loop_tripcount min=1 max=10000
+#pragma HLS pipeline II=1
+#pragma HLS dependence false inter variable=Matrix_B_onchip
+#ifdef LEDA_PERF_COUNTERS
+            ++perf[mult_i & 1][PERF_MMU_CYCLES];
+#endif
+
+            // fill engine
+            const bool fill_allowed = (fill_i < Batch_num) & (fill_i < mult_i + B_BUFFERS);
+            if(fill_allowed & (fill_j >= Slices * fill_len)) {
+                ++fill_i;
+                fill_j = 0;
+                fill_jj = 0;
+                fill_line_base = 0;
+                fill_len = ((K + 7) >> 3) - fill_i * Slice_lines;
+                fill_len = (fill_len < 0) ? 0 : (fill_len < Slice_lines) ? fill_len : Slice_lines;
+            }
+            else if(fill_allowed) {
                 bool b_2048_ready = true;
                 bool b_2048_out_not_full = true;
                 for(INDEX_TYPE k = 0; k < HBM_CHANNEL_B_NUM; ++k) {
@@ -269,25 +570,53 @@ iter:
                     for(INDEX_TYPE k = 0; k < 8; ++k) {
                         for(INDEX_TYPE m = 0; m < 8; ++m) {
                             for(INDEX_TYPE l = 0; l < 2; ++l) {
-                                Matrix_B_onchip[l][m][(j << 3) + k] = b_512_x[m / 2][k + m % 2 * 8];
+                                Matrix_B_onchip[fill_i % B_BUFFERS][l][m][((fill_line_base + fill_jj) << 3) + k] = b_512_x[m / 2][k + m % 2 * 8];
                             }
                         }
                     }
-                    ++j;
+                    ++fill_j;
+                    if(fill_jj + 1 < fill_len) {
+                        ++fill_jj;
+                    }
+                    else {
+                        fill_jj = 0;
+                        fill_line_base += Slice_lines;
+                    }
+#ifdef LEDA_PERF_COUNTERS
+                    ++perf[fill_i & 1][PERF_FILL_ACTIVE];
+#endif
+                }
+#ifdef LEDA_PERF_COUNTERS
+                else if(!b_2048_ready) {
+                    ++perf[fill_i & 1][PERF_FILL_WAIT_B];
                 }
+                else {
+                    ++perf[fill_i & 1][PERF_FILL_WAIT_OUT];
+                }
+#endif
             }
-            
-            const INDEX_TYPE end_32 = PE_Param_in.read();
-            PE_Param_out.write(end_32);
-            PE_Param_to_C.write(end_32);
-            
-        Matrix_mult:
-            for(INDEX_TYPE j = start_32; j < end_32; ) {
-#pragma HLS loop_tripcount min=1 max=200
-#pragma HLS pipeline II=1                
-
-                ap_uint<256> a_pes;
 
+            // multiply engine, once the window of batch mult_i is loaded
+            if((fill_i > mult_i) & !mult_started) {
+                end_32 = PE_Param_in.read();
+                PE_Param_out.write(end_32);
+                PE_Param_to_C.write(end_32);
+                mult_started = true;
+            }
+            else if(mult_started & (j >= end_32)) {
+#ifdef LEDA_PERF_COUNTERS
+                if(rp < Pass_num(N, N_slices)) {
+                    Perf_Stream.write(perf[mult_i & 1]);
+                }
+                for(INDEX_TYPE f = PERF_BATCH + 1; f < PERF_WORDS; ++f) {
+                    perf[mult_i & 1][f] = 0;
+                }
+                perf[mult_i & 1][PERF_BATCH] = mult_i + 2;
+#endif
+                ++mult_i;
+                mult_started = false;
+            }
+            else if(mult_started) {
                 ap_uint<14> col_old[4];
                 for(INDEX_TYPE col = 0; col < 4; ++col) {
                     col_old[col] = 0x3FFF;
@@ -297,8 +626,31 @@ iter:
 #pragma HLS array_partition variable=Matrix_B_reusequeue complete dim=1
 #pragma HLS array_partition variable=Matrix_B_reusequeue complete dim=2
 
-                bool a_pes_ready = Matrix_A_Stream_256.try_read(a_pes);
+                const bool a_read = (s == 0) & (a_phase < A_beats);
+                ap_uint<256> a_beat;
+#ifdef LEDA_PERF_COUNTERS
+                // only take A when every product can leave, so a full
+                // output FIFO shows up as a counted cycle instead of a stall
+                bool mult_out_full = false;
+                for(INDEX_TYPE p = 0; p < 4; ++p) {
+                    mult_out_full |= Matrix_Mult_Matrix_Stream[p].full();
+                }
+                bool a_pes_ready = !mult_out_full && (!a_read || Matrix_A_Stream_256.try_read(a_beat));
+                if(!a_pes_ready) {
+                    ++perf[mult_i & 1][mult_out_full ? PERF_MULT_WAIT_OUT : PERF_MULT_WAIT_A];
+                }
+                else if(a_read) {
+                    ++perf[mult_i & 1][PERF_MULT_A_READS];
+                }
+#else
+                bool a_pes_ready = !a_read || Matrix_A_Stream_256.try_read(a_beat);
+#endif
                 
+                if(a_pes_ready & (s == 0)) {
+                    Decode_A_slot(A_format, a_phase, a_beat, a_held, A_codebook, A_tile, a_pes);
+                    a_phase = (a_phase + 1 < A_slots) ? a_phase + 1 : 0;
+                }
+
                 if(a_pes_ready) {
                          
                 PE:
@@ -313,20 +665,38 @@ iter:
                         mult_val.row = a_row;
 
                         if (a_row[17] == 0) {
-                            Outer_Product_Unit_Merge(a_col,
+                            Outer_Product_Unit_Merge(b_base + a_col,
                                                      col_old[p],
                                                      a_val,
-                                                     Matrix_B_onchip[p/2],
+                                                     Matrix_B_onchip[mult_i % B_BUFFERS][p/2],
                                                      Matrix_B_reusequeue[p],
                                                      mult_val.val
                                                     );
+#ifdef LEDA_PERF_COUNTERS
+                            ++perf[mult_i & 1][PERF_MULT_USEFUL + p];
+#endif
                         }
                         Matrix_Mult_Matrix_Stream[p].write(mult_val);
                     }
-                    ++j;
+                    if(s + 1 < Slices) {
+                        ++s;
+                        b_base += Slice_width;
+                    }
+                    else {
+                        s = 0;
+                        b_base = 0;
+                        ++j;
+                    }
+#ifdef LEDA_PERF_COUNTERS
+                    ++perf[mult_i & 1][PERF_MULT_ACTIVE];
+#endif
                 }
             }
-            start_32 = end_32;
+        }
+
+        block += N_slices;
+        if(block >= Block_num) {
+            block = 0;
         }
     }
 }
@@ -370,6 +740,9 @@ void Adder_Unit(ap_uint<18> C_row,
 
 void MAU(tapa::istreams<INDEX_TYPE, 2> &PE_inst_in,
          tapa::istreams<Matrix_Mult, 8> &Matrix_Mult_Matrix_Stream,
+#ifdef LEDA_PERF_COUNTERS
+         tapa::ostream<INDEX_TYPE_v16> &Perf_Stream,
+#endif
          tapa::ostream<VALUE_TYPE_v16> &Matrix_C_Stream_out
         ) {
 
@@ -377,15 +750,20 @@ void MAU(tapa::istreams<INDEX_TYPE, 2> &PE_inst_in,
     const INDEX_TYPE M = PE_inst_in[0].read();
     const INDEX_TYPE N = PE_inst_in[0].read();
     const INDEX_TYPE Iteration_num = PE_inst_in[0].read();
+    const INDEX_TYPE N_slices = PE_inst_in[0].read();
     
     INDEX_TYPE tmp;
 Destroy_PE_inst:
-    for(INDEX_TYPE i = 0; i < 4; ++i) {
+    for(INDEX_TYPE i = 0; i < 5; ++i) {
         tmp = PE_inst_in[1].read();
     }
 
     const INDEX_TYPE Iteration_time = (Iteration_num == 0) ? 1 : Iteration_num;
-    const INDEX_TYPE Iteration_time_N = Iteration_time * ((N + 7) >> 3);
+    const INDEX_TYPE Iteration_time_N = Iteration_time * Pass_num(N, N_slices);
+
+    // slice s of the C rows, at s * Slice_depth, holds N-block block + s
+    const INDEX_TYPE Block_num = (N + 7) >> 3;
+    const INDEX_TYPE Slice_depth = URAM_DEPTH / N_slices;
 
     const INDEX_TYPE num_v_init = (M + 63) >> 6;
     const INDEX_TYPE num_v_out = (M + 15) >> 4;
@@ -396,20 +774,28 @@ Destroy_PE_inst:
 #pragma HLS array_partition complete variable=Matrix_C_onchip dim=2
     
 iter:
-    for(INDEX_TYPE rp = 0; rp < Iteration_time_N; rp++) {
+    for(INDEX_TYPE rp = 0, block = 0; rp < Iteration_time_N; rp++) {
 #pragma HLS loop_flatten off
 #pragma HLS loop_tripcount min=1 max=16
+        const INDEX_TYPE Slices = (Block_num - block < N_slices) ? Block_num - block : N_slices;
         
     Init_C_onchip:
-        for(INDEX_TYPE i = 0; i < num_v_init; ++i) {
+        for(INDEX_TYPE v = 0, i = 0, c_base = 0; v < Slices * num_v_init; ++v) {
 #pragma HLS loop_tripcount min=1 max=800
 #pragma HLS pipeline II=1
 
             for(INDEX_TYPE j = 0; j < 8; ++j) {
                 for(INDEX_TYPE k = 0; k < 4; ++k) {
-                    Matrix_C_onchip[j][k][i] = 0;
+                    Matrix_C_onchip[j][k][c_base + i] = 0;
                 }
             }
+            if(i + 1 < num_v_init) {
+                ++i;
+            }
+            else {
+                i = 0;
+                c_base += Slice_depth;
+            }
         }
         
         INDEX_TYPE start_32 = PE_inst_in[0].read();
@@ -422,9 +808,17 @@ iter:
             
             const INDEX_TYPE end_32 = PE_inst_in[0].read();
             tmp = PE_inst_in[1].read();
+#ifdef LEDA_PERF_COUNTERS
+            INDEX_TYPE_v16 perf;
+            for(INDEX_TYPE f = 0; f < PERF_WORDS; ++f) {
+                perf[f] = 0;
+            }
+            perf[PERF_N_BLOCK] = rp;
+            perf[PERF_BATCH] = i;
+#endif
 
         Accumulate:
-            for(INDEX_TYPE j = start_32; j < end_32; ) {
+            for(INDEX_TYPE j = start_32, s = 0, c_base = 0; j < end_32; ) {
 #pragma HLS loop_tripcount min=1 max=200
 #pragma HLS pipeline II=1
 #pragma HLS dependence true variable=Matrix_C_onchip distance=WINDOWS
@@ -442,20 +836,44 @@ iter:
                         ap_uint<18> a_row = mult_val.row;
                         
                         if(a_row[17] == 0) {
-                            Adder_Unit(a_row,
+                            Adder_Unit(a_row + c_base,
                                        mult_val.val,
                                        Matrix_C_onchip[p]
                                       );
+#ifdef LEDA_PERF_COUNTERS
+                            ++perf[PERF_ACC_USEFUL];
+#endif
                         }
                     }
-                    ++j;
+                    if(s + 1 < Slices) {
+                        ++s;
+                        c_base += Slice_depth;
+                    }
+                    else {
+                        s = 0;
+                        c_base = 0;
+                        ++j;
+                    }
+#ifdef LEDA_PERF_COUNTERS
+                    ++perf[PERF_ACC_ACTIVE];
+#endif
+                }
+#ifdef LEDA_PERF_COUNTERS
+                else {
+                    ++perf[PERF_ACC_WAIT];
                 }
+#endif
             }
             start_32 = end_32;
+#ifdef LEDA_PERF_COUNTERS
+            if(rp < Pass_num(N, N_slices)) {
+                Perf_Stream.write(perf);
+            }
+#endif
         }
 
 Write_C_onchip:
-        for(INDEX_TYPE i = 0; i < num_v_out; ++i) {
+        for(INDEX_TYPE v = 0, i = 0, c_base = 0; v < Slices * num_v_out; ++v) {
 #pragma HLS loop_tripcount min=1 max=1800
 #pragma HLS pipeline II=1
 
@@ -466,51 +884,51 @@ Write_C_onchip:
 
             switch(i % 4) {
 					case 0:
-						u_64_pe_d[0][0] = Matrix_C_onchip[0][0][i/4];
-						u_64_pe_d[0][1] = Matrix_C_onchip[0][1][i/4];
-						u_64_pe_d[0][2] = Matrix_C_onchip[0][2][i/4];
-						u_64_pe_d[0][3] = Matrix_C_onchip[0][3][i/4];
+						u_64_pe_d[0][0] = Matrix_C_onchip[0][0][c_base + i/4];
+						u_64_pe_d[0][1] = Matrix_C_onchip[0][1][c_base + i/4];
+						u_64_pe_d[0][2] = Matrix_C_onchip[0][2][c_base + i/4];
+						u_64_pe_d[0][3] = Matrix_C_onchip[0][3][c_base + i/4];
 
-						u_64_pe_d[1][0] = Matrix_C_onchip[1][0][i/4];
-						u_64_pe_d[1][1] = Matrix_C_onchip[1][1][i/4];
-						u_64_pe_d[1][2] = Matrix_C_onchip[1][2][i/4];
-						u_64_pe_d[1][3] = Matrix_C_onchip[1][3][i/4];
+						u_64_pe_d[1][0] = Matrix_C_onchip[1][0][c_base + i/4];
+						u_64_pe_d[1][1] = Matrix_C_onchip[1][1][c_base + i/4];
+						u_64_pe_d[1][2] = Matrix_C_onchip[1][2][c_base + i/4];
+						u_64_pe_d[1][3] = Matrix_C_onchip[1][3][c_base + i/4];
 
 						break;
 					case 1:
-						u_64_pe_d[0][0] = Matrix_C_onchip[2][0][i/4];
-						u_64_pe_d[0][1] = Matrix_C_onchip[2][1][i/4];
-						u_64_pe_d[0][2] = Matrix_C_onchip[2][2][i/4];
-						u_64_pe_d[0][3] = Matrix_C_onchip[2][3][i/4];
+						u_64_pe_d[0][0] = Matrix_C_onchip[2][0][c_base + i/4];
+						u_64_pe_d[0][1] = Matrix_C_onchip[2][1][c_base + i/4];
+						u_64_pe_d[0][2] = Matrix_C_onchip[2][2][c_base + i/4];
+						u_64_pe_d[0][3] = Matrix_C_onchip[2][3][c_base + i/4];
 
-						u_64_pe_d[1][0] = Matrix_C_onchip[3][0][i/4];
-						u_64_pe_d[1][1] = Matrix_C_onchip[3][1][i/4];
-						u_64_pe_d[1][2] = Matrix_C_onchip[3][2][i/4];
-						u_64_pe_d[1][3] = Matrix_C_onchip[3][3][i/4];
+						u_64_pe_d[1][0] = Matrix_C_onchip[3][0][c_base + i/4];
+						u_64_pe_d[1][1] = Matrix_C_onchip[3][1][c_base + i/4];
+						u_64_pe_d[1][2] = Matrix_C_onchip[3][2][c_base + i/4];
+						u_64_pe_d[1][3] = Matrix_C_onchip[3][3][c_base + i/4];
 
 						break;
 					case 2:
-						u_64_pe_d[0][0] = Matrix_C_onchip[4][0][i/4];
-						u_64_pe_d[0][1] = Matrix_C_onchip[4][1][i/4];
-						u_64_pe_d[0][2] = Matrix_C_onchip[4][2][i/4];
-						u_64_pe_d[0][3] = Matrix_C_onchip[4][3][i/4];
+						u_64_pe_d[0][0] = Matrix_C_onchip[4][0][c_base + i/4];
+						u_64_pe_d[0][1] = Matrix_C_onchip[4][1][c_base + i/4];
+						u_64_pe_d[0][2] = Matrix_C_onchip[4][2][c_base + i/4];
+						u_64_pe_d[0][3] = Matrix_C_onchip[4][3][c_base + i/4];
 
-						u_64_pe_d[1][0] = Matrix_C_onchip[5][0][i/4];
-						u_64_pe_d[1][1] = Matrix_C_onchip[5][1][i/4];
-						u_64_pe_d[1][2] = Matrix_C_onchip[5][2][i/4];
-						u_64_pe_d[1][3] = Matrix_C_onchip[5][3][i/4];
+						u_64_pe_d[1][0] = Matrix_C_onchip[5][0][c_base + i/4];
+						u_64_pe_d[1][1] = Matrix_C_onchip[5][1][c_base + i/4];
+						u_64_pe_d[1][2] = Matrix_C_onchip[5][2][c_base + i/4];
+						u_64_pe_d[1][3] = Matrix_C_onchip[5][3][c_base + i/4];
 
 						break;
 					case 3:
-						u_64_pe_d[0][0] = Matrix_C_onchip[6][0][i/4];
-						u_64_pe_d[0][1] = Matrix_C_onchip[6][1][i/4];
-						u_64_pe_d[0][2] = Matrix_C_onchip[6][2][i/4];
-						u_64_pe_d[0][3] = Matrix_C_onchip[6][3][i/4];
+						u_64_pe_d[0][0] = Matrix_C_onchip[6][0][c_base + i/4];
+						u_64_pe_d[0][1] = Matrix_C_onchip[6][1][c_base + i/4];
+						u_64_pe_d[0][2] = Matrix_C_onchip[6][2][c_base + i/4];
+						u_64_pe_d[0][3] = Matrix_C_onchip[6][3][c_base + i/4];
 
-						u_64_pe_d[1][0] = Matrix_C_onchip[7][0][i/4];
-						u_64_pe_d[1][1] = Matrix_C_onchip[7][1][i/4];
-						u_64_pe_d[1][2] = Matrix_C_onchip[7][2][i/4];
-						u_64_pe_d[1][3] = Matrix_C_onchip[7][3][i/4];
+						u_64_pe_d[1][0] = Matrix_C_onchip[7][0][c_base + i/4];
+						u_64_pe_d[1][1] = Matrix_C_onchip[7][1][c_base + i/4];
+						u_64_pe_d[1][2] = Matrix_C_onchip[7][2][c_base + i/4];
+						u_64_pe_d[1][3] = Matrix_C_onchip[7][3][c_base + i/4];
 
 						break;
 				}
@@ -528,6 +946,18 @@ Write_C_onchip:
                     out[d * 2 + 1] = tapa::bit_cast<VALUE_TYPE>(u_32_d[d][1]);
 				}
             Matrix_C_Stream_out.write(out);
+            if(i + 1 < num_v_out) {
+                ++i;
+            }
+            else {
+                i = 0;
+                c_base += Slice_depth;
+            }
+        }
+
+        block += N_slices;
+        if(block >= Block_num) {
+            block = 0;
         }
     }
 }
@@ -571,6 +1001,48 @@ void Merger(tapa::istreams<VALUE_TYPE_v16, HBM_CHANNEL_C_NUM> & Matrix_C_Stream_
     }
 }
 
+#ifdef LEDA_PERF_COUNTERS
+void Perf_Collector(const INDEX_TYPE Batch_num,
+                    const INDEX_TYPE N,
+                    const INDEX_TYPE N_slices,
+                    tapa::istreams<INDEX_TYPE_v16, PERF_SOURCE_NUM> &Perf_Stream,
+                    tapa::async_mmap<INDEX_TYPE_v16> &Perf_counters
+                   ) {
+    const INDEX_TYPE Record_num = Perf_record_num(Batch_num, N, N_slices);
+
+Write_perf:
+    for(INDEX_TYPE i_req = 0, i_resp = 0; i_resp < Record_num;) {
+#pragma HLS loop_tripcount min=1 max=20000
+#pragma HLS pipeline II=1
+        // fixed priority is enough, every source sends at most one record per batch
+        bool found = false;
+        INDEX_TYPE src = 0;
+        for(INDEX_TYPE s = 0; s < PERF_SOURCE_NUM; ++s) {
+            if(!found & !Perf_Stream[s].empty()) {
+                found = true;
+                src = s;
+            }
+        }
+        if((i_req < Record_num) & found & !Perf_counters.write_addr.full() & !Perf_counters.write_data.full()) {
+            INDEX_TYPE_v16 record;
+            for(INDEX_TYPE s = 0; s < PERF_SOURCE_NUM; ++s) {
+                if(s == src) {
+                    Perf_Stream[s].try_read(record);
+                }
+            }
+            record[PERF_SOURCE] = src;
+            Perf_counters.write_addr.try_write(i_req);
+            Perf_counters.write_data.try_write(record);
+            ++i_req;
+        }
+        uint8_t n_resp;
+        if(Perf_counters.write_resp.try_read(n_resp)) {
+            i_resp += INDEX_TYPE(n_resp) + 1;
+        }
+    }
+}
+#endif
+
 void Destroy_int(tapa::istream<INDEX_TYPE> &Stream_in) {
     for(;;) {
 #pragma HLS pipeline II=1
@@ -595,12 +1067,18 @@ void Leda(tapa::mmap<INDEX_TYPE> SpElement_list_ptr,
           tapa::mmaps<VALUE_TYPE_v16, HBM_CHANNEL_B_NUM> Matrix_B_data,
         
           tapa::mmaps<VALUE_TYPE_v16, HBM_CHANNEL_C_NUM> Matrix_C_data,
+#ifdef LEDA_PERF_COUNTERS
+
+          tapa::mmap<INDEX_TYPE_v16> Perf_counters,
+#endif
         
           const INDEX_TYPE Batch_num,
           const INDEX_TYPE Sparse_Matrix_len,
           const INDEX_TYPE M,
           const INDEX_TYPE K,
           const INDEX_TYPE N,
+          const INDEX_TYPE N_slices,
+          const INDEX_TYPE A_format,
           const INDEX_TYPE Iteration_num
           ) {
     tapa::streams<INDEX_TYPE, HBM_CHANNEL_A_NUM * UNIT_NUM + 1, FIFO_DEPTH> PE_Param("PE_Param");
@@ -618,6 +1096,11 @@ void Leda(tapa::mmap<INDEX_TYPE> SpElement_list_ptr,
     tapa::streams<Matrix_Mult, HBM_CHANNEL_A_NUM * 8, FIFO_DEPTH> Matrix_Mult_Matrix_Stream("Matrix_Mult_Matrix_Stream");
     
     tapa::streams<VALUE_TYPE_v16, HBM_CHANNEL_C_NUM, FIFO_DEPTH> Matrix_C_Result_Stream("Matrix_C_Result_Stream");
+
+#ifdef LEDA_PERF_COUNTERS
+    // written by the MMUs, then the MAUs, then the C writers, in invoke order
+    tapa::streams<INDEX_TYPE_v16, PERF_SOURCE_NUM, FIFO_DEPTH> Perf_Stream("Perf_Stream");
+#endif
     
     tapa::task()
 
@@ -625,6 +1108,8 @@ void Leda(tapa::mmap<INDEX_TYPE> SpElement_list_ptr,
                 Batch_num,
                 M,
                 N,
+                N_slices,
+                A_format,
                 K,
                 Iteration_num,
                 SpElement_list_ptr,
@@ -634,6 +1119,8 @@ void Leda(tapa::mmap<INDEX_TYPE> SpElement_list_ptr,
         .invoke<tapa::join, HBM_CHANNEL_A_NUM>(Sparse_Matrix_Loader,
                                                Sparse_Matrix_len,
                                                N,
+                                               N_slices,
+                                               A_format,
                                                Iteration_num,
                                                Matrix_A_data,
                                                Matrix_A_Stream
@@ -647,6 +1134,7 @@ void Leda(tapa::mmap<INDEX_TYPE> SpElement_list_ptr,
         .invoke<tapa::join, HBM_CHANNEL_B_NUM>(Dense_Matrix_Loader,
                                                K,
                                                N,
+                                               N_slices,
                                                Iteration_num,
                                                Matrix_B_data,
                                                Matrix_B_Stream
@@ -659,12 +1147,18 @@ void Leda(tapa::mmap<INDEX_TYPE> SpElement_list_ptr,
                                                           PE_Param, 
                                                           Matrix_B_Stream,
                                                           PE_Param_to_C,
+#ifdef LEDA_PERF_COUNTERS
+                                                          Perf_Stream,
+#endif
                                                           Matrix_Mult_Matrix_Stream
                                                          )
 
         .invoke<tapa::join, HBM_CHANNEL_C_NUM>(MAU,
                                                PE_Param_to_C,
                                                Matrix_Mult_Matrix_Stream,
+#ifdef LEDA_PERF_COUNTERS
+                                               Perf_Stream,
+#endif
                                                Matrix_C_Stream
                                               )
     
@@ -686,8 +1180,21 @@ void Leda(tapa::mmap<INDEX_TYPE> SpElement_list_ptr,
                                                N,
                                                Iteration_num,
                                                Matrix_C_Result_Stream,
+#ifdef LEDA_PERF_COUNTERS
+                                               Perf_Stream,
+#endif
                                                Matrix_C_data
                                               )
+#ifdef LEDA_PERF_COUNTERS
+
+        .invoke<tapa::join>(Perf_Collector,
+                            Batch_num,
+                            N,
+                            N_slices,
+                            Perf_Stream,
+                            Perf_counters
+                           )
+#endif
     ;
 }
 
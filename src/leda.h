@@ -19,7 +19,17 @@ constexpr INDEX_TYPE FIFO_DEPTH = 2;
 
 constexpr INDEX_TYPE Tile_SIZE = 16;
 
-constexpr INDEX_TYPE BATCH_SIZE = 4096 / Tile_SIZE;
+// B prefetch (-DLEDA_B_PREFETCH): every MMU keeps two B windows, and the
+// window of batch i + 1 is filled while batch i multiplies. The windows are
+// half as wide, so the B storage of an MMU stays that of one 4096-column
+// window, and the image is built with batches half as wide
+#ifdef LEDA_B_PREFETCH
+constexpr INDEX_TYPE B_BUFFERS = 2;
+#else
+constexpr INDEX_TYPE B_BUFFERS = 1;
+#endif
+
+constexpr INDEX_TYPE BATCH_SIZE = 4096 / B_BUFFERS / Tile_SIZE;
 
 const INDEX_TYPE Tile_WIDTH = BATCH_SIZE * Tile_SIZE;
 
@@ -29,19 +39,127 @@ const INDEX_TYPE URAM_DEPTH = 8192;
 
 const INDEX_TYPE WINDOWS = 10;
 
+// Wide-N mode: one pass over A serves N_slices N-blocks of 8 columns, so A
+// is read once per 8 * N_slices columns of B. The B window of a batch and
+// the C rows of every PE are cut into N_slices slices: the A image is built
+// with batches of Tile_WIDTH / N_slices columns, and a kernel run holds
+// URAM_DEPTH / N_slices rows per PE. N_slices is a power of two.
+constexpr INDEX_TYPE N_SLICES_MAX = 16;
+
+constexpr INDEX_TYPE Pass_num(const INDEX_TYPE N, const INDEX_TYPE N_slices) {
+    return (((N + 7) >> 3) + N_slices - 1) / N_slices;
+}
+
+// A word formats. A_FORMAT_FP32 is the 64-bit word of a 14-bit column, an
+// 18-bit row and a float value, so a 256-bit beat of an MMU holds one slot
+// of its 4 lanes. The compressed formats pack A_format_slots slots into
+// A_format_beats beats, the word of lane p of slot q at k = 4 q + p:
+//   pattern   32-bit column | row, every value 1.0, 2 slots per beat
+//   codebook  8-bit value index | 12-bit column | 12-bit row, 2 slots per
+//             beat, the index A_CODEBOOK_SIZE - 1 marks padding
+//   fp16/bf16 16-bit value | 12-bit column | 14-bit row with the padding
+//             flag on top, 42-bit words, 3 slots per 2 beats
+//   delta     42-bit words, 3 slots per 2 beats, against A_DELTA_TILES
+//             tile registers of every lane, each a row and a window of 32
+//             columns: a header (bit 41 set) is a padding slot that loads
+//             register [40:37] with a 9-bit window | 18-bit row, a data word
+//             holds register [40:37] | 5-bit column offset | fp32 value
+// Every batch is padded to whole groups of slots. The codebook follows the
+// batch pointers in SpElement_list_ptr.
+constexpr INDEX_TYPE A_FORMAT_FP32     = 0;
+constexpr INDEX_TYPE A_FORMAT_PATTERN  = 1;
+constexpr INDEX_TYPE A_FORMAT_CODEBOOK = 2;
+constexpr INDEX_TYPE A_FORMAT_FP16     = 3;
+constexpr INDEX_TYPE A_FORMAT_BF16     = 4;
+constexpr INDEX_TYPE A_FORMAT_DELTA    = 5;
+constexpr INDEX_TYPE A_FORMAT_NUM      = 6;
+
+constexpr INDEX_TYPE A_CODEBOOK_SIZE = 256;
+
+constexpr INDEX_TYPE A_DELTA_TILES = 16;
+
+constexpr INDEX_TYPE A_format_slots(const INDEX_TYPE A_format) {
+    return (A_format == A_FORMAT_FP32) ? 1 : (A_format < A_FORMAT_FP16) ? 2 : 3;
+}
+
+constexpr INDEX_TYPE A_format_beats(const INDEX_TYPE A_format) {
+    return (A_format < A_FORMAT_FP16) ? 1 : 2;
+}
+
+// lines of every A channel for Sparse_Matrix_len padded slots
+constexpr INDEX_TYPE A_format_lines(const INDEX_TYPE Sparse_Matrix_len, const INDEX_TYPE A_format) {
+    return Sparse_Matrix_len / A_format_slots(A_format) * A_format_beats(A_format);
+}
+
+// rows of every PE the row field can address
+constexpr INDEX_TYPE A_format_rows(const INDEX_TYPE A_format) {
+    return (A_format == A_FORMAT_CODEBOOK) ? 4096 : URAM_DEPTH;
+}
+
 using VALUE_TYPE_v16 = tapa::vec_t<VALUE_TYPE, 16>;
 using VALUE_TYPE_v8  = tapa::vec_t<VALUE_TYPE, 8>;
+using INDEX_TYPE_v16 = tapa::vec_t<INDEX_TYPE, 16>;
+
+// Kernel performance counters, compiled in with LEDA_PERF_COUNTERS. For the
+// first iteration, every MMU and MAU sends one record per (pass over A,
+// batch) and every C writer one record per N-block; Perf_Collector stamps
+// the source and writes the records to Perf_counters in arrival order.
+constexpr INDEX_TYPE PERF_WORDS       = 16;
+constexpr INDEX_TYPE PERF_MMU_BASE    = 0;
+constexpr INDEX_TYPE PERF_MAU_BASE    = PERF_MMU_BASE + HBM_CHANNEL_A_NUM * UNIT_NUM;
+constexpr INDEX_TYPE PERF_WRITER_BASE = PERF_MAU_BASE + HBM_CHANNEL_C_NUM;
+constexpr INDEX_TYPE PERF_SOURCE_NUM  = PERF_WRITER_BASE + HBM_CHANNEL_C_NUM;
+
+// record header
+constexpr INDEX_TYPE PERF_SOURCE  = 0;
+constexpr INDEX_TYPE PERF_N_BLOCK = 1;
+constexpr INDEX_TYPE PERF_BATCH   = 2;
+
+// MMU, the fill and multiply cycles of the batch, the non-padding elements
+// of lane p at PERF_MULT_USEFUL + p, the 256-bit A words it read, and the
+// MMU cycles from the end of the previous batch to the end of this one; the
+// fill of a batch overlaps the multiply of the one before it, so fill and
+// multiply cycles can add up to more than the MMU cycles
+constexpr INDEX_TYPE PERF_FILL_ACTIVE    = 3;
+constexpr INDEX_TYPE PERF_FILL_WAIT_B    = 4;
+constexpr INDEX_TYPE PERF_FILL_WAIT_OUT  = 5;
+constexpr INDEX_TYPE PERF_MULT_ACTIVE    = 6;
+constexpr INDEX_TYPE PERF_MULT_WAIT_A    = 7;
+constexpr INDEX_TYPE PERF_MULT_WAIT_OUT  = 8;
+constexpr INDEX_TYPE PERF_MULT_USEFUL    = 9;
+constexpr INDEX_TYPE PERF_MULT_A_READS   = 13;
+constexpr INDEX_TYPE PERF_MMU_CYCLES     = 14;
+
+// MAU, cycles of Accumulate and non-padding elements over its 8 inputs
+constexpr INDEX_TYPE PERF_ACC_ACTIVE     = 3;
+constexpr INDEX_TYPE PERF_ACC_WAIT       = 4;
+constexpr INDEX_TYPE PERF_ACC_USEFUL     = 5;
+
+// Dense_Matrix_Writer, cycles of Write_C
+constexpr INDEX_TYPE PERF_WRITE_ACTIVE    = 3;
+constexpr INDEX_TYPE PERF_WRITE_WAIT_C    = 4;
+constexpr INDEX_TYPE PERF_WRITE_WAIT_MEM  = 5;
+constexpr INDEX_TYPE PERF_WRITE_WAIT_RESP = 6;
+
+constexpr INDEX_TYPE Perf_record_num(const INDEX_TYPE Batch_num, const INDEX_TYPE N, const INDEX_TYPE N_slices) {
+    return Pass_num(N, N_slices) * (PERF_MAU_BASE + HBM_CHANNEL_C_NUM) * Batch_num + ((N + 7) >> 3) * HBM_CHANNEL_C_NUM;
+}
 
 void Leda(tapa::mmap<INDEX_TYPE> SpElement_list_ptr,
           tapa::mmaps<ap_uint<512>, HBM_CHANNEL_A_NUM> Matrix_A_data,
           tapa::mmaps<VALUE_TYPE_v16, HBM_CHANNEL_B_NUM> Matrix_B_data,
           tapa::mmaps<VALUE_TYPE_v16, HBM_CHANNEL_C_NUM> Matrix_C_data,
+#ifdef LEDA_PERF_COUNTERS
+          tapa::mmap<INDEX_TYPE_v16> Perf_counters,
+#endif
 
           const INDEX_TYPE Batch_num, 
           const INDEX_TYPE Sparse_Matrix_len, 
           const INDEX_TYPE M, 
           const INDEX_TYPE K,
           const INDEX_TYPE N,
+          const INDEX_TYPE N_slices,
+          const INDEX_TYPE A_format,
           const INDEX_TYPE Iteration_num
          );
 
@@ -0,0 +1,209 @@
+#ifndef LEDA_AUTOTUNE_H
+#define LEDA_AUTOTUNE_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include "leda.h"
+#include "leda_common.h"
+#include "leda_model.h"
+
+// Host-side tuning of the preprocessing for one matrix. The bitstream fixes
+// the B window (Tile_WIDTH columns), the accumulators (URAM_DEPTH rows) and
+// the shortest distance between two nonzeros of a row (WINDOWS), so the
+// candidates are the ones these allow:
+//   Tile_SIZE   the tile of the column reorder, up to the 16 rows of a mask
+//   BATCH_SIZE  tiles per batch; a batch must match the B window of the
+//               kernel, Tile_WIDTH / N_slices columns, so a narrower batch
+//               is a larger N_slices
+//   WINDOWS     the distance of the bitstream; a larger one is allowed but
+//               never gives a shorter list
+// Every candidate runs the whole pipelined preprocessing and is ranked by
+// the cycles of Model_kernel_cycles, which streams the A image once per pass:
+// a larger N_slices saves passes, and with them A reads, but pays for it in
+// narrower batches. Equal cycles go to the fewest A bytes. The choice is
+// recorded in <matrix>.ledatune next to the matrix, together with what it
+// depends on.
+
+constexpr INDEX_TYPE LEDA_TUNE_VERSION = 2;
+
+struct Tune_Config {
+    INDEX_TYPE Tile_SIZE;
+    INDEX_TYPE BATCH_SIZE;
+    INDEX_TYPE WINDOWS;
+    INDEX_TYPE N_slices;
+};
+
+struct Tune_Result {
+    Tune_Config config;
+    INDEX_TYPE  Sparse_Matrix_len;
+    double      padding;
+    double      fill_lines;
+    double      A_bytes;
+    double      cycles;
+    INDEX_TYPE  bottleneck;
+};
+
+// N_slices from N_slices_min up to N_slices_max, every Tile_SIZE that
+// divides the batch
+vector<Tune_Config> Autotune_candidates(const INDEX_TYPE N_slices_min, const INDEX_TYPE N_slices_max) {
+    vector<Tune_Config> candidates;
+    for(INDEX_TYPE s = N_slices_min; s <= N_slices_max; s *= 2) {
+        for(INDEX_TYPE tile = 4; tile <= 16; tile *= 2) {
+            INDEX_TYPE width = Tile_WIDTH / s;
+            if(width % tile == 0) {
+                Tune_Config config = {tile, width / tile, WINDOWS, s};
+                candidates.push_back(config);
+            }
+        }
+    }
+    return candidates;
+}
+
+// the schedule figures of one candidate: B fill lines per N-block, the A
+// bytes of all passes, and the modelled cycles and bottleneck of the run
+Tune_Result Evaluate_tune_config(const Tune_Config &config,
+                                 const INDEX_TYPE M,
+                                 const INDEX_TYPE K,
+                                 const INDEX_TYPE N,
+                                 const INDEX_TYPE nnzR,
+                                 const vector<INDEX_TYPE> &RowIdx_COO,
+                                 const vector<INDEX_TYPE> &ColIdx_COO,
+                                 const vector<VALUE_TYPE> &Val_COO,
+                                 const INDEX_TYPE SCHEDULER,
+                                 const INDEX_TYPE A_format = A_FORMAT_FP32,
+                                 const Model_Params &params = Default_model_params()
+                                ) {
+    vector<INDEX_TYPE> SpElement_list_ptr;
+    vector<aligned_vector<unsigned long> > Matrix_A_fpga_data(HBM_CHANNEL_A_NUM);
+    Create_Matrix_A_data_FPGA_pipelined<HBM_CHANNEL_A_NUM>(M,
+                                                           K,
+                                                           nnzR,
+                                                           RowIdx_COO,
+                                                           ColIdx_COO,
+                                                           Val_COO,
+                                                           config.Tile_SIZE,
+                                                           config.BATCH_SIZE,
+                                                           config.WINDOWS,
+                                                           SCHEDULER,
+                                                           SpElement_list_ptr,
+                                                           Matrix_A_fpga_data
+                                                          );
+    const INDEX_TYPE Batch_num = SpElement_list_ptr.size() - 1;
+    const INDEX_TYPE NUM_PE = PE_NUM * HBM_CHANNEL_A_NUM;
+
+    Tune_Result result;
+    result.config = config;
+    result.Sparse_Matrix_len = SpElement_list_ptr[Batch_num];
+    double slots = (double)result.Sparse_Matrix_len * NUM_PE;
+    result.padding = (slots > 0) ? 100.0 * (slots - nnzR) / slots : 0.0;
+    result.fill_lines = min((INDEX_TYPE)((K + 7) / 8), Batch_num * (Tile_WIDTH / config.N_slices / 8));
+    result.A_bytes = 64.0 * A_format_lines(result.Sparse_Matrix_len, A_format) * HBM_CHANNEL_A_NUM * Pass_num(N, config.N_slices);
+    Model_Result model = Model_kernel_cycles(M, K, N, SpElement_list_ptr, config.N_slices, A_format, params);
+    result.cycles = model.cycles;
+    result.bottleneck = model.bottleneck;
+    return result;
+}
+
+void Print_tune_results(const vector<Tune_Result> &results, const size_t best) {
+    printf("%9s %10s %7s %8s %10s %8s %10s %10s %12s  %s\n",
+           "Tile_SIZE", "BATCH_SIZE", "WINDOWS", "N_slices", "slots", "padding", "B fill", "A MB", "cycles", "bottleneck");
+    for(size_t i = 0; i < results.size(); ++i) {
+        const Tune_Result &r = results[i];
+        printf("%9d %10d %7d %8d %10d %7.2f%% %10.0f %10.2f %12.0f  %s%s\n",
+               r.config.Tile_SIZE, r.config.BATCH_SIZE, r.config.WINDOWS, r.config.N_slices,
+               r.Sparse_Matrix_len, r.padding, r.fill_lines, r.A_bytes / 1048576.0, r.cycles,
+               Model_stage_name(r.bottleneck), i == best ? " *" : "");
+    }
+}
+
+// what a recorded choice depends on: the matrix after any row renumbering,
+// the kernel, the options that limit the candidates, and the N and A format
+// the model ranks them for
+struct Tune_Key {
+    uint64_t   content_hash;
+    INDEX_TYPE Tile_WIDTH;
+    INDEX_TYPE WINDOWS;
+    INDEX_TYPE URAM_DEPTH;
+    INDEX_TYPE NUM_PE;
+    INDEX_TYPE N_slices_min;
+    INDEX_TYPE N_slices_max;
+    INDEX_TYPE scheduler;
+    INDEX_TYPE N;
+    INDEX_TYPE A_format;
+};
+
+inline std::string Tune_record_path(const std::string &matrix_path) {
+    return matrix_path + ".ledatune";
+}
+
+bool Save_tune_record(const std::string &path, const Tune_Key &key, const Tune_Result &result) {
+    FILE *f = fopen(path.c_str(), "w");
+    if(f == NULL) {
+        return false;
+    }
+    fprintf(f, "leda-autotune %d\n", LEDA_TUNE_VERSION);
+    fprintf(f, "content_hash %016llx\n", (unsigned long long)key.content_hash);
+    fprintf(f, "kernel %d %d %d %d\n", key.Tile_WIDTH, key.WINDOWS, key.URAM_DEPTH, key.NUM_PE);
+    fprintf(f, "limits %d %d %d\n", key.N_slices_min, key.N_slices_max, key.scheduler);
+    fprintf(f, "run %d %d\n", key.N, key.A_format);
+    fprintf(f, "Tile_SIZE %d\n", result.config.Tile_SIZE);
+    fprintf(f, "BATCH_SIZE %d\n", result.config.BATCH_SIZE);
+    fprintf(f, "WINDOWS %d\n", result.config.WINDOWS);
+    fprintf(f, "N_slices %d\n", result.config.N_slices);
+    fprintf(f, "predicted_cycles %.0f\n", result.cycles);
+    return fclose(f) == 0;
+}
+
+// false when there is no record or it was made for another key
+bool Load_tune_record(const std::string &path, const Tune_Key &key, Tune_Config &config) {
+    FILE *f = fopen(path.c_str(), "r");
+    if(f == NULL) {
+        return false;
+    }
+    INDEX_TYPE version = 0;
+    unsigned long long content_hash = 0;
+    Tune_Key record;
+    memset(&record, 0, sizeof(record));
+    bool ok = fscanf(f, "leda-autotune %d\n", &version) == 1 &&
+              fscanf(f, "content_hash %llx\n", &content_hash) == 1 &&
+              fscanf(f, "kernel %d %d %d %d\n", &record.Tile_WIDTH, &record.WINDOWS, &record.URAM_DEPTH, &record.NUM_PE) == 4 &&
+              fscanf(f, "limits %d %d %d\n", &record.N_slices_min, &record.N_slices_max, &record.scheduler) == 3 &&
+              fscanf(f, "run %d %d\n", &record.N, &record.A_format) == 2 &&
+              fscanf(f, "Tile_SIZE %d\n", &config.Tile_SIZE) == 1 &&
+              fscanf(f, "BATCH_SIZE %d\n", &config.BATCH_SIZE) == 1 &&
+              fscanf(f, "WINDOWS %d\n", &config.WINDOWS) == 1 &&
+              fscanf(f, "N_slices %d\n", &config.N_slices) == 1;
+    fclose(f);
+    return ok &&
+           version                == LEDA_TUNE_VERSION &&
+           content_hash           == key.content_hash &&
+           record.Tile_WIDTH      == key.Tile_WIDTH &&
+           record.WINDOWS         == key.WINDOWS &&
+           record.URAM_DEPTH      == key.URAM_DEPTH &&
+           record.NUM_PE          == key.NUM_PE &&
+           record.N_slices_min    == key.N_slices_min &&
+           record.N_slices_max    == key.N_slices_max &&
+           record.scheduler       == key.scheduler &&
+           record.N               == key.N &&
+           record.A_format        == key.A_format;
+}
+
+// a record can be stale or edited by hand: it must be one of the
+// candidates the limits allow, a batch as wide as the B window of its N_slices
+bool Valid_tune_config(const Tune_Config &config, const INDEX_TYPE N_slices_min, const INDEX_TYPE N_slices_max) {
+    for(const auto &candidate : Autotune_candidates(N_slices_min, N_slices_max)) {
+        if(candidate.Tile_SIZE  == config.Tile_SIZE &&
+           candidate.BATCH_SIZE == config.BATCH_SIZE &&
+           candidate.WINDOWS    == config.WINDOWS &&
+           candidate.N_slices   == config.N_slices) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
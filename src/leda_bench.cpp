@@ -0,0 +1,332 @@
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <iostream>
+#include <omp.h>
+#include <unistd.h>
+
+#include <ap_int.h>
+#include <tapa.h>
+
+#include "leda.h"
+#include "leda_common.h"
+#include "leda_generator.h"
+
+using namespace std;
+
+// micro-benchmark of the host preprocessing stages on synthetic matrices:
+// every stage is timed in isolation for every thread count of the sweep,
+// the best of REPEAT runs is kept
+
+struct Bench_Result {
+    std::string matrix;
+    std::string stage;
+    INDEX_TYPE  threads;
+    double      items;
+    double      seconds;
+    double      throughput;
+    double      efficiency;
+};
+
+vector<std::string> Split_list(const std::string &list) {
+    vector<std::string> items;
+    size_t pos = 0;
+    while(pos <= list.size()) {
+        size_t next = list.find(',', pos);
+        if(next == std::string::npos) next = list.size();
+        items.push_back(list.substr(pos, next - pos));
+        pos = next + 1;
+    }
+    return items;
+}
+
+template <typename F>
+double Time_best(const INDEX_TYPE repeat, F run) {
+    double best = 1e30;
+    for(INDEX_TYPE r = 0; r < repeat; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        auto end = std::chrono::steady_clock::now();
+        best = min(best, std::chrono::duration<double>(end - start).count());
+    }
+    return best;
+}
+
+bool Generate_matrix(const std::string &generator,
+                     const INDEX_TYPE scale,
+                     const INDEX_TYPE degree,
+                     const INDEX_TYPE block_size,
+                     const uint64_t seed,
+                     INDEX_TYPE &M,
+                     INDEX_TYPE &K,
+                     INDEX_TYPE &nnzR,
+                     vector<INDEX_TYPE> &RowIdx_COO,
+                     vector<INDEX_TYPE> &ColIdx_COO,
+                     vector<VALUE_TYPE> &Val_COO
+                    ) {
+    if(generator == "rmat") {
+        Generate_RMAT_COO(scale, degree, seed, M, K, nnzR, RowIdx_COO, ColIdx_COO, Val_COO);
+    }
+    else if(generator == "banded") {
+        Generate_Banded_COO(1 << scale, degree, seed, M, K, nnzR, RowIdx_COO, ColIdx_COO, Val_COO);
+    }
+    else if(generator == "uniform") {
+        Generate_Uniform_COO(1 << scale, degree, seed, M, K, nnzR, RowIdx_COO, ColIdx_COO, Val_COO);
+    }
+    else if(generator == "block") {
+        Generate_Block_Diagonal_COO(1 << scale, block_size, degree, seed, M, K, nnzR, RowIdx_COO, ColIdx_COO, Val_COO);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+void Bench_matrix(const std::string &name,
+                  const INDEX_TYPE M,
+                  const INDEX_TYPE K,
+                  const INDEX_TYPE nnzR,
+                  const vector<INDEX_TYPE> &RowIdx_COO,
+                  const vector<INDEX_TYPE> &ColIdx_COO,
+                  const vector<VALUE_TYPE> &Val_COO,
+                  const std::string &mtx_path,
+                  const INDEX_TYPE N,
+                  const vector<INDEX_TYPE> &thread_sweep,
+                  const INDEX_TYPE repeat,
+                  vector<Bench_Result> &results
+                 ) {
+    const INDEX_TYPE NUM_PE = PE_NUM * HBM_CHANNEL_A_NUM;
+
+    vector<VALUE_TYPE> Matrix_B_CPU_Dense(K * N);
+    vector<VALUE_TYPE> Matrix_C_CPU_Dense(M * N, 0.0);
+    Generate_Dense_Matrix(K, N, 1.0, Matrix_B_CPU_Dense, false, false);
+
+    for(INDEX_TYPE t : thread_sweep) {
+        omp_set_num_threads(t);
+
+        vector<Bench_Result> stages;
+        auto add = [&](const char *stage, const double items, const double seconds) {
+            stages.push_back({name, stage, t, items, seconds, items / seconds, 0.0});
+        };
+
+        if(!mtx_path.empty()) {
+            add("parse", nnzR, Time_best(repeat, [&] {
+                INDEX_TYPE m, k, nnz, isSymmetric;
+                vector<INDEX_TYPE> RowIdx, ColIdx;
+                vector<VALUE_TYPE> Val;
+                Read_matrix_2_COO((char *)mtx_path.c_str(), &m, &k, &nnz, &isSymmetric, RowIdx, ColIdx, Val);
+            }));
+        }
+
+        vector<Matrix_COO> Matrix_Band_COO(NUM_PE);
+        add("scatter", nnzR, Time_best(repeat, [&] {
+            Matrix_Scatter(M, K, nnzR, RowIdx_COO, ColIdx_COO, Val_COO, NUM_PE, Matrix_Band_COO);
+        }));
+
+        vector<SparseTile> Matrix_Band_Tile(NUM_PE);
+        add("tile", nnzR, Time_best(repeat, [&] {
+            Create_Matrix_Band_SparseTile_ex(Tile_SIZE, Matrix_Band_COO, Matrix_Band_Tile);
+        }));
+        vector<Matrix_COO>().swap(Matrix_Band_COO);
+
+        // the column reorder works in place, so every run starts from a copy
+        vector<vector<SpElement> > SpElement_list_pes;
+        vector<INDEX_TYPE> SpElement_list_ptr;
+        double schedule_time = 1e30;
+        for(INDEX_TYPE r = 0; r < repeat; ++r) {
+            vector<SparseTile> Matrix_Band_Tile_copy = Matrix_Band_Tile;
+            schedule_time = min(schedule_time, Time_best(1, [&] {
+                Create_SpElement_list_for_all_PEs(NUM_PE, M, K, Tile_SIZE, BATCH_SIZE, Matrix_Band_Tile_copy,
+                                                  SpElement_list_pes, SpElement_list_ptr, WINDOWS);
+            }));
+        }
+        add("schedule", nnzR, schedule_time);
+        vector<SparseTile>().swap(Matrix_Band_Tile);
+
+        vector<aligned_vector<unsigned long> > Matrix_A_fpga_data(HBM_CHANNEL_A_NUM);
+        add("pack", nnzR, Time_best(repeat, [&] {
+            Create_SpElement_list_for_all_channels<HBM_CHANNEL_A_NUM>(SpElement_list_pes, SpElement_list_ptr, Matrix_A_fpga_data);
+        }));
+        vector<vector<SpElement> >().swap(SpElement_list_pes);
+
+        add("pipelined", nnzR, Time_best(repeat, [&] {
+            Create_Matrix_A_data_FPGA_pipelined<HBM_CHANNEL_A_NUM>(M, K, nnzR, RowIdx_COO, ColIdx_COO, Val_COO,
+                                                                   Tile_SIZE, BATCH_SIZE, WINDOWS, SCHEDULER_WINDOW,
+                                                                   SpElement_list_ptr, Matrix_A_fpga_data);
+        }));
+
+        vector<aligned_vector<VALUE_TYPE> > Matrix_B_fpga_data(HBM_CHANNEL_B_NUM);
+        add("layout_B", (double)K * N, Time_best(repeat, [&] {
+            Create_Matrix_B_data_FPGA(K, N, HBM_CHANNEL_B_NUM, Matrix_B_CPU_Dense, Matrix_B_fpga_data);
+        }));
+
+        vector<aligned_vector<VALUE_TYPE> > Matrix_C_fpga_data(HBM_CHANNEL_C_NUM);
+        add("layout_C", (double)M * N, Time_best(repeat, [&] {
+            Create_Matrix_C_data_FPGA(M, N, HBM_CHANNEL_C_NUM, Matrix_C_CPU_Dense, Matrix_C_fpga_data);
+        }));
+
+        for(const Bench_Result &stage : stages) {
+            results.push_back(stage);
+        }
+    }
+
+    // scaling efficiency against the first thread count of the sweep
+    for(Bench_Result &result : results) {
+        if(result.matrix != name) {
+            continue;
+        }
+        for(const Bench_Result &base : results) {
+            if(base.matrix == name && base.stage == result.stage && base.threads == thread_sweep[0]) {
+                result.efficiency = (base.seconds * base.threads) / (result.seconds * result.threads);
+            }
+        }
+    }
+}
+
+// a matrix name is a path given on the command line, so quotes, backslashes
+// and control characters are escaped
+std::string JSON_escape(const std::string &text) {
+    std::string escaped;
+    for(char ch : text) {
+        if(ch == '"' || ch == '\\') {
+            escaped += '\\';
+            escaped += ch;
+        }
+        else if((unsigned char)ch < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", (unsigned char)ch);
+            escaped += code;
+        }
+        else {
+            escaped += ch;
+        }
+    }
+    return escaped;
+}
+
+void Write_results_JSON(FILE *f, const vector<Bench_Result> &results) {
+    fprintf(f, "[\n");
+    for(size_t i = 0; i < results.size(); ++i) {
+        const Bench_Result &r = results[i];
+        fprintf(f, "  {\"matrix\": \"%s\", \"stage\": \"%s\", \"threads\": %d, \"items\": %.0f, "
+                   "\"seconds\": %.6e, \"throughput\": %.6e, \"efficiency\": %.4f}%s\n",
+                JSON_escape(r.matrix).c_str(), JSON_escape(r.stage).c_str(), r.threads, r.items,
+                r.seconds, r.throughput, r.efficiency, (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(f, "]\n");
+}
+
+int main(int argc, char **argv) {
+    std::string generators = "rmat,banded,uniform,block";
+    std::string matrix_path;
+    std::string json_path;
+    std::string tmp_dir = "/tmp";
+    INDEX_TYPE scale = 16;
+    INDEX_TYPE degree = 16;
+    INDEX_TYPE block_size = 256;
+    INDEX_TYPE N = 16;
+    INDEX_TYPE repeat = 3;
+    uint64_t seed = 1;
+    vector<INDEX_TYPE> thread_sweep;
+
+    for(INDEX_TYPE i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        std::string value = option.substr(option.find('=') + 1);
+        if(option.compare(0, 13, "--generators=") == 0)      generators = value;
+        else if(option.compare(0, 9, "--matrix=") == 0)      matrix_path = value;
+        else if(option.compare(0, 7, "--json=") == 0)        json_path = value;
+        else if(option.compare(0, 10, "--tmp-dir=") == 0)    tmp_dir = value;
+        else if(option.compare(0, 8, "--scale=") == 0)       scale = atoi(value.c_str());
+        else if(option.compare(0, 9, "--degree=") == 0)      degree = atoi(value.c_str());
+        else if(option.compare(0, 8, "--block=") == 0)       block_size = atoi(value.c_str());
+        else if(option.compare(0, 4, "--N=") == 0)           N = tapa::round_up<8>(atoi(value.c_str()));
+        else if(option.compare(0, 9, "--repeat=") == 0)      repeat = max(1, atoi(value.c_str()));
+        else if(option.compare(0, 7, "--seed=") == 0)        seed = strtoull(value.c_str(), NULL, 10);
+        else if(option.compare(0, 10, "--threads=") == 0) {
+            for(const std::string &t : Split_list(value)) {
+                thread_sweep.push_back(max(1, atoi(t.c_str())));
+            }
+        }
+        else {
+            cout << "Message: " << argv[0] << " [--generators=rmat,banded,uniform,block] [--matrix=file.mtx]"
+                 << " [--scale=S] [--degree=D] [--block=B] [--N=N] [--threads=1,2,4] [--repeat=R]"
+                 << " [--seed=S] [--json=file] [--tmp-dir=dir]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(block_size <= 0) {
+        cout << "--block must be a positive number of rows" << endl;
+        return EXIT_FAILURE;
+    }
+
+    if(thread_sweep.empty()) {
+        for(INDEX_TYPE t = 1; t < omp_get_max_threads(); t *= 2) {
+            thread_sweep.push_back(t);
+        }
+        thread_sweep.push_back(omp_get_max_threads());
+    }
+
+    vector<Bench_Result> results;
+
+    vector<std::string> names = matrix_path.empty() ? Split_list(generators) : vector<std::string>(1, matrix_path);
+
+    for(const std::string &name : names) {
+        INDEX_TYPE M, K, nnzR, isSymmetric;
+        vector<INDEX_TYPE> RowIdx_COO;
+        vector<INDEX_TYPE> ColIdx_COO;
+        vector<VALUE_TYPE> Val_COO;
+        std::string mtx_path;
+        bool generated = matrix_path.empty();
+
+        if(generated) {
+            if(!Generate_matrix(name, scale, degree, block_size, seed, M, K, nnzR, RowIdx_COO, ColIdx_COO, Val_COO)) {
+                cout << "Unknown generator " << name << endl;
+                return EXIT_FAILURE;
+            }
+            mtx_path = tmp_dir + "/leda_bench_" + name + "_" + std::to_string(getpid()) + ".mtx";
+            if(!Write_matrix_COO(mtx_path, M, K, nnzR, RowIdx_COO, ColIdx_COO, Val_COO)) {
+                mtx_path.clear();
+            }
+        }
+        else {
+            mtx_path = name;
+            if(Read_matrix_2_COO((char *)name.c_str(), &M, &K, &nnzR, &isSymmetric, RowIdx_COO, ColIdx_COO, Val_COO) != 0) {
+                cout << "Could not read " << name << endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        cout << name << ": #Rows = " << M << ", #Cols = " << K << ", #nnzR = " << nnzR << endl;
+
+        Bench_matrix(name, M, K, nnzR, RowIdx_COO, ColIdx_COO, Val_COO, mtx_path, N, thread_sweep, repeat, results);
+
+        if(generated && !mtx_path.empty()) {
+            unlink(mtx_path.c_str());
+        }
+    }
+
+    printf("\n%-10s %-10s %8s %12s %14s %10s\n", "matrix", "stage", "threads", "time (ms)", "items/s", "efficiency");
+    for(const Bench_Result &r : results) {
+        std::string matrix = r.matrix.substr(r.matrix.find_last_of('/') + 1);
+        printf("%-10s %-10s %8d %12.3f %14.4e %10.2f\n",
+               matrix.c_str(), r.stage.c_str(), r.threads, r.seconds * 1000, r.throughput, r.efficiency);
+    }
+
+    if(!json_path.empty()) {
+        FILE *f = fopen(json_path.c_str(), "w");
+        if(f == NULL) {
+            cout << "Could not write " << json_path << endl;
+            return EXIT_FAILURE;
+        }
+        Write_results_JSON(f, results);
+        fclose(f);
+    }
+
+    return EXIT_SUCCESS;
+}
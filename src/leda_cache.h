@@ -0,0 +1,282 @@
+#ifndef LEDA_CACHE_H
+#define LEDA_CACHE_H
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "leda_common.h"
+
+// On-disk image of everything the host builds before tapa::invoke:
+//
+//   [header, padded to 4 KiB]
+//   [SpElement_list_ptr_fpga, padded to 4 KiB]
+//   [Matrix_A_fpga_data[0], padded to 4 KiB] ... [Matrix_A_fpga_data[C - 1]]
+//
+// The image depends only on the matrix and the kernel configuration, both
+// recorded in the header and checked before an image is used.
+
+constexpr uint32_t LEDA_IMAGE_VERSION = 1;
+constexpr uint64_t LEDA_IMAGE_ALIGN   = 4096;
+
+struct Leda_Image_Header {
+    char       magic[8];
+    uint32_t   version;
+    uint32_t   header_size;
+
+    INDEX_TYPE M;
+    INDEX_TYPE K;
+    INDEX_TYPE nnzR;
+
+    INDEX_TYPE Tile_SIZE;
+    INDEX_TYPE BATCH_SIZE;
+    INDEX_TYPE WINDOWS;
+    INDEX_TYPE PE_NUM;
+    INDEX_TYPE HBM_CHANNEL_A_NUM;
+
+    INDEX_TYPE Batch_num;
+    INDEX_TYPE Sparse_Matrix_len;
+
+    uint64_t   options;
+    uint64_t   content_hash;
+
+    uint64_t   ptr_offset;
+    uint64_t   ptr_size;
+    uint64_t   channel_offset;
+    uint64_t   channel_stride;
+    uint64_t   channel_size;
+    uint64_t   file_size;
+};
+
+inline uint64_t Image_align(const uint64_t bytes) {
+    return (bytes + LEDA_IMAGE_ALIGN - 1) / LEDA_IMAGE_ALIGN * LEDA_IMAGE_ALIGN;
+}
+
+inline uint64_t Hash_mix(uint64_t h, const uint64_t x) {
+    h ^= x + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// hash of an array, computed over fixed-size blocks in parallel so the
+// result does not depend on the number of threads
+uint64_t Hash_array(const void *data, const uint64_t bytes, const uint64_t seed) {
+    const uint64_t BLOCK = 1 << 20;
+    const unsigned char *p = (const unsigned char *)data;
+    INDEX_TYPE num_blocks = (bytes + BLOCK - 1) / BLOCK;
+    vector<uint64_t> block_hash(num_blocks, 0);
+
+#pragma omp parallel for
+    for(INDEX_TYPE b = 0; b < num_blocks; ++b) {
+        uint64_t begin = b * BLOCK;
+        uint64_t end = min(bytes, begin + BLOCK);
+        uint64_t h = seed + b;
+        uint64_t i = begin;
+        for(; i + 8 <= end; i += 8) {
+            uint64_t w;
+            memcpy(&w, p + i, 8);
+            h = (h ^ w) * 0x100000001B3ULL;
+            h ^= h >> 29;
+        }
+        for(; i < end; ++i) {
+            h = (h ^ p[i]) * 0x100000001B3ULL;
+        }
+        block_hash[b] = h;
+    }
+
+    uint64_t h = Hash_mix(seed, bytes);
+    for(INDEX_TYPE b = 0; b < num_blocks; ++b) {
+        h = Hash_mix(h, block_hash[b]);
+    }
+    return h;
+}
+
+// the COO order fully determines the preprocessed image
+uint64_t Hash_matrix_COO(const INDEX_TYPE M,
+                         const INDEX_TYPE K,
+                         const INDEX_TYPE nnzR,
+                         const vector<INDEX_TYPE> &RowIdx_COO,
+                         const vector<INDEX_TYPE> &ColIdx_COO,
+                         const vector<VALUE_TYPE> &Val_COO
+                        ) {
+    uint64_t h = Hash_mix(Hash_mix(Hash_mix(0, M), K), nnzR);
+    h = Hash_array(RowIdx_COO.data(), RowIdx_COO.size() * sizeof(INDEX_TYPE), h);
+    h = Hash_array(ColIdx_COO.data(), ColIdx_COO.size() * sizeof(INDEX_TYPE), h);
+    h = Hash_array(Val_COO.data(), Val_COO.size() * sizeof(VALUE_TYPE), h);
+    return h;
+}
+
+void Init_image_header(Leda_Image_Header &header,
+                       const INDEX_TYPE M,
+                       const INDEX_TYPE K,
+                       const INDEX_TYPE nnzR,
+                       const uint64_t content_hash,
+                       const uint64_t options,
+                       const INDEX_TYPE batch_size = BATCH_SIZE,
+                       const INDEX_TYPE tile_size = Tile_SIZE,
+                       const INDEX_TYPE windows = WINDOWS
+                      ) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "LEDAIMG", 8);
+    header.version           = LEDA_IMAGE_VERSION;
+    header.header_size       = LEDA_IMAGE_ALIGN;
+    header.M                 = M;
+    header.K                 = K;
+    header.nnzR              = nnzR;
+    header.Tile_SIZE         = tile_size;
+    header.BATCH_SIZE        = batch_size;
+    header.WINDOWS           = windows;
+    header.PE_NUM            = PE_NUM;
+    header.HBM_CHANNEL_A_NUM = HBM_CHANNEL_A_NUM;
+    header.options           = options;
+    header.content_hash      = content_hash;
+}
+
+bool Check_image_header(const Leda_Image_Header &header,
+                        const Leda_Image_Header &expected
+                       ) {
+    return memcmp(header.magic, expected.magic, 8) == 0 &&
+           header.version           == expected.version &&
+           header.header_size       == expected.header_size &&
+           header.M                 == expected.M &&
+           header.K                 == expected.K &&
+           header.nnzR              == expected.nnzR &&
+           header.Tile_SIZE         == expected.Tile_SIZE &&
+           header.BATCH_SIZE        == expected.BATCH_SIZE &&
+           header.WINDOWS           == expected.WINDOWS &&
+           header.PE_NUM            == expected.PE_NUM &&
+           header.HBM_CHANNEL_A_NUM == expected.HBM_CHANNEL_A_NUM &&
+           header.options           == expected.options &&
+           header.content_hash      == expected.content_hash;
+}
+
+// <cache_dir>/<matrix name>.<key>.ledaimg, the key covers content and configuration
+std::string Leda_image_path(const std::string &cache_dir,
+                            const std::string &matrix_path,
+                            const Leda_Image_Header &header
+                           ) {
+    std::string name = matrix_path.substr(matrix_path.find_last_of('/') + 1);
+    name = name.substr(0, name.find_last_of('.'));
+
+    uint64_t key = Hash_mix(header.content_hash, header.version);
+    key = Hash_mix(key, header.Tile_SIZE);
+    key = Hash_mix(key, header.BATCH_SIZE);
+    key = Hash_mix(key, header.WINDOWS);
+    key = Hash_mix(key, header.PE_NUM);
+    key = Hash_mix(key, header.HBM_CHANNEL_A_NUM);
+    key = Hash_mix(key, header.options);
+
+    char key_str[17];
+    snprintf(key_str, sizeof(key_str), "%016llx", (unsigned long long)key);
+    return cache_dir + "/" + name + "." + key_str + ".ledaimg";
+}
+
+bool Save_Leda_image(const std::string &path,
+                     Leda_Image_Header header,
+                     const vector<INDEX_TYPE> &SpElement_list_ptr,
+                     const aligned_vector<INDEX_TYPE> &SpElement_list_ptr_fpga,
+                     const vector<aligned_vector<unsigned long> > &Matrix_A_fpga_data
+                    ) {
+    INDEX_TYPE Batch_num = SpElement_list_ptr.size() - 1;
+    header.Batch_num         = Batch_num;
+    header.Sparse_Matrix_len = SpElement_list_ptr[Batch_num];
+    header.ptr_offset        = LEDA_IMAGE_ALIGN;
+    header.ptr_size          = SpElement_list_ptr_fpga.size();
+    header.channel_offset    = header.ptr_offset + Image_align(header.ptr_size * sizeof(INDEX_TYPE));
+    header.channel_size      = Matrix_A_fpga_data[0].size();
+    header.channel_stride    = Image_align(header.channel_size * sizeof(unsigned long));
+    header.file_size         = header.channel_offset + header.channel_stride * HBM_CHANNEL_A_NUM;
+
+    // write to a temporary file first so readers never see a partial image
+    std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        return false;
+    }
+    if(ftruncate(fd, header.file_size) != 0) {
+        close(fd);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    void *addr = mmap(NULL, header.file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    char *image = (char *)addr;
+
+    memcpy(image, &header, sizeof(header));
+    memcpy(image + header.ptr_offset, SpElement_list_ptr_fpga.data(), header.ptr_size * sizeof(INDEX_TYPE));
+
+#pragma omp parallel for
+    for(INDEX_TYPE c = 0; c < HBM_CHANNEL_A_NUM; ++c) {
+        memcpy(image + header.channel_offset + c * header.channel_stride,
+               Matrix_A_fpga_data[c].data(),
+               header.channel_size * sizeof(unsigned long));
+    }
+
+    bool ok = (munmap(addr, header.file_size) == 0);
+    ok = ok && (rename(tmp_path.c_str(), path.c_str()) == 0);
+    if(!ok) {
+        unlink(tmp_path.c_str());
+    }
+    return ok;
+}
+
+bool Load_Leda_image(const std::string &path,
+                     const Leda_Image_Header &expected,
+                     vector<INDEX_TYPE> &SpElement_list_ptr,
+                     aligned_vector<INDEX_TYPE> &SpElement_list_ptr_fpga,
+                     vector<aligned_vector<unsigned long> > &Matrix_A_fpga_data
+                    ) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (uint64_t)st.st_size < LEDA_IMAGE_ALIGN) {
+        close(fd);
+        return false;
+    }
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) {
+        return false;
+    }
+    const char *image = (const char *)addr;
+
+    Leda_Image_Header header;
+    memcpy(&header, image, sizeof(header));
+
+    bool valid = Check_image_header(header, expected) &&
+                 header.file_size == (uint64_t)st.st_size &&
+                 header.ptr_size >= (uint64_t)header.Batch_num + 1 &&
+                 header.channel_offset + header.channel_stride * HBM_CHANNEL_A_NUM <= header.file_size;
+
+    if(valid) {
+        madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+        const INDEX_TYPE *ptr = (const INDEX_TYPE *)(image + header.ptr_offset);
+        SpElement_list_ptr_fpga.assign(ptr, ptr + header.ptr_size);
+        SpElement_list_ptr.assign(ptr, ptr + header.Batch_num + 1);
+
+#pragma omp parallel for
+        for(INDEX_TYPE c = 0; c < HBM_CHANNEL_A_NUM; ++c) {
+            const unsigned long *channel = (const unsigned long *)(image + header.channel_offset + c * header.channel_stride);
+            Matrix_A_fpga_data[c].assign(channel, channel + header.channel_size);
+        }
+    }
+
+    munmap(addr, st.st_size);
+    return valid;
+}
+
+#endif
@@ -2,10 +2,23 @@
 #define LEDA_COMMON_H
 
 #include <vector>
+#include <string>
+#include <algorithm>
 #include <iostream>
 #include <bitset>
 #include <omp.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 #include "mmio_highlevel.h"
+#include "mmio_parallel.h"
 #include "leda_common.h"
 
 using std::cout;
@@ -42,12 +55,13 @@ struct Matrix_COO {
     vector<INDEX_TYPE> RowIdx_copy;
     vector<VALUE_TYPE> Val;
 
-    vector<unsigned short> mask;
-    vector<vector<INDEX_TYPE> > map;
-
-    Matrix_COO() : M(0), K(0), nnzR(0), ColIdx() , RowIdx(), Val(), mask(), map() {}
+    Matrix_COO() : M(0), K(0), nnzR(0), ColIdx() , RowIdx(), RowIdx_copy(), Val() {}
 };
 
+// tiled CSC storage of a band: the non-empty tiles of tile column j are
+// TileColPtr[j] .. TileColPtr[j + 1] - 1, the nonzeros of tile t are
+// TilePtr[t] .. TilePtr[t + 1] - 1 in the flat arrays, and tile t owns the
+// TileSize column masks starting at Mask[t * TileSize]
 struct SparseTile {
     INDEX_TYPE         TileSize;
     INDEX_TYPE         numColTiles;
@@ -56,9 +70,15 @@ struct SparseTile {
 
     vector<INDEX_TYPE> TileColPtr;
     vector<INDEX_TYPE> TileRowIdx;
-    vector<Matrix_COO> TileVal;
+    vector<INDEX_TYPE> TilePtr;
+
+    vector<INDEX_TYPE> ColIdx;
+    vector<INDEX_TYPE> RowIdx;
+    vector<INDEX_TYPE> RowIdx_copy;
+    vector<VALUE_TYPE> Val;
+    vector<unsigned short> Mask;
 
-    SparseTile() : TileSize(0), numColTiles(0), numRowTiles(0), TileColPtr(), TileRowIdx(), TileVal() {}
+    SparseTile() : TileSize(0), numColTiles(0), numRowTiles(0), numTiles(0), TileColPtr(), TileRowIdx(), TilePtr(), ColIdx(), RowIdx(), RowIdx_copy(), Val(), Mask() {}
 };
 
 void Read_matrix_size(char       *filename,
@@ -129,6 +149,101 @@ void Read_matrix_2_CSC(char       *filename,
     free(ColPtr_d);
 }
 
+INDEX_TYPE Read_matrix_2_COO(char       *filename,
+                             INDEX_TYPE *M,
+                             INDEX_TYPE *K,
+                             INDEX_TYPE *nnzR,
+                             INDEX_TYPE *isSymmetric,
+
+                             vector<INDEX_TYPE> &RowIdx_COO,
+                             vector<INDEX_TYPE> &ColIdx_COO,
+                             vector<VALUE_TYPE> &Val_COO
+                            ) {
+
+    return mmio_parallel_coo(M, K, nnzR, isSymmetric, RowIdx_COO, ColIdx_COO, Val_COO, filename);
+}
+
+void COO_2_CSC(const INDEX_TYPE M,
+               const INDEX_TYPE K,
+               const INDEX_TYPE nnzR,
+
+               const vector<INDEX_TYPE> &RowIdx_COO,
+               const vector<INDEX_TYPE> &ColIdx_COO,
+               const vector<VALUE_TYPE> &Val_COO,
+
+               vector<INDEX_TYPE> &ColPtr_CSC,
+               vector<INDEX_TYPE> &RowIdx_CSC,
+               vector<VALUE_TYPE> &Val_CSC
+              ) {
+
+    // stable counting sort on the column index, one histogram per part of
+    // the input; the number of parts keeps the histograms within O(nnzR)
+    INDEX_TYPE num_parts = max((INDEX_TYPE)1, min((INDEX_TYPE)omp_get_max_threads(), nnzR / (K + 1)));
+    vector<INDEX_TYPE> part_counts((size_t)num_parts * K, 0);
+
+    ColPtr_CSC.assign(K + 1, 0);
+    RowIdx_CSC.resize(nnzR);
+    Val_CSC.resize(nnzR);
+
+#pragma omp parallel for schedule(static, 1)
+    for(INDEX_TYPE t = 0; t < num_parts; ++t) {
+        INDEX_TYPE *counts = part_counts.data() + (size_t)t * K;
+        for(INDEX_TYPE i = (long)nnzR * t / num_parts; i < (long)nnzR * (t + 1) / num_parts; ++i) {
+            counts[ColIdx_COO[i]]++;
+        }
+    }
+
+#pragma omp parallel for
+    for(INDEX_TYPE j = 0; j < K; ++j) {
+        INDEX_TYPE sum = 0;
+        for(INDEX_TYPE t = 0; t < num_parts; ++t) {
+            INDEX_TYPE count = part_counts[(size_t)t * K + j];
+            part_counts[(size_t)t * K + j] = sum;
+            sum += count;
+        }
+        ColPtr_CSC[j + 1] = sum;
+    }
+
+    for(INDEX_TYPE j = 0; j < K; ++j) {
+        ColPtr_CSC[j + 1] += ColPtr_CSC[j];
+    }
+
+#pragma omp parallel for schedule(static, 1)
+    for(INDEX_TYPE t = 0; t < num_parts; ++t) {
+        INDEX_TYPE *offsets = part_counts.data() + (size_t)t * K;
+        for(INDEX_TYPE i = (long)nnzR * t / num_parts; i < (long)nnzR * (t + 1) / num_parts; ++i) {
+            INDEX_TYPE col = ColIdx_COO[i];
+            INDEX_TYPE pos = ColPtr_CSC[col] + offsets[col]++;
+            RowIdx_CSC[pos] = RowIdx_COO[i];
+            Val_CSC[pos]    = Val_COO[i];
+        }
+    }
+}
+
+void Read_matrix_mmap(char       *filename,
+                      INDEX_TYPE *M,
+                      INDEX_TYPE *K,
+                      INDEX_TYPE *nnzR,
+                      INDEX_TYPE *isSymmetric,
+
+                      vector<INDEX_TYPE> &ColPtr_CSC,
+                      vector<INDEX_TYPE> &RowIdx_CSC,
+                      vector<VALUE_TYPE> &Val_CSC,
+
+                      vector<INDEX_TYPE> &RowIdx_COO,
+                      vector<INDEX_TYPE> &ColIdx_COO,
+                      vector<VALUE_TYPE> &Val_COO
+                     ) {
+
+    INDEX_TYPE ret = Read_matrix_2_COO(filename, M, K, nnzR, isSymmetric, RowIdx_COO, ColIdx_COO, Val_COO);
+    if(ret != 0) {
+        cout << "Failed to read " << filename << " (error " << ret << ")" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    COO_2_CSC(*M, *K, *nnzR, RowIdx_COO, ColIdx_COO, Val_COO, ColPtr_CSC, RowIdx_CSC, Val_CSC);
+}
+
 void CSC_2_CSR(const INDEX_TYPE M,
                const INDEX_TYPE K,
                const INDEX_TYPE nnzR,
@@ -284,13 +399,7 @@ void Generate_Dense_Matrix(const INDEX_TYPE M,
 }
 
 INDEX_TYPE CountOnes(const unsigned short num) {
-    INDEX_TYPE count = 0;
-    unsigned short num_tmp = num;
-    while (num_tmp) {
-        count += num_tmp & 1;
-        num_tmp >>= 1;
-    }
-    return count;
+    return __builtin_popcount(num);
 }
 
 void SpMM_CPU_CSR(const INDEX_TYPE M,
@@ -331,6 +440,108 @@ void SpMM_CPU_CSC(const INDEX_TYPE M,
   }
 }
 
+// one row of C = A * B with B and C row-major: C_row is accumulated in
+// register blocks over N, every nonzero of the row adding v * B[col] with FMA
+inline void SpMM_CPU_CSR_row(const INDEX_TYPE N,
+                             const INDEX_TYPE begin,
+                             const INDEX_TYPE end,
+                             const INDEX_TYPE *ColIdx,
+                             const VALUE_TYPE *Val,
+                             const VALUE_TYPE *B,
+                             VALUE_TYPE *C_row
+                            ) {
+    INDEX_TYPE l = 0;
+
+#if defined(__AVX512F__)
+    static_assert(sizeof(VALUE_TYPE) == sizeof(float), "the vector SpMM works on float");
+    for(; l + 64 <= N; l += 64) {
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+        __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+        for(INDEX_TYPE k = begin; k < end; ++k) {
+            __m512 v = _mm512_set1_ps(Val[k]);
+            const VALUE_TYPE *b = B + (size_t)ColIdx[k] * N + l;
+            acc0 = _mm512_fmadd_ps(v, _mm512_loadu_ps(b), acc0);
+            acc1 = _mm512_fmadd_ps(v, _mm512_loadu_ps(b + 16), acc1);
+            acc2 = _mm512_fmadd_ps(v, _mm512_loadu_ps(b + 32), acc2);
+            acc3 = _mm512_fmadd_ps(v, _mm512_loadu_ps(b + 48), acc3);
+        }
+        _mm512_storeu_ps(C_row + l, acc0);
+        _mm512_storeu_ps(C_row + l + 16, acc1);
+        _mm512_storeu_ps(C_row + l + 32, acc2);
+        _mm512_storeu_ps(C_row + l + 48, acc3);
+    }
+    for(; l + 16 <= N; l += 16) {
+        __m512 acc = _mm512_setzero_ps();
+        for(INDEX_TYPE k = begin; k < end; ++k) {
+            acc = _mm512_fmadd_ps(_mm512_set1_ps(Val[k]), _mm512_loadu_ps(B + (size_t)ColIdx[k] * N + l), acc);
+        }
+        _mm512_storeu_ps(C_row + l, acc);
+    }
+#elif defined(__AVX2__) && defined(__FMA__)
+    static_assert(sizeof(VALUE_TYPE) == sizeof(float), "the vector SpMM works on float");
+    for(; l + 32 <= N; l += 32) {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        for(INDEX_TYPE k = begin; k < end; ++k) {
+            __m256 v = _mm256_set1_ps(Val[k]);
+            const VALUE_TYPE *b = B + (size_t)ColIdx[k] * N + l;
+            acc0 = _mm256_fmadd_ps(v, _mm256_loadu_ps(b), acc0);
+            acc1 = _mm256_fmadd_ps(v, _mm256_loadu_ps(b + 8), acc1);
+            acc2 = _mm256_fmadd_ps(v, _mm256_loadu_ps(b + 16), acc2);
+            acc3 = _mm256_fmadd_ps(v, _mm256_loadu_ps(b + 24), acc3);
+        }
+        _mm256_storeu_ps(C_row + l, acc0);
+        _mm256_storeu_ps(C_row + l + 8, acc1);
+        _mm256_storeu_ps(C_row + l + 16, acc2);
+        _mm256_storeu_ps(C_row + l + 24, acc3);
+    }
+    for(; l + 8 <= N; l += 8) {
+        __m256 acc = _mm256_setzero_ps();
+        for(INDEX_TYPE k = begin; k < end; ++k) {
+            acc = _mm256_fmadd_ps(_mm256_set1_ps(Val[k]), _mm256_loadu_ps(B + (size_t)ColIdx[k] * N + l), acc);
+        }
+        _mm256_storeu_ps(C_row + l, acc);
+    }
+#endif
+
+    for(; l < N; ++l) {
+        VALUE_TYPE acc = 0;
+        for(INDEX_TYPE k = begin; k < end; ++k) {
+            acc += Val[k] * B[(size_t)ColIdx[k] * N + l];
+        }
+        C_row[l] = acc;
+    }
+}
+
+// optimized CPU baseline: A in CSR, B (K x N) and C (M x N) row-major,
+// panels of rows are shared out among THREADS threads
+void SpMM_CPU_CSR_rowmajor(const INDEX_TYPE M,
+                           const INDEX_TYPE N,
+                           const INDEX_TYPE K,
+                           const vector<INDEX_TYPE> &RowPtr_CSR,
+                           const vector<INDEX_TYPE> &ColIdx_CSR,
+                           const vector<VALUE_TYPE> &Val_CSR,
+                           const vector<VALUE_TYPE> &Matrix_B_Dense_rowmajor,
+                           vector<VALUE_TYPE>       &Matrix_C_Dense_rowmajor,
+                           const INDEX_TYPE THREADS
+                          ) {
+    const INDEX_TYPE PANEL = 64;
+
+#pragma omp parallel for schedule(dynamic) num_threads(THREADS)
+    for(INDEX_TYPE panel = 0; panel < (M + PANEL - 1) / PANEL; ++panel) {
+        for(INDEX_TYPE r = panel * PANEL; r < min((panel + 1) * PANEL, M); ++r) {
+            SpMM_CPU_CSR_row(N,
+                             RowPtr_CSR[r],
+                             RowPtr_CSR[r + 1],
+                             ColIdx_CSR.data(),
+                             Val_CSR.data(),
+                             Matrix_B_Dense_rowmajor.data(),
+                             Matrix_C_Dense_rowmajor.data() + (size_t)r * N
+                            );
+        }
+    }
+}
+
 void SpMM_CPU_Tile(const INDEX_TYPE M, 
                     const INDEX_TYPE N, 
                     const INDEX_TYPE K,
@@ -340,23 +551,21 @@ void SpMM_CPU_Tile(const INDEX_TYPE M,
                    ) {
 
     for(INDEX_TYPE p = 0; p < Matrix_SparseTile.size(); p++) {
-        for(INDEX_TYPE j = 0; j < Matrix_SparseTile[p].numColTiles; ++j) {
-                for(INDEX_TYPE i = Matrix_SparseTile[p].TileColPtr[j]; i < Matrix_SparseTile[p].TileColPtr[j + 1]; ++i) {
-                    INDEX_TYPE TilennzR = Matrix_SparseTile[p].TileVal[i].nnzR;
-
-                    for(INDEX_TYPE k = 0; k < TilennzR; ++k) {
-
-                        INDEX_TYPE r = Matrix_SparseTile[p].TileVal[i].RowIdx_copy[k];
-                        INDEX_TYPE c = Matrix_SparseTile[p].TileVal[i].ColIdx[k];
-                        VALUE_TYPE v = Matrix_SparseTile[p].TileVal[i].Val[k];
+        const SparseTile &Tile = Matrix_SparseTile[p];
+        for(INDEX_TYPE j = 0; j < Tile.numColTiles; ++j) {
+            for(INDEX_TYPE i = Tile.TileColPtr[j]; i < Tile.TileColPtr[j + 1]; ++i) {
+                for(INDEX_TYPE k = Tile.TilePtr[i]; k < Tile.TilePtr[i + 1]; ++k) {
+
+                    INDEX_TYPE r = Tile.RowIdx_copy[k];
+                    INDEX_TYPE c = Tile.ColIdx[k];
+                    VALUE_TYPE v = Tile.Val[k];
                         
-                        for(INDEX_TYPE l = 0; l < N; ++l) {
-                                Matrix_C_Dense[l * M + r] += v * Matrix_B_Dense[l * K + c];
-                            }
+                    for(INDEX_TYPE l = 0; l < N; ++l) {
+                        Matrix_C_Dense[l * M + r] += v * Matrix_B_Dense[l * K + c];
                     }
-
                 }
             }
+        }
     }
 }
 
@@ -372,293 +581,247 @@ void Matrix_Scatter(const INDEX_TYPE M,
 
                     vector<Matrix_COO> &Matrix_Band_COO
                     ) {
-                    
-    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
-        INDEX_TYPE p = (RowIdx_COO[i]) % NUM_PE;
-        INDEX_TYPE pos = Matrix_Band_COO[p].RowIdx.size();
-        Matrix_Band_COO[p].RowIdx.resize(pos + 1);
-        Matrix_Band_COO[p].RowIdx_copy.resize(pos + 1);
-        Matrix_Band_COO[p].ColIdx.resize(pos + 1);
-        Matrix_Band_COO[p].Val.resize(pos + 1);
-        Matrix_Band_COO[p].RowIdx[pos] = RowIdx_COO[i] / NUM_PE;
-        Matrix_Band_COO[p].RowIdx_copy[pos] = RowIdx_COO[i];
-        Matrix_Band_COO[p].ColIdx[pos] = ColIdx_COO[i];
-        Matrix_Band_COO[p].Val[pos] = Val_COO[i];
-        Matrix_Band_COO[p].nnzR++;  
-    }
-
-
-#pragma omp parallel for
-    for(INDEX_TYPE i = 0; i < Matrix_Band_COO.size(); ++i) {
-        INDEX_TYPE max_rownum = -1;
-        INDEX_TYPE max_colnum = -1;
-        for(INDEX_TYPE j = 0; j < Matrix_Band_COO[i].nnzR; ++j) {
-            max_rownum = max(max_rownum, Matrix_Band_COO[i].RowIdx[j]);
-            max_colnum = max(max_colnum, Matrix_Band_COO[i].ColIdx[j]);
-        }
-        Matrix_Band_COO[i].M = max_rownum + 1;
-        Matrix_Band_COO[i].K = max_colnum + 1;
-    }
-}
-
-void Create_SparseTile(const INDEX_TYPE M, 
-                        const INDEX_TYPE K, 
-                        const INDEX_TYPE nnzR,
-
-                        const INDEX_TYPE TileSize,
-
-                        const vector<INDEX_TYPE> &RowIdx_COO,
-                        const vector<INDEX_TYPE> &ColIdx_COO,
-                        const vector<VALUE_TYPE> &Val_COO,
-
-                        SparseTile &TileMatrix
-                        ) {
-    
-    INDEX_TYPE numColTiles = (K + TileSize - 1) / TileSize;
-    INDEX_TYPE numRowTiles = (M + TileSize - 1) / TileSize;
-
-    INDEX_TYPE newnumCols  = numColTiles * TileSize;
-    INDEX_TYPE newnumRows  = numRowTiles * TileSize;
-    INDEX_TYPE newnnzR     = nnzR;
-
-    if(newnumCols != K || newnumRows != M) {
-        newnnzR += (newnumCols - K);
-    }
 
-    SparseTile TileMatrix_temp;
+    // two-phase counting sort on the band index: per-part histograms, then
+    // every part fills its own slice of each band, which keeps the input
+    // order inside a band
+    INDEX_TYPE num_parts = max((INDEX_TYPE)1, min((INDEX_TYPE)omp_get_max_threads(), nnzR / 4096));
 
-    TileMatrix_temp.numColTiles = numColTiles;
-    TileMatrix_temp.numRowTiles = numRowTiles;
-    TileMatrix_temp.TileSize    = TileSize;
+    vector<INDEX_TYPE> part_offsets(num_parts * NUM_PE, 0);
+    vector<INDEX_TYPE> part_max_row(num_parts * NUM_PE, -1);
+    vector<INDEX_TYPE> part_max_col(num_parts * NUM_PE, -1);
 
-    INDEX_TYPE numTiles         = numColTiles * numRowTiles;
-
-    TileMatrix_temp.numTiles    = numTiles;
-
-    vector<INDEX_TYPE> TileCounts(numTiles, 0);
-    for (INDEX_TYPE i = 0; i < nnzR; ++i) {
-        INDEX_TYPE row       = RowIdx_COO[i];
-        INDEX_TYPE col       = ColIdx_COO[i];
-        INDEX_TYPE TileRow   = row / TileSize;
-        INDEX_TYPE TileCol   = col / TileSize;
-        INDEX_TYPE TileIndex = TileCol * numRowTiles + TileRow;
-        TileCounts[TileIndex]++;
+#pragma omp parallel for schedule(static, 1)
+    for(INDEX_TYPE t = 0; t < num_parts; ++t) {
+        vector<INDEX_TYPE> counts(NUM_PE, 0);
+        for(INDEX_TYPE i = (long)nnzR * t / num_parts; i < (long)nnzR * (t + 1) / num_parts; ++i) {
+            counts[RowIdx_COO[i] % NUM_PE]++;
+        }
+        for(INDEX_TYPE p = 0; p < NUM_PE; ++p) {
+            part_offsets[t * NUM_PE + p] = counts[p];
+        }
     }
 
-    INDEX_TYPE numTiles_nnzR = 0;
-    for(INDEX_TYPE i = 0; i < numTiles; ++i) {
-        if(TileCounts[i] != 0) numTiles_nnzR++;
+#pragma omp parallel for
+    for(INDEX_TYPE p = 0; p < NUM_PE; ++p) {
+        INDEX_TYPE band_nnzR = 0;
+        for(INDEX_TYPE t = 0; t < num_parts; ++t) {
+            INDEX_TYPE count = part_offsets[t * NUM_PE + p];
+            part_offsets[t * NUM_PE + p] = band_nnzR;
+            band_nnzR += count;
+        }
+        Matrix_Band_COO[p].nnzR = band_nnzR;
+        Matrix_Band_COO[p].RowIdx.resize(band_nnzR);
+        Matrix_Band_COO[p].RowIdx_copy.resize(band_nnzR);
+        Matrix_Band_COO[p].ColIdx.resize(band_nnzR);
+        Matrix_Band_COO[p].Val.resize(band_nnzR);
     }
 
-    TileMatrix_temp.TileColPtr.resize(numColTiles + 1, 0);
-    TileMatrix_temp.TileRowIdx.resize(numTiles_nnzR, 0);
-
-    for(INDEX_TYPE j = 0; j < numColTiles; ++j) {
-        for(INDEX_TYPE i = 0; i < numRowTiles; ++i) {
-            INDEX_TYPE TileIndex = j * numRowTiles + i;
-            if(TileCounts[TileIndex] != 0) {
-                TileMatrix_temp.TileColPtr[j + 1] += 1;
-                Matrix_COO cooElem_temp;
-                cooElem_temp.M    = TileSize;
-                cooElem_temp.K    = TileSize;
-                cooElem_temp.nnzR = TileCounts[TileIndex];
-
-                TileMatrix_temp.TileVal.push_back(cooElem_temp);
-            } 
+#pragma omp parallel for schedule(static, 1)
+    for(INDEX_TYPE t = 0; t < num_parts; ++t) {
+        vector<INDEX_TYPE> offsets(part_offsets.begin() + t * NUM_PE, part_offsets.begin() + (t + 1) * NUM_PE);
+        vector<INDEX_TYPE> max_row(NUM_PE, -1);
+        vector<INDEX_TYPE> max_col(NUM_PE, -1);
+
+        for(INDEX_TYPE i = (long)nnzR * t / num_parts; i < (long)nnzR * (t + 1) / num_parts; ++i) {
+            INDEX_TYPE row = RowIdx_COO[i];
+            INDEX_TYPE col = ColIdx_COO[i];
+            INDEX_TYPE p = row % NUM_PE;
+            INDEX_TYPE pos = offsets[p]++;
+            Matrix_COO &band = Matrix_Band_COO[p];
+            band.RowIdx[pos] = row / NUM_PE;
+            band.RowIdx_copy[pos] = row;
+            band.ColIdx[pos] = col;
+            band.Val[pos] = Val_COO[i];
+            max_row[p] = max(max_row[p], row / NUM_PE);
+            max_col[p] = max(max_col[p], col);
         }
-    }
 
-    for(INDEX_TYPE j = 0; j < numColTiles; ++j) {
-        TileMatrix_temp.TileColPtr[j + 1] += TileMatrix_temp.TileColPtr[j];
-    }
-    
-    vector<INDEX_TYPE> TileOffsets(numTiles, 0);
-    INDEX_TYPE offset = 0;
-    for(INDEX_TYPE i = 0; i < numTiles; ++i) {
-        if(TileCounts[i] != 0) {
-            TileOffsets[i] = offset;
-            offset++;
+        for(INDEX_TYPE p = 0; p < NUM_PE; ++p) {
+            part_max_row[t * NUM_PE + p] = max_row[p];
+            part_max_col[t * NUM_PE + p] = max_col[p];
         }
     }
 
-    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
-        INDEX_TYPE row        = RowIdx_COO[i];
-        INDEX_TYPE col        = ColIdx_COO[i];
-        VALUE_TYPE value      = Val_COO[i];
-        INDEX_TYPE TileRow    = row / TileSize;
-        INDEX_TYPE TileCol    = col / TileSize;
-        INDEX_TYPE TileIndex  = TileCol * numRowTiles + TileRow;
-        INDEX_TYPE TileOffset = TileOffsets[TileIndex];
-
-        TileMatrix_temp.TileRowIdx[TileOffset] = TileRow;
-        TileMatrix_temp.TileVal[TileOffset].ColIdx.push_back(col);
-        TileMatrix_temp.TileVal[TileOffset].RowIdx.push_back(row);
-        TileMatrix_temp.TileVal[TileOffset].Val.push_back(value);
-        
+    for(INDEX_TYPE p = 0; p < NUM_PE; ++p) {
+        INDEX_TYPE max_rownum = -1;
+        INDEX_TYPE max_colnum = -1;
+        for(INDEX_TYPE t = 0; t < num_parts; ++t) {
+            max_rownum = max(max_rownum, part_max_row[t * NUM_PE + p]);
+            max_colnum = max(max_colnum, part_max_col[t * NUM_PE + p]);
+        }
+        Matrix_Band_COO[p].M = max_rownum + 1;
+        Matrix_Band_COO[p].K = max_colnum + 1;
     }
-
-    TileMatrix_temp.numTiles  = TileMatrix_temp.TileColPtr[numColTiles];
-    TileMatrix = TileMatrix_temp;
 }
 
-void Create_Matrix_Band_SparseTile(const INDEX_TYPE TileSize,
-                                    const Matrix_COO &Matrix_Band_COO,
-                                    SparseTile      &Matrix_Band_Tile
-                                   ) {
-    INDEX_TYPE M = Matrix_Band_COO.M; 
-    INDEX_TYPE K = Matrix_Band_COO.K;
-    INDEX_TYPE nnzR = Matrix_Band_COO.nnzR;
+// build the tiled storage of an M x K COO matrix: a counting sort groups
+// the nonzeros by tile column, then each tile column is sorted by tile row
+// and local column; the input order is kept among equal keys
+void Build_SparseTile(const INDEX_TYPE TileSize,
+                      const INDEX_TYPE M,
+                      const INDEX_TYPE K,
+                      const INDEX_TYPE nnzR,
 
-    vector<INDEX_TYPE> RowIdx_COO = Matrix_Band_COO.RowIdx;
-    vector<INDEX_TYPE> RowIdx_COO_copy = Matrix_Band_COO.RowIdx_copy;
-    vector<INDEX_TYPE> ColIdx_COO = Matrix_Band_COO.ColIdx;
-    vector<VALUE_TYPE> Val_COO = Matrix_Band_COO.Val;
+                      const vector<INDEX_TYPE> &RowIdx_COO,
+                      const vector<INDEX_TYPE> &RowIdx_COO_copy,
+                      const vector<INDEX_TYPE> &ColIdx_COO,
+                      const vector<VALUE_TYPE> &Val_COO,
+
+                      SparseTile &TileMatrix
+                     ) {
 
     INDEX_TYPE numColTiles = (K + TileSize - 1) / TileSize;
     INDEX_TYPE numRowTiles = (M + TileSize - 1) / TileSize;
 
-    INDEX_TYPE newnumCols  = numColTiles * TileSize;
-    INDEX_TYPE newnumRows  = numRowTiles * TileSize;
-    INDEX_TYPE newnnzR     = nnzR;
+    TileMatrix.TileSize    = TileSize;
+    TileMatrix.numColTiles = numColTiles;
+    TileMatrix.numRowTiles = numRowTiles;
 
-    if(newnumCols != K || newnumRows != M) {
-        newnnzR += (newnumCols - K);
+    vector<INDEX_TYPE> ColTilePtr(numColTiles + 1, 0);
+    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
+        ColTilePtr[ColIdx_COO[i] / TileSize + 1]++;
     }
-
-    SparseTile Matrix_Band_Tile_temp;
-
-    Matrix_Band_Tile_temp.numColTiles = numColTiles;
-    Matrix_Band_Tile_temp.numRowTiles = numRowTiles;
-    Matrix_Band_Tile_temp.TileSize    = TileSize;
-
-    INDEX_TYPE numTiles         = numColTiles * numRowTiles;
-
-    Matrix_Band_Tile_temp.numTiles    = numTiles;
-    
-    vector<INDEX_TYPE> TileCounts(numTiles, 0);
-
-    for (INDEX_TYPE i = 0; i < nnzR; ++i) {
-        INDEX_TYPE row       = RowIdx_COO[i];
-        INDEX_TYPE col       = ColIdx_COO[i];
-        INDEX_TYPE TileRow   = row / TileSize;
-        INDEX_TYPE TileCol   = col / TileSize;
-        INDEX_TYPE TileIndex = TileCol * numRowTiles + TileRow;
-        TileCounts[TileIndex]++;
+    for(INDEX_TYPE j = 0; j < numColTiles; ++j) {
+        ColTilePtr[j + 1] += ColTilePtr[j];
     }
 
-    INDEX_TYPE numTiles_nnzR = 0;
-    for(INDEX_TYPE i = 0; i < numTiles; ++i) {
-        if(TileCounts[i] != 0) numTiles_nnzR++;
+    vector<INDEX_TYPE> order(nnzR);
+    {
+        vector<INDEX_TYPE> offsets(ColTilePtr.begin(), ColTilePtr.end() - 1);
+        for(INDEX_TYPE i = 0; i < nnzR; ++i) {
+            order[offsets[ColIdx_COO[i] / TileSize]++] = i;
+        }
     }
 
-    Matrix_Band_Tile_temp.TileColPtr.resize(numColTiles + 1, 0);
-    Matrix_Band_Tile_temp.TileRowIdx.resize(numTiles_nnzR, 0);
+    TileMatrix.TileColPtr.assign(numColTiles + 1, 0);
+    TileMatrix.TileRowIdx.clear();
+    TileMatrix.TilePtr.assign(1, 0);
+    TileMatrix.Mask.clear();
 
     for(INDEX_TYPE j = 0; j < numColTiles; ++j) {
-        for(INDEX_TYPE i = 0; i < numRowTiles; ++i) {
-            INDEX_TYPE TileIndex = j * numRowTiles + i;
-            if(TileCounts[TileIndex] != 0) {
-                Matrix_Band_Tile_temp.TileColPtr[j + 1] += 1;
-
-                Matrix_COO cooElem_temp;
-                cooElem_temp.M    = TileSize;
-                cooElem_temp.K    = TileSize;
-                cooElem_temp.nnzR = TileCounts[TileIndex];
-                cooElem_temp.mask.resize(TileSize, 0);
-                cooElem_temp.map.resize(TileSize);
-
-                Matrix_Band_Tile_temp.TileVal.push_back(cooElem_temp);
-            } 
+        INDEX_TYPE col_base = j * TileSize;
+        std::stable_sort(order.begin() + ColTilePtr[j], order.begin() + ColTilePtr[j + 1],
+                         [&](const INDEX_TYPE a, const INDEX_TYPE b) {
+                             INDEX_TYPE tile_row_a = RowIdx_COO[a] / TileSize;
+                             INDEX_TYPE tile_row_b = RowIdx_COO[b] / TileSize;
+                             if(tile_row_a != tile_row_b) return tile_row_a < tile_row_b;
+                             return ColIdx_COO[a] < ColIdx_COO[b];
+                         });
+
+        INDEX_TYPE tile_row_last = -1;
+        for(INDEX_TYPE k = ColTilePtr[j]; k < ColTilePtr[j + 1]; ++k) {
+            INDEX_TYPE row = RowIdx_COO[order[k]];
+            INDEX_TYPE col = ColIdx_COO[order[k]];
+            INDEX_TYPE TileRow = row / TileSize;
+            if(TileRow != tile_row_last) {
+                if(tile_row_last != -1) {
+                    TileMatrix.TilePtr.push_back(k);
+                }
+                TileMatrix.TileRowIdx.push_back(TileRow);
+                TileMatrix.Mask.resize(TileMatrix.Mask.size() + TileSize, 0);
+                tile_row_last = TileRow;
+            }
+            TileMatrix.Mask[TileMatrix.Mask.size() - TileSize + (col - col_base)] |= (0x1 << (row - TileRow * TileSize));
         }
+        if(tile_row_last != -1) {
+            TileMatrix.TilePtr.push_back(ColTilePtr[j + 1]);
+        }
+        TileMatrix.TileColPtr[j + 1] = TileMatrix.TileRowIdx.size();
     }
 
-    for(INDEX_TYPE j = 0; j < numColTiles; ++j) {
-        Matrix_Band_Tile_temp.TileColPtr[j + 1] += Matrix_Band_Tile_temp.TileColPtr[j];
-    }
-    
-    vector<INDEX_TYPE> TileOffsets(numTiles, 0);
-    INDEX_TYPE offset = 0;
-    for(INDEX_TYPE i = 0; i < numTiles; ++i) {
-        if(TileCounts[i] != 0) {
-            TileOffsets[i] = offset;
-            offset++;
-        }
+    TileMatrix.numTiles = TileMatrix.TileRowIdx.size();
+
+    TileMatrix.RowIdx.resize(nnzR);
+    TileMatrix.RowIdx_copy.resize(nnzR);
+    TileMatrix.ColIdx.resize(nnzR);
+    TileMatrix.Val.resize(nnzR);
+    for(INDEX_TYPE k = 0; k < nnzR; ++k) {
+        TileMatrix.RowIdx[k]      = RowIdx_COO[order[k]];
+        TileMatrix.RowIdx_copy[k] = RowIdx_COO_copy[order[k]];
+        TileMatrix.ColIdx[k]      = ColIdx_COO[order[k]];
+        TileMatrix.Val[k]         = Val_COO[order[k]];
     }
+}
 
-    vector<INDEX_TYPE> Tile_push_num(numTiles_nnzR, 0);
+void Create_SparseTile(const INDEX_TYPE M, 
+                        const INDEX_TYPE K, 
+                        const INDEX_TYPE nnzR,
 
-    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
-        INDEX_TYPE row         = RowIdx_COO[i];
-        INDEX_TYPE row_copy    = RowIdx_COO_copy[i];
-        INDEX_TYPE col         = ColIdx_COO[i];
-        VALUE_TYPE value       = Val_COO[i];
-        INDEX_TYPE TileRow    = row / TileSize;
-        INDEX_TYPE TileCol    = col / TileSize;
-        INDEX_TYPE TileIndex  = TileCol * numRowTiles + TileRow;
-        INDEX_TYPE TileOffset = TileOffsets[TileIndex];
+                        const INDEX_TYPE TileSize,
 
-        Matrix_Band_Tile_temp.TileRowIdx[TileOffset] = TileRow;
-        Matrix_Band_Tile_temp.TileVal[TileOffset].ColIdx.push_back(col);
-        Matrix_Band_Tile_temp.TileVal[TileOffset].RowIdx.push_back(row);
-        
-        Matrix_Band_Tile_temp.TileVal[TileOffset].RowIdx_copy.push_back(row_copy);
-        Matrix_Band_Tile_temp.TileVal[TileOffset].Val.push_back(value);
+                        const vector<INDEX_TYPE> &RowIdx_COO,
+                        const vector<INDEX_TYPE> &ColIdx_COO,
+                        const vector<VALUE_TYPE> &Val_COO,
 
-        Matrix_Band_Tile_temp.TileVal[TileOffset].mask[col - TileCol * Tile_SIZE] |=  (0x1 << (row - TileRow * Tile_SIZE));
-        Matrix_Band_Tile_temp.TileVal[TileOffset].map[col - TileCol * Tile_SIZE].push_back(Tile_push_num[TileOffset]);
-        Tile_push_num[TileOffset]++;
-    }
+                        SparseTile &TileMatrix
+                        ) {
 
-    Matrix_Band_Tile_temp.numTiles  = Matrix_Band_Tile_temp.TileColPtr[numColTiles];
-    Matrix_Band_Tile = Matrix_Band_Tile_temp;
+    Build_SparseTile(TileSize, M, K, nnzR, RowIdx_COO, RowIdx_COO, ColIdx_COO, Val_COO, TileMatrix);
 }
 
+void Create_Matrix_Band_SparseTile(const INDEX_TYPE TileSize,
+                                    const Matrix_COO &Matrix_Band_COO,
+                                    SparseTile      &Matrix_Band_Tile
+                                   ) {
 
-void Create_Matrix_Band_SparseTile_ex(const vector<Matrix_COO> &Matrix_Band_COO,
-                                       vector<SparseTile> &Matrix_Band_Tile) {
+    Build_SparseTile(TileSize,
+                     Matrix_Band_COO.M,
+                     Matrix_Band_COO.K,
+                     Matrix_Band_COO.nnzR,
+                     Matrix_Band_COO.RowIdx,
+                     Matrix_Band_COO.RowIdx_copy,
+                     Matrix_Band_COO.ColIdx,
+                     Matrix_Band_COO.Val,
+                     Matrix_Band_Tile
+                    );
+}
+
+
+void Create_Matrix_Band_SparseTile_ex(const INDEX_TYPE TileSize,
+                                      const vector<Matrix_COO> &Matrix_Band_COO,
+                                      vector<SparseTile> &Matrix_Band_Tile) {
 #pragma omp parallel for
     for(INDEX_TYPE i = 0; i < Matrix_Band_Tile.size(); ++i) {
-        Create_Matrix_Band_SparseTile(Tile_SIZE, Matrix_Band_COO[i], Matrix_Band_Tile[i]);
+        Create_Matrix_Band_SparseTile(TileSize, Matrix_Band_COO[i], Matrix_Band_Tile[i]);
     }
 
 }
 
-void Tile_MiniSimilar_Column_reorder(Matrix_COO &TileVal) {
+// reorder the columns of tile TileIdx so that consecutive columns share
+// as few rows as possible; the nonzeros of a tile are grouped by column
+void Tile_MiniSimilar_Column_reorder(SparseTile &Matrix_SparseTile, const INDEX_TYPE TileIdx) {
 
-    vector<INDEX_TYPE> RowIdx_tmp;
-    vector<INDEX_TYPE> RowIdx_copy_tmp;
-    vector<INDEX_TYPE> ColIdx_tmp;
-    vector<VALUE_TYPE> Val_tmp;
-    
-    vector<unsigned short> mask_tmp = TileVal.mask;
+    const INDEX_TYPE TileSize = Matrix_SparseTile.TileSize;
+    const INDEX_TYPE begin = Matrix_SparseTile.TilePtr[TileIdx];
+    const INDEX_TYPE end = Matrix_SparseTile.TilePtr[TileIdx + 1];
+    const INDEX_TYPE col_base = Matrix_SparseTile.ColIdx[begin] / TileSize * TileSize;
 
-    vector<INDEX_TYPE> list;
+    unsigned short mask_tmp[16];
+    INDEX_TYPE list[16];
+    INDEX_TYPE list_len = 0;
 
     INDEX_TYPE mask_num = 0;
 
-    for(INDEX_TYPE maskcol = 0; maskcol < Tile_SIZE; ++maskcol) {
+    for(INDEX_TYPE maskcol = 0; maskcol < TileSize; ++maskcol) {
+        mask_tmp[maskcol] = Matrix_SparseTile.Mask[TileIdx * TileSize + maskcol];
         if(CountOnes(mask_tmp[maskcol]) != 0) {
+            if(mask_num == 0) {
+                list[list_len++] = maskcol;
+            }
             mask_num++;
         }
     }
 
-    for(INDEX_TYPE maskcol = 0; maskcol < Tile_SIZE; ++maskcol) {
-        if(CountOnes(mask_tmp[maskcol]) != 0) {
-            list.push_back(maskcol);
-            break;
-        }
-    }
-
+    INDEX_TYPE min_colidx = 0;
     INDEX_TYPE num = 0;
     while(num < mask_num - 1) {
-        INDEX_TYPE pos = list.size();
-        INDEX_TYPE this_col = list[pos - 1];
+        INDEX_TYPE this_col = list[list_len - 1];
         unsigned short this_mask = mask_tmp[this_col];
 
         INDEX_TYPE min_val = 10000;
-        INDEX_TYPE min_colidx;
 
-        for(INDEX_TYPE maskcol_next = 0; maskcol_next < Tile_SIZE; ++maskcol_next) {
+        for(INDEX_TYPE maskcol_next = 0; maskcol_next < TileSize; ++maskcol_next) {
             if(this_col != maskcol_next) {
                 if(CountOnes(mask_tmp[maskcol_next]) != 0) {
                     INDEX_TYPE countone = CountOnes(this_mask & mask_tmp[maskcol_next]);
@@ -670,32 +833,73 @@ void Tile_MiniSimilar_Column_reorder(Matrix_COO &TileVal) {
             }
         }
 
-        list.resize(pos + 1);
-        list[pos] = min_colidx;
+        list[list_len++] = min_colidx;
         mask_tmp[this_col] &= 0;
         num++;
     }
 
-    for(INDEX_TYPE i = 0; i < list.size(); ++i) {
-        for(INDEX_TYPE j = 0; j < TileVal.map[list[i]].size(); ++j) {
-            RowIdx_tmp.push_back(TileVal.RowIdx[TileVal.map[list[i]][j]]);
-            RowIdx_copy_tmp.push_back(TileVal.RowIdx_copy[TileVal.map[list[i]][j]]);
-            ColIdx_tmp.push_back(TileVal.ColIdx[TileVal.map[list[i]][j]]);
-            Val_tmp.push_back(TileVal.Val[TileVal.map[list[i]][j]]);
+    // column segments of the tile, which is sorted by column
+    INDEX_TYPE col_ptr[17] = {0};
+    for(INDEX_TYPE k = begin; k < end; ++k) {
+        col_ptr[Matrix_SparseTile.ColIdx[k] - col_base + 1]++;
+    }
+    for(INDEX_TYPE c = 0; c < TileSize; ++c) {
+        col_ptr[c + 1] += col_ptr[c];
+    }
+
+    bool in_order = true;
+    for(INDEX_TYPE i = 1; i < list_len; ++i) {
+        in_order &= (list[i] > list[i - 1]);
+    }
+    if(in_order) {
+        return;
+    }
+
+    const INDEX_TYPE TilennzR = end - begin;
+    INDEX_TYPE RowIdx_buf[256], RowIdx_copy_buf[256], ColIdx_buf[256];
+    VALUE_TYPE Val_buf[256];
+    vector<INDEX_TYPE> RowIdx_tmp, RowIdx_copy_tmp, ColIdx_tmp;
+    vector<VALUE_TYPE> Val_tmp;
+
+    INDEX_TYPE *RowIdx_out = RowIdx_buf;
+    INDEX_TYPE *RowIdx_copy_out = RowIdx_copy_buf;
+    INDEX_TYPE *ColIdx_out = ColIdx_buf;
+    VALUE_TYPE *Val_out = Val_buf;
+
+    // tiles only exceed TileSize * TileSize nonzeros with duplicate entries
+    if(TilennzR > 256) {
+        RowIdx_tmp.resize(TilennzR);
+        RowIdx_copy_tmp.resize(TilennzR);
+        ColIdx_tmp.resize(TilennzR);
+        Val_tmp.resize(TilennzR);
+        RowIdx_out = RowIdx_tmp.data();
+        RowIdx_copy_out = RowIdx_copy_tmp.data();
+        ColIdx_out = ColIdx_tmp.data();
+        Val_out = Val_tmp.data();
+    }
+
+    INDEX_TYPE pos = 0;
+    for(INDEX_TYPE i = 0; i < list_len; ++i) {
+        for(INDEX_TYPE k = begin + col_ptr[list[i]]; k < begin + col_ptr[list[i] + 1]; ++k) {
+            RowIdx_out[pos]      = Matrix_SparseTile.RowIdx[k];
+            RowIdx_copy_out[pos] = Matrix_SparseTile.RowIdx_copy[k];
+            ColIdx_out[pos]      = Matrix_SparseTile.ColIdx[k];
+            Val_out[pos]         = Matrix_SparseTile.Val[k];
+            pos++;
         }
     }
 
-    TileVal.RowIdx = RowIdx_tmp;
-    TileVal.RowIdx_copy = RowIdx_copy_tmp;
-    TileVal.ColIdx = ColIdx_tmp;
-    TileVal.Val = Val_tmp;
+    std::copy(RowIdx_out, RowIdx_out + TilennzR, Matrix_SparseTile.RowIdx.begin() + begin);
+    std::copy(RowIdx_copy_out, RowIdx_copy_out + TilennzR, Matrix_SparseTile.RowIdx_copy.begin() + begin);
+    std::copy(ColIdx_out, ColIdx_out + TilennzR, Matrix_SparseTile.ColIdx.begin() + begin);
+    std::copy(Val_out, Val_out + TilennzR, Matrix_SparseTile.Val.begin() + begin);
 }
 
 
 void Get_tile_nnzr(const SparseTile &Matrix_SparseTile, vector<INDEX_TYPE> &tile_nnzr, INDEX_TYPE &tile_num) {
     for(INDEX_TYPE j = 0; j < Matrix_SparseTile.numColTiles; ++j) {
         for(INDEX_TYPE i = Matrix_SparseTile.TileColPtr[j]; i < Matrix_SparseTile.TileColPtr[j + 1]; ++i) {
-            INDEX_TYPE nnzr = Matrix_SparseTile.TileVal[i].nnzR;
+            INDEX_TYPE nnzr = Matrix_SparseTile.TilePtr[i + 1] - Matrix_SparseTile.TilePtr[i];
             if(nnzr != 0) {
                 INDEX_TYPE pos = tile_nnzr.size();
                 tile_nnzr.resize(pos + 1);
@@ -706,53 +910,193 @@ void Get_tile_nnzr(const SparseTile &Matrix_SparseTile, vector<INDEX_TYPE> &tile
     }
 }
 
+// per-thread scratch of Reordering, kept across calls: the row table is
+// only valid for entries stamped with the current epoch, so it never has
+// to be cleared, and the occupied slots are tracked in a bitmap
+struct Reorder_Workspace {
+    vector<INDEX_TYPE> row_slot;
+    vector<unsigned int> row_epoch;
+    unsigned int epoch;
+
+    vector<unsigned long long> slot_used;
+    vector<INDEX_TYPE> slot;
+
+    vector<INDEX_TYPE> group_ptr;
+    vector<INDEX_TYPE> group_elem;
+    vector<std::pair<INDEX_TYPE, INDEX_TYPE> > ready;
+    vector<std::pair<INDEX_TYPE, INDEX_TYPE> > cooling;
+
+    Reorder_Workspace() : row_slot(), row_epoch(), epoch(0), slot_used(), slot(), group_ptr(), group_elem(), ready(), cooling() {}
+};
+
+// start a new call: rows stamped with an older epoch are treated as unseen
+inline void Next_epoch(Reorder_Workspace &ws, const INDEX_TYPE NUM_Row) {
+    if(ws.row_epoch.size() < (size_t)NUM_Row) {
+        ws.row_slot.resize(NUM_Row);
+        ws.row_epoch.resize(NUM_Row, 0);
+    }
+    if(++ws.epoch == 0) {
+        std::fill(ws.row_epoch.begin(), ws.row_epoch.end(), 0);
+        ws.epoch = 1;
+    }
+}
+
+// first free slot at or after start, growing the bitmap as needed
+inline INDEX_TYPE Find_next_free_slot(vector<unsigned long long> &slot_used, const INDEX_TYPE start) {
+    size_t w = start >> 6;
+    if(w >= slot_used.size()) {
+        slot_used.resize(max(w + 1, 2 * slot_used.size()), 0);
+    }
+    unsigned long long free_bits = ~slot_used[w] & (~0ULL << (start & 63));
+    while(free_bits == 0) {
+        w++;
+        if(w >= slot_used.size()) {
+            slot_used.resize(2 * slot_used.size(), 0);
+        }
+        free_bits = ~slot_used[w];
+    }
+    return (INDEX_TYPE)(w << 6) + __builtin_ctzll(free_bits);
+}
+
+// place every element in the first free slot at least WIDTH slots after
+// the previous element of the same row
 void Reordering(const vector<SpElement> &temp_SpElement_list,
                 vector<SpElement> &SpEelment_list,
                 const INDEX_TYPE base_col_index,
                 const INDEX_TYPE i_start,
                 const INDEX_TYPE NUM_Row,
                 const INDEX_TYPE NUM_PE,
-                const INDEX_TYPE WIDTH
+                const INDEX_TYPE WIDTH,
+                Reorder_Workspace &ws
                 ) {
 
     SpElement sp_empty = {-1, -1, (VALUE_TYPE)0};
 
-    vector<SpElement> scheduled_SpElement;
-    
-    vector<INDEX_TYPE> sliding_window(NUM_Row, -WIDTH);
-    INDEX_TYPE org_row_idx;
+    INDEX_TYPE list_size = temp_SpElement_list.size();
+    if(list_size == 0) {
+        return;
+    }
 
-    for(INDEX_TYPE p = 0; p < temp_SpElement_list.size(); ++p) {
-        org_row_idx = temp_SpElement_list[p].rowIdx;
-        INDEX_TYPE win_row_idx = sliding_window[org_row_idx] + WIDTH;
-        INDEX_TYPE insert_flag = 1;
-        while(insert_flag){
-            if(win_row_idx >= ((INDEX_TYPE)scheduled_SpElement.size())) {
-                scheduled_SpElement.resize(win_row_idx + 1);
-                scheduled_SpElement[win_row_idx] = sp_empty;
-            }
-            SpElement sp = scheduled_SpElement[win_row_idx];
-            if(sp.rowIdx == -1 && sp.colIdx == -1 && sp.val == 0.0) {
-                insert_flag = 0;
-            }
-            else {
-                win_row_idx++;
-            }
+    Next_epoch(ws, NUM_Row);
+    ws.slot_used.assign(((size_t)list_size * 2 + 63) >> 6, 0);
+    ws.slot.resize(list_size);
+
+    INDEX_TYPE scheduled_SpElement_size = 0;
+
+    for(INDEX_TYPE p = 0; p < list_size; ++p) {
+        INDEX_TYPE org_row_idx = temp_SpElement_list[p].rowIdx;
+        INDEX_TYPE start = (ws.row_epoch[org_row_idx] == ws.epoch) ? ws.row_slot[org_row_idx] + WIDTH : 0;
+
+        INDEX_TYPE win_row_idx = Find_next_free_slot(ws.slot_used, start);
+        ws.slot_used[win_row_idx >> 6] |= 1ULL << (win_row_idx & 63);
+
+        ws.slot[p] = win_row_idx;
+        ws.row_slot[org_row_idx] = win_row_idx;
+        ws.row_epoch[org_row_idx] = ws.epoch;
+        scheduled_SpElement_size = max(scheduled_SpElement_size, win_row_idx + 1);
+    }
+
+    SpEelment_list.resize(i_start + scheduled_SpElement_size, sp_empty);
+    for(INDEX_TYPE p = 0; p < list_size; ++p) {
+        SpElement &sp = SpEelment_list[i_start + ws.slot[p]];
+        sp.colIdx = temp_SpElement_list[p].colIdx - base_col_index;
+        sp.rowIdx = temp_SpElement_list[p].rowIdx;
+        sp.val = temp_SpElement_list[p].val;
+    }
+}
+
+// list scheduling: at every slot issue the next element of the ready row
+// with the most elements left (first seen row on ties), and only leave a
+// bubble when every remaining row is still within WIDTH of its last slot.
+// For a uniform dependence distance this gives the shortest schedule,
+// max(n, (c - 1) * WIDTH + r) for n elements whose busiest rows, r of
+// them, have c elements each
+void List_Scheduling(const vector<SpElement> &temp_SpElement_list,
+                     vector<SpElement> &SpEelment_list,
+                     const INDEX_TYPE base_col_index,
+                     const INDEX_TYPE i_start,
+                     const INDEX_TYPE NUM_Row,
+                     const INDEX_TYPE NUM_PE,
+                     const INDEX_TYPE WIDTH,
+                     Reorder_Workspace &ws
+                    ) {
+
+    SpElement sp_empty = {-1, -1, (VALUE_TYPE)0};
+
+    INDEX_TYPE list_size = temp_SpElement_list.size();
+    if(list_size == 0) {
+        return;
+    }
+
+    // group the elements by row, rows numbered by first appearance
+    Next_epoch(ws, NUM_Row);
+    ws.group_ptr.assign(1, 0);
+    for(INDEX_TYPE p = 0; p < list_size; ++p) {
+        INDEX_TYPE row = temp_SpElement_list[p].rowIdx;
+        if(ws.row_epoch[row] != ws.epoch) {
+            ws.row_epoch[row] = ws.epoch;
+            ws.row_slot[row] = ws.group_ptr.size() - 1;
+            ws.group_ptr.push_back(0);
         }
+        ws.group_ptr[ws.row_slot[row] + 1]++;
+    }
+    INDEX_TYPE group_num = ws.group_ptr.size() - 1;
+    for(INDEX_TYPE g = 0; g < group_num; ++g) {
+        ws.group_ptr[g + 1] += ws.group_ptr[g];
+    }
+    ws.group_elem.resize(list_size);
+    ws.slot.assign(ws.group_ptr.begin(), ws.group_ptr.end() - 1);
+    for(INDEX_TYPE p = 0; p < list_size; ++p) {
+        ws.group_elem[ws.slot[ws.row_slot[temp_SpElement_list[p].rowIdx]]++] = p;
+    }
 
-        scheduled_SpElement[win_row_idx].colIdx = temp_SpElement_list[p].colIdx - base_col_index;
-        scheduled_SpElement[win_row_idx].rowIdx = org_row_idx;
-        scheduled_SpElement[win_row_idx].val = temp_SpElement_list[p].val;
-        sliding_window[org_row_idx] = win_row_idx;
+    // ready rows in a max-heap of (elements left, -group), cooling rows in
+    // a FIFO of (ready slot, group) which is sorted since WIDTH is uniform
+    ws.ready.resize(0);
+    ws.cooling.resize(0);
+    for(INDEX_TYPE g = 0; g < group_num; ++g) {
+        ws.ready.push_back(std::make_pair(ws.group_ptr[g + 1] - ws.group_ptr[g], -g));
     }
+    std::make_heap(ws.ready.begin(), ws.ready.end());
+
+    // ws.slot[g] is the next element of group g, ws.slot[group_num + p] the slot of element p
+    ws.slot.resize(group_num + list_size);
+    std::copy(ws.group_ptr.begin(), ws.group_ptr.end() - 1, ws.slot.begin());
+
+    INDEX_TYPE t = 0;
+    INDEX_TYPE issued = 0;
+    size_t cooling_head = 0;
+    while(issued < list_size) {
+        while(cooling_head < ws.cooling.size() && ws.cooling[cooling_head].first <= t) {
+            INDEX_TYPE g = ws.cooling[cooling_head].second;
+            ws.ready.push_back(std::make_pair(ws.group_ptr[g + 1] - ws.slot[g], -g));
+            std::push_heap(ws.ready.begin(), ws.ready.end());
+            cooling_head++;
+        }
+        if(ws.ready.empty()) {
+            t = ws.cooling[cooling_head].first;
+            continue;
+        }
 
-    INDEX_TYPE scheduled_SpElement_size = scheduled_SpElement.size();
+        std::pop_heap(ws.ready.begin(), ws.ready.end());
+        INDEX_TYPE g = -ws.ready.back().second;
+        ws.ready.pop_back();
 
-    if(scheduled_SpElement_size > 0) {
-        SpEelment_list.resize(i_start + scheduled_SpElement_size, sp_empty);
-        for(INDEX_TYPE i = 0; i < scheduled_SpElement_size; ++i) {
-            SpEelment_list[i + i_start] = scheduled_SpElement[i];
+        INDEX_TYPE p = ws.group_elem[ws.slot[g]++];
+        ws.slot[group_num + p] = t;
+        if(ws.slot[g] < ws.group_ptr[g + 1]) {
+            ws.cooling.push_back(std::make_pair(t + WIDTH, g));
         }
+        issued++;
+        t++;
+    }
+
+    SpEelment_list.resize(i_start + t, sp_empty);
+    for(INDEX_TYPE p = 0; p < list_size; ++p) {
+        SpElement &sp = SpEelment_list[i_start + ws.slot[group_num + p]];
+        sp.colIdx = temp_SpElement_list[p].colIdx - base_col_index;
+        sp.rowIdx = temp_SpElement_list[p].rowIdx;
+        sp.val = temp_SpElement_list[p].val;
     }
 }
 
@@ -784,6 +1128,72 @@ void Push_SpEelment_list(const vector<SpElement> &temp_SpElement_list,
     }
 }
 
+// schedulers that turn the elements of one (batch, PE) pair into a list
+// the MAU can accumulate without hazards; the id is stored in image caches
+enum Scheduler_Type {
+    SCHEDULER_WINDOW = 0,
+    SCHEDULER_LIST   = 1,
+    SCHEDULER_NUM
+};
+
+const char *Scheduler_name(const INDEX_TYPE scheduler) {
+    switch(scheduler) {
+        case SCHEDULER_WINDOW: return "window";
+        case SCHEDULER_LIST:   return "list";
+        default:               return "unknown";
+    }
+}
+
+// returns -1 for an unknown name
+INDEX_TYPE Parse_scheduler(const std::string &name) {
+    for(INDEX_TYPE s = 0; s < SCHEDULER_NUM; ++s) {
+        if(name == Scheduler_name(s)) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+const char *A_format_name(const INDEX_TYPE A_format) {
+    switch(A_format) {
+        case A_FORMAT_FP32:     return "fp32";
+        case A_FORMAT_PATTERN:  return "pattern";
+        case A_FORMAT_CODEBOOK: return "codebook";
+        case A_FORMAT_FP16:     return "fp16";
+        case A_FORMAT_BF16:     return "bf16";
+        case A_FORMAT_DELTA:    return "delta";
+        default:                return "unknown";
+    }
+}
+
+// returns -1 for an unknown name
+INDEX_TYPE Parse_A_format(const std::string &name) {
+    for(INDEX_TYPE f = 0; f < A_FORMAT_NUM; ++f) {
+        if(name == A_format_name(f)) {
+            return f;
+        }
+    }
+    return -1;
+}
+
+void Schedule_SpElement_list(const INDEX_TYPE scheduler,
+                             const vector<SpElement> &temp_SpElement_list,
+                             vector<SpElement> &SpEelment_list,
+                             const INDEX_TYPE base_col_index,
+                             const INDEX_TYPE i_start,
+                             const INDEX_TYPE NUM_Row,
+                             const INDEX_TYPE NUM_PE,
+                             const INDEX_TYPE WIDTH,
+                             Reorder_Workspace &ws
+                            ) {
+    if(scheduler == SCHEDULER_LIST) {
+        List_Scheduling(temp_SpElement_list, SpEelment_list, base_col_index, i_start, NUM_Row, NUM_PE, WIDTH, ws);
+    }
+    else {
+        Reordering(temp_SpElement_list, SpEelment_list, base_col_index, i_start, NUM_Row, NUM_PE, WIDTH, ws);
+    }
+}
+
 void Create_SpElement_list_for_all_PEs(const INDEX_TYPE NUM_PE,
                                        const INDEX_TYPE NUM_ROW,
                                        const INDEX_TYPE NUM_COLUMN,
@@ -793,7 +1203,8 @@ void Create_SpElement_list_for_all_PEs(const INDEX_TYPE NUM_PE,
                                        vector<SparseTile> &Matrix_Band_Tile,
                                        vector<vector<SpElement> > &SpElement_list_pes,
                                        vector<INDEX_TYPE> &SpElement_list_ptr,
-                                       const INDEX_TYPE WINDOWS = 10
+                                       const INDEX_TYPE WINDOWS = 10,
+                                       const INDEX_TYPE SCHEDULER = SCHEDULER_WINDOW
                                       ) {
     SpElement_list_pes.resize(NUM_PE); 
 
@@ -802,107 +1213,482 @@ void Create_SpElement_list_for_all_PEs(const INDEX_TYPE NUM_PE,
         numColTiles_max = max(Matrix_Band_Tile[p].numColTiles, numColTiles_max);
     }
 
-    SpElement_list_ptr.resize((numColTiles_max + BATCH_SIZE - 1) / BATCH_SIZE + 1, 0);
+    INDEX_TYPE Batch_num = (numColTiles_max + BATCH_SIZE - 1) / BATCH_SIZE;
+
+    SpElement_list_ptr.resize(Batch_num + 1, 0);
 
-    vector<vector<SpElement> > temp_SpElement_list_pes(NUM_PE);
-    for(INDEX_TYPE i = 0; i < (numColTiles_max + BATCH_SIZE - 1) / BATCH_SIZE; ++i) {
+    // phase 1: every (batch, PE) pair is scheduled on its own, the tiles of
+    // different pairs are disjoint so the column reorder can run in parallel
+    vector<vector<SpElement> > SpElement_list_pieces(Batch_num * NUM_PE);
 
-#pragma omp parallel for     
-        for(INDEX_TYPE p = 0; p < NUM_PE; p++) {
-            temp_SpElement_list_pes[p].resize(0);
+#pragma omp parallel
+    {
+        vector<SpElement> temp_SpElement_list;
+        Reorder_Workspace ws;
+
+#pragma omp for schedule(dynamic)
+        for(INDEX_TYPE ip = 0; ip < Batch_num * NUM_PE; ++ip) {
+            INDEX_TYPE i = ip / NUM_PE;
+            INDEX_TYPE p = ip % NUM_PE;
+
+            temp_SpElement_list.resize(0);
             for(INDEX_TYPE Tilecolidx =  BATCH_SIZE * i; Tilecolidx < min(BATCH_SIZE * (i + 1), Matrix_Band_Tile[p].numColTiles); ++Tilecolidx) {
                 for(INDEX_TYPE j = Matrix_Band_Tile[p].TileColPtr[Tilecolidx]; j < Matrix_Band_Tile[p].TileColPtr[Tilecolidx + 1]; ++j) {
-                    INDEX_TYPE TilennzR = Matrix_Band_Tile[p].TileVal[j].nnzR;
-                    Tile_MiniSimilar_Column_reorder(Matrix_Band_Tile[p].TileVal[j]);
+                    Tile_MiniSimilar_Column_reorder(Matrix_Band_Tile[p], j);
 
-                    for(INDEX_TYPE k = 0; k < TilennzR; ++k) {
-                        INDEX_TYPE pos = temp_SpElement_list_pes[p].size();
-                        temp_SpElement_list_pes[p].resize(pos + 1);
-                        temp_SpElement_list_pes[p][pos] = SpElement(Matrix_Band_Tile[p].TileVal[j].ColIdx[k], Matrix_Band_Tile[p].TileVal[j].RowIdx[k], Matrix_Band_Tile[p].TileVal[j].Val[k]);
+                    for(INDEX_TYPE k = Matrix_Band_Tile[p].TilePtr[j]; k < Matrix_Band_Tile[p].TilePtr[j + 1]; ++k) {
+                        temp_SpElement_list.push_back(SpElement(Matrix_Band_Tile[p].ColIdx[k], Matrix_Band_Tile[p].RowIdx[k], Matrix_Band_Tile[p].Val[k]));
                     }
                 }
             } 
 
-            INDEX_TYPE i_start = SpElement_list_pes[p].size();
             INDEX_TYPE base_col_index = i * BATCH_SIZE * Tile_SIZE;
 
-            Reordering(temp_SpElement_list_pes[p],
-                       SpElement_list_pes[p],
-                       base_col_index,
-                       i_start,
-                       NUM_ROW,
-                       NUM_PE,
-                       WINDOWS
-                      );
+            Schedule_SpElement_list(SCHEDULER,
+                                    temp_SpElement_list,
+                                    SpElement_list_pieces[ip],
+                                    base_col_index,
+                                    0,
+                                    NUM_ROW,
+                                    NUM_PE,
+                                    WINDOWS,
+                                    ws
+                                   );
         }
+    }
 
+    // phase 2: a batch is as long as its longest piece, the batch offsets
+    // are the prefix sum of these lengths
+    for(INDEX_TYPE i = 0; i < Batch_num; ++i) {
         INDEX_TYPE max_len = 0;
         for(INDEX_TYPE p = 0; p < NUM_PE; ++p) {
-            max_len = max((INDEX_TYPE) SpElement_list_pes[p].size(), max_len);
+            max_len = max((INDEX_TYPE) SpElement_list_pieces[i * NUM_PE + p].size(), max_len);
         }
-        
-        for(INDEX_TYPE p = 0; p < NUM_PE; ++p) {
-            SpElement_list_pes[p].resize(max_len, SpElement(-1, -1, 0.0));
+        SpElement_list_ptr[i + 1] = SpElement_list_ptr[i] + max_len;
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for(INDEX_TYPE p = 0; p < NUM_PE; ++p) {
+        SpElement_list_pes[p].assign(SpElement_list_ptr[Batch_num], SpElement(-1, -1, 0.0));
+        for(INDEX_TYPE i = 0; i < Batch_num; ++i) {
+            vector<SpElement> &piece = SpElement_list_pieces[i * NUM_PE + p];
+            std::copy(piece.begin(), piece.end(), SpElement_list_pes[p].begin() + SpElement_list_ptr[i]);
+            vector<SpElement>().swap(piece);
         }
-        
-        SpElement_list_ptr[i + 1] = max_len;
-    } 
+    }
 }
 
 
+// first-order kernel estimate: per 8 columns of B, every batch loads its
+// B window at 8 rows per cycle and streams one list slot per cycle, and the
+// C tile is written back at 16 rows per cycle; wide-N passes only share the
+// A reads, not the cycles. With B_BUFFERS windows the MMU loads batch i
+// while earlier batches multiply, so a fill waits for the multiply
+// B_BUFFERS batches back; serial is the estimate without that overlap
+double Predict_kernel_cycles(const INDEX_TYPE M,
+                             const INDEX_TYPE K,
+                             const INDEX_TYPE N,
+                             const vector<INDEX_TYPE> &SpElement_list_ptr,
+                             const INDEX_TYPE N_slices = 1,
+                             const bool serial = false
+                            ) {
+    INDEX_TYPE Batch_num = SpElement_list_ptr.size() - 1;
+    INDEX_TYPE B_rows = (K + 7) / 8;
+    INDEX_TYPE Slice_rows = Tile_WIDTH / N_slices / 8;
+
+    double fill_end = 0;
+    double mult_end = 0;
+    double mult_end_old = 0;
+    for(INDEX_TYPE i = 0; i < Batch_num; ++i) {
+        INDEX_TYPE fill = max(min(Slice_rows, B_rows - i * Slice_rows), (INDEX_TYPE)0);
+        INDEX_TYPE mult = SpElement_list_ptr[i + 1] - SpElement_list_ptr[i];
+        if(serial || B_BUFFERS == 1) {
+            mult_end += fill + mult;
+            continue;
+        }
+        fill_end = max(fill_end, mult_end_old) + fill;
+        mult_end_old = mult_end;
+        mult_end = max(mult_end, fill_end) + mult;
+    }
+    return (mult_end + (M + 15) / 16) * ((N + 7) / 8);
+}
+
+void Report_SpElement_list(const INDEX_TYPE scheduler,
+                           const INDEX_TYPE M,
+                           const INDEX_TYPE K,
+                           const INDEX_TYPE N,
+                           const INDEX_TYPE nnzR,
+                           const INDEX_TYPE NUM_PE,
+                           const vector<INDEX_TYPE> &SpElement_list_ptr,
+                           const INDEX_TYPE N_slices = 1,
+                           const INDEX_TYPE A_format = A_FORMAT_FP32
+                          ) {
+    INDEX_TYPE Batch_num = SpElement_list_ptr.size() - 1;
+    double slots = (double)SpElement_list_ptr[Batch_num] * NUM_PE;
+    double padding = (slots > 0) ? 100.0 * (slots - nnzR) / slots : 0.0;
+
+    cout << "Scheduler = " << Scheduler_name(scheduler) << "\n";
+    cout << "Sparse_Matrix_len = " << SpElement_list_ptr[Batch_num] << ", ideal = " << (nnzR + NUM_PE - 1) / NUM_PE << "\n";
+    printf("Padding ratio = %.2f%%\n", padding);
+    double cycles = Predict_kernel_cycles(M, K, N, SpElement_list_ptr, N_slices);
+    double serial_cycles = Predict_kernel_cycles(M, K, N, SpElement_list_ptr, N_slices, true);
+    if(B_BUFFERS > 1) {
+        printf("Predicted cycles = %.0f (%.0f without B prefetch, %.2fx)\n",
+               cycles, serial_cycles, cycles > 0 ? serial_cycles / cycles : 1.0);
+    }
+    else {
+        printf("Predicted cycles = %.0f (B prefetch off)\n", cycles);
+    }
+
+    // every pass streams the whole image, 64 bytes per line and channel
+    INDEX_TYPE passes = ((N + 7) / 8 + N_slices - 1) / N_slices;
+    INDEX_TYPE lines = A_format_lines(SpElement_list_ptr[Batch_num], A_format);
+    printf("A format = %s, %d slots per %d lines, %.2f bytes per nonzero\n",
+           A_format_name(A_format), A_format_slots(A_format), A_format_beats(A_format),
+           nnzR > 0 ? 64.0 * lines * (NUM_PE / 8) / nnzR : 0.0);
+    printf("A traffic = %.1f MB (%d passes of %d N-blocks)\n",
+           64.0 * lines * (NUM_PE / 8) * passes / 1048576.0, passes, N_slices);
+}
+
+// PE whose list goes to word w of channel c of the A image: the inverse of
+// the channel remapping, fixed by the number of A channels
+constexpr INDEX_TYPE A_channel_word_PE(const INDEX_TYPE CHANNEL_NUM, const INDEX_TYPE c, const INDEX_TYPE w) {
+    return (CHANNEL_NUM * 8 <= 16) ? c * 8 + w :
+           (CHANNEL_NUM == 8)      ? 16 * (w / 2) + 2 * c + w % 2 :
+                                     16 * (w / 4) + 4 * c + w % 4;
+}
+
+// 14-bit column | 18-bit row | 32-bit value, padding has all row bits set
+inline unsigned long Pack_SpElement(const SpElement &sp) {
+    if(sp.rowIdx == -1) {
+        return 0x3FFFFUL << 32;
+    }
+    unsigned int val_bits;
+    memcpy(&val_bits, &sp.val, sizeof(val_bits));
+    return ((unsigned long)(sp.colIdx & 0x3FFF) << 50) |
+           ((unsigned long)(sp.rowIdx & 0x3FFFF) << 32) |
+           (unsigned long)val_bits;
+}
+
+// pack slots [begin, end) of one channel; pe_list[w] is the list of the PE
+// in word w, so every slot becomes one 64-byte line of the channel
+inline void Pack_A_channel_lines(const SpElement * const pe_list[8],
+                                 unsigned long *out,
+                                 INDEX_TYPE begin,
+                                 const INDEX_TYPE end
+                                ) {
+    static_assert(offsetof(SpElement, colIdx) == 0 && offsetof(SpElement, rowIdx) == 4 && offsetof(SpElement, val) == 8,
+                  "the vector packers load colIdx and rowIdx as one 64-bit word");
+
+#if defined(__AVX512F__)
+    if(((uintptr_t)out & 63) == 0) {
+        const __m512i list_addr = _mm512_set_epi64((long long)pe_list[7], (long long)pe_list[6],
+                                                   (long long)pe_list[5], (long long)pe_list[4],
+                                                   (long long)pe_list[3], (long long)pe_list[2],
+                                                   (long long)pe_list[1], (long long)pe_list[0]);
+        const __m512i col_mask = _mm512_set1_epi64(0x3FFF);
+        const __m512i row_mask = _mm512_set1_epi64(0x3FFFF);
+        const __m512i row_empty = _mm512_set1_epi64(0xFFFFFFFFLL);
+        const __m512i word_empty = _mm512_set1_epi64(0x3FFFFLL << 32);
+        const __m512i val_offset = _mm512_set1_epi64(8);
+
+        for(; begin < end; ++begin) {
+            __m512i addr = _mm512_add_epi64(list_addr, _mm512_set1_epi64((long long)begin * sizeof(SpElement)));
+            __m512i col_row = _mm512_i64gather_epi64(addr, (const void *)0, 1);
+            __m512i val = _mm512_cvtepu32_epi64(_mm512_i64gather_epi32(_mm512_add_epi64(addr, val_offset), (const void *)0, 1));
+
+            __m512i row = _mm512_srli_epi64(col_row, 32);
+            __m512i word = _mm512_or_si512(_mm512_slli_epi64(_mm512_and_si512(col_row, col_mask), 50),
+                                           _mm512_or_si512(_mm512_slli_epi64(_mm512_and_si512(row, row_mask), 32), val));
+            word = _mm512_mask_mov_epi64(word, _mm512_cmpeq_epi64_mask(row, row_empty), word_empty);
+            _mm512_stream_si512((__m512i *)(out + begin * 8), word);
+        }
+        _mm_sfence();
+        return;
+    }
+#elif defined(__AVX2__)
+    if(((uintptr_t)out & 31) == 0) {
+        const __m256i list_addr[2] = {
+            _mm256_set_epi64x((long long)pe_list[3], (long long)pe_list[2], (long long)pe_list[1], (long long)pe_list[0]),
+            _mm256_set_epi64x((long long)pe_list[7], (long long)pe_list[6], (long long)pe_list[5], (long long)pe_list[4])
+        };
+        const __m256i col_mask = _mm256_set1_epi64x(0x3FFF);
+        const __m256i row_mask = _mm256_set1_epi64x(0x3FFFF);
+        const __m256i row_empty = _mm256_set1_epi64x(0xFFFFFFFFLL);
+        const __m256i word_empty = _mm256_set1_epi64x(0x3FFFFLL << 32);
+        const __m256i val_offset = _mm256_set1_epi64x(8);
+
+        for(; begin < end; ++begin) {
+            __m256i slot_offset = _mm256_set1_epi64x((long long)begin * sizeof(SpElement));
+            for(INDEX_TYPE h = 0; h < 2; ++h) {
+                __m256i addr = _mm256_add_epi64(list_addr[h], slot_offset);
+                __m256i col_row = _mm256_i64gather_epi64((const long long *)0, addr, 1);
+                __m256i val = _mm256_cvtepu32_epi64(_mm256_i64gather_epi32((const int *)0, _mm256_add_epi64(addr, val_offset), 1));
+
+                __m256i row = _mm256_srli_epi64(col_row, 32);
+                __m256i word = _mm256_or_si256(_mm256_slli_epi64(_mm256_and_si256(col_row, col_mask), 50),
+                                               _mm256_or_si256(_mm256_slli_epi64(_mm256_and_si256(row, row_mask), 32), val));
+                word = _mm256_blendv_epi8(word, word_empty, _mm256_cmpeq_epi64(row, row_empty));
+                _mm256_stream_si256((__m256i *)(out + begin * 8 + h * 4), word);
+            }
+        }
+        _mm_sfence();
+        return;
+    }
+#endif
+
+    for(; begin < end; ++begin) {
+        for(INDEX_TYPE w = 0; w < 8; ++w) {
+            out[begin * 8 + w] = Pack_SpElement(pe_list[w][begin]);
+        }
+    }
+}
+
+// every channel is split into blocks of slots, each written by one thread
+template <INDEX_TYPE CHANNEL_NUM>
 void Create_SpElement_list_for_all_channels(const vector<vector<SpElement> > &SpElement_list_pes,
                                             const vector<INDEX_TYPE>         &SpElement_list_ptr,
-                                            vector<vector<unsigned long, tapa::aligned_allocator<unsigned long> > > &Matrix_A_fpga_data,
-                                            const INDEX_TYPE HBM_CHANNEL_A_NUM = 8
+                                            vector<vector<unsigned long, tapa::aligned_allocator<unsigned long> > > &Matrix_A_fpga_data
                                            ) {
-    INDEX_TYPE Matrix_fpga_data_column_size = 8 * SpElement_list_ptr[SpElement_list_ptr.size() - 1] * 4 / 4;
-    INDEX_TYPE Matrix_fpga_data_channel_size  = ((Matrix_fpga_data_column_size + 512 - 1) / 512) * 512;
+    const INDEX_TYPE Sparse_Matrix_len = SpElement_list_ptr[SpElement_list_ptr.size() - 1];
+    const INDEX_TYPE Matrix_fpga_data_column_size = 8 * Sparse_Matrix_len;
+    const INDEX_TYPE Matrix_fpga_data_channel_size  = ((Matrix_fpga_data_column_size + 512 - 1) / 512) * 512;
 
-    for(INDEX_TYPE c = 0; c < HBM_CHANNEL_A_NUM; ++c) {
+    const INDEX_TYPE SLOT_BLOCK = 1 << 14;
+    const INDEX_TYPE slot_blocks = (Sparse_Matrix_len + SLOT_BLOCK - 1) / SLOT_BLOCK;
+
+#pragma omp parallel for
+    for(INDEX_TYPE c = 0; c < CHANNEL_NUM; ++c) {
         Matrix_A_fpga_data[c].resize(Matrix_fpga_data_channel_size, 0);
     }
-    
-    for(INDEX_TYPE i = 0; i < SpElement_list_ptr[SpElement_list_ptr.size() - 1]; ++i) {
-        for(INDEX_TYPE c = 0; c < HBM_CHANNEL_A_NUM; ++c) {
-            for(INDEX_TYPE j = 0; j < 8; ++j) {
-                SpElement sp = SpElement_list_pes[j + c * 8][i];
-
-                unsigned long x = 0;
-                if(sp.rowIdx == -1) {
-                    x = 0x3FFFF;
-                    x = x << 32;
-                } 
-                else {
-                    unsigned long x_col = sp.colIdx;
-                    x_col = (x_col & 0x3FFF) << (32 + 18); 
-                    unsigned long x_row = sp.rowIdx;
-                    x_row = (x_row & 0x3FFFF) << 32;
-                    VALUE_TYPE x_float = sp.val;
-                    
-                    unsigned int x_float_in_int = *((unsigned int*)(&x_float));
-                    unsigned long x_float_val_64 = ((unsigned long) x_float_in_int);
-                    x_float_val_64 = x_float_val_64 & 0xFFFFFFFF;
 
-                    x = x_col | x_row | x_float_val_64;
+#pragma omp parallel for schedule(static)
+    for(INDEX_TYPE cb = 0; cb < CHANNEL_NUM * slot_blocks; ++cb) {
+        INDEX_TYPE c = cb / slot_blocks;
+        INDEX_TYPE b = cb % slot_blocks;
+
+        const SpElement *pe_list[8];
+        for(INDEX_TYPE w = 0; w < 8; ++w) {
+            pe_list[w] = SpElement_list_pes[A_channel_word_PE(CHANNEL_NUM, c, w)].data();
+        }
+
+        Pack_A_channel_lines(pe_list,
+                             Matrix_A_fpga_data[c].data(),
+                             b * SLOT_BLOCK,
+                             min((b + 1) * SLOT_BLOCK, Sparse_Matrix_len)
+                            );
+    }
+}
+
+// blocking FIFO with a fixed capacity between two pipeline stages
+template <typename T>
+struct Bounded_Queue {
+    const size_t            capacity;
+    std::deque<T>           items;
+    bool                    closed;
+    std::mutex              lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+
+    explicit Bounded_Queue(const size_t capacity) : capacity(capacity), items(), closed(false) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> guard(lock);
+        not_full.wait(guard, [this] { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+    }
+
+    // false once the queue is closed and drained
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> guard(lock);
+        not_empty.wait(guard, [this] { return !items.empty() || closed; });
+        if(items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        not_empty.notify_all();
+    }
+};
+
+struct SpElement_batch {
+    INDEX_TYPE                  batch;
+    vector<vector<SpElement> >  pieces;
+};
+
+// build SpElement_list_ptr and the A channels batch by batch: the nonzeros
+// are bucketed by (column batch, band) once, then the calling thread tiles
+// and schedules batch i + 1 while a packing thread appends batch i to the
+// channels, with at most PIPELINE_DEPTH scheduled batches waiting. The
+// result is identical to Create_SpElement_list_for_all_PEs followed by
+// Create_SpElement_list_for_all_channels, without materializing the bands,
+// the tiles or the full PE lists
+template <INDEX_TYPE CHANNEL_NUM>
+void Create_Matrix_A_data_FPGA_pipelined(const INDEX_TYPE M,
+                                         const INDEX_TYPE K,
+                                         const INDEX_TYPE nnzR,
+
+                                         const vector<INDEX_TYPE> &RowIdx_COO,
+                                         const vector<INDEX_TYPE> &ColIdx_COO,
+                                         const vector<VALUE_TYPE> &Val_COO,
+
+                                         const INDEX_TYPE Tile_SIZE,
+                                         const INDEX_TYPE BATCH_SIZE,
+                                         const INDEX_TYPE WINDOWS,
+                                         const INDEX_TYPE SCHEDULER,
+
+                                         vector<INDEX_TYPE> &SpElement_list_ptr,
+                                         vector<aligned_vector<unsigned long> > &Matrix_A_fpga_data,
+                                         const INDEX_TYPE PIPELINE_DEPTH = 4
+                                        ) {
+    const INDEX_TYPE NUM_PE = CHANNEL_NUM * 8;
+    const INDEX_TYPE Batch_width = BATCH_SIZE * Tile_SIZE;
+
+    INDEX_TYPE max_col = -1;
+#pragma omp parallel for reduction(max : max_col)
+    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
+        max_col = max(max_col, ColIdx_COO[i]);
+    }
+    const INDEX_TYPE Batch_num = (max_col + Batch_width) / Batch_width;
+    const INDEX_TYPE num_keys = Batch_num * NUM_PE;
+
+    // stable parallel counting sort of the nonzeros on (batch, band)
+    INDEX_TYPE num_parts = max((INDEX_TYPE)1, min((INDEX_TYPE)omp_get_max_threads(), nnzR / 4096));
+    vector<INDEX_TYPE> part_offsets((size_t)num_parts * num_keys, 0);
+    vector<INDEX_TYPE> key_ptr(num_keys + 1, 0);
+    vector<INDEX_TYPE> order(nnzR);
+
+#pragma omp parallel for schedule(static, 1)
+    for(INDEX_TYPE t = 0; t < num_parts; ++t) {
+        INDEX_TYPE *counts = part_offsets.data() + (size_t)t * num_keys;
+        for(INDEX_TYPE i = (long)nnzR * t / num_parts; i < (long)nnzR * (t + 1) / num_parts; ++i) {
+            counts[ColIdx_COO[i] / Batch_width * NUM_PE + RowIdx_COO[i] % NUM_PE]++;
+        }
+    }
+
+    INDEX_TYPE offset = 0;
+    for(INDEX_TYPE key = 0; key < num_keys; ++key) {
+        key_ptr[key] = offset;
+        for(INDEX_TYPE t = 0; t < num_parts; ++t) {
+            INDEX_TYPE count = part_offsets[(size_t)t * num_keys + key];
+            part_offsets[(size_t)t * num_keys + key] = offset;
+            offset += count;
+        }
+    }
+    key_ptr[num_keys] = offset;
+
+#pragma omp parallel for schedule(static, 1)
+    for(INDEX_TYPE t = 0; t < num_parts; ++t) {
+        INDEX_TYPE *offsets = part_offsets.data() + (size_t)t * num_keys;
+        for(INDEX_TYPE i = (long)nnzR * t / num_parts; i < (long)nnzR * (t + 1) / num_parts; ++i) {
+            order[offsets[ColIdx_COO[i] / Batch_width * NUM_PE + RowIdx_COO[i] % NUM_PE]++] = i;
+        }
+    }
+    vector<INDEX_TYPE>().swap(part_offsets);
+
+    SpElement_list_ptr.assign(Batch_num + 1, 0);
+    for(INDEX_TYPE c = 0; c < CHANNEL_NUM; ++c) {
+        Matrix_A_fpga_data[c].resize(0);
+    }
+
+    Bounded_Queue<SpElement_batch> scheduled(PIPELINE_DEPTH);
+
+    // packing stage: pad the pieces of a batch to its longest one and
+    // append the batch to every channel
+    std::thread packer([&] {
+        SpElement_batch item;
+        while(scheduled.pop(item)) {
+            INDEX_TYPE i = item.batch;
+            INDEX_TYPE max_len = 0;
+            for(INDEX_TYPE p = 0; p < NUM_PE; ++p) {
+                max_len = max((INDEX_TYPE)item.pieces[p].size(), max_len);
+            }
+            for(INDEX_TYPE p = 0; p < NUM_PE; ++p) {
+                item.pieces[p].resize(max_len, SpElement(-1, -1, 0.0));
+            }
+            SpElement_list_ptr[i + 1] = SpElement_list_ptr[i] + max_len;
+
+            for(INDEX_TYPE c = 0; c < CHANNEL_NUM; ++c) {
+                const SpElement *pe_list[8];
+                for(INDEX_TYPE w = 0; w < 8; ++w) {
+                    pe_list[w] = item.pieces[A_channel_word_PE(CHANNEL_NUM, c, w)].data();
                 }
-                if(HBM_CHANNEL_A_NUM * 8 <= 16) {
-                    Matrix_A_fpga_data[c][j + i * 8] = x;
-                } 
-                else if(HBM_CHANNEL_A_NUM == 8) {
-
-
-                    INDEX_TYPE seg = 16 / HBM_CHANNEL_A_NUM;
-                    INDEX_TYPE seg_idx = (c * 8 + j) / seg;
-                    INDEX_TYPE c_new = seg_idx % HBM_CHANNEL_A_NUM;
-                    INDEX_TYPE j_new = seg * (seg_idx / HBM_CHANNEL_A_NUM) + j % seg;
-                    Matrix_A_fpga_data[c_new][j_new + i * 8] = x;
-                } 
-                else if(HBM_CHANNEL_A_NUM == 4) {
-                    INDEX_TYPE pe_idx = j + c * 8;
-                    Matrix_A_fpga_data[(pe_idx / 4) % 4][pe_idx % 4 + (pe_idx / 16) * 4 + i * 8] = x;
+                Matrix_A_fpga_data[c].resize(8 * SpElement_list_ptr[i + 1]);
+                Pack_A_channel_lines(pe_list, Matrix_A_fpga_data[c].data() + 8 * SpElement_list_ptr[i], 0, max_len);
+            }
+        }
+    });
+
+    // tiling and scheduling stage, the bands of a batch run in parallel
+    vector<Reorder_Workspace> workspaces(omp_get_max_threads());
+    for(INDEX_TYPE i = 0; i < Batch_num; ++i) {
+        SpElement_batch item;
+        item.batch = i;
+        item.pieces.resize(NUM_PE);
+
+#pragma omp parallel for schedule(dynamic)
+        for(INDEX_TYPE p = 0; p < NUM_PE; ++p) {
+            INDEX_TYPE begin = key_ptr[i * NUM_PE + p];
+            INDEX_TYPE band_nnzR = key_ptr[i * NUM_PE + p + 1] - begin;
+            if(band_nnzR == 0) {
+                continue;
+            }
+
+            // columns are relative to the batch
+            Matrix_COO band;
+            band.RowIdx.resize(band_nnzR);
+            band.RowIdx_copy.resize(band_nnzR);
+            band.ColIdx.resize(band_nnzR);
+            band.Val.resize(band_nnzR);
+            for(INDEX_TYPE k = 0; k < band_nnzR; ++k) {
+                INDEX_TYPE idx = order[begin + k];
+                band.RowIdx[k] = RowIdx_COO[idx] / NUM_PE;
+                band.RowIdx_copy[k] = RowIdx_COO[idx];
+                band.ColIdx[k] = ColIdx_COO[idx] - i * Batch_width;
+                band.Val[k] = Val_COO[idx];
+            }
+
+            SparseTile tile;
+            Build_SparseTile(Tile_SIZE, (M + NUM_PE - 1) / NUM_PE, Batch_width, band_nnzR,
+                             band.RowIdx, band.RowIdx_copy, band.ColIdx, band.Val, tile);
+
+            vector<SpElement> temp_SpElement_list;
+            temp_SpElement_list.reserve(band_nnzR);
+            for(INDEX_TYPE j = 0; j < tile.numTiles; ++j) {
+                Tile_MiniSimilar_Column_reorder(tile, j);
+                for(INDEX_TYPE k = tile.TilePtr[j]; k < tile.TilePtr[j + 1]; ++k) {
+                    temp_SpElement_list.push_back(SpElement(tile.ColIdx[k], tile.RowIdx[k], tile.Val[k]));
                 }
             }
+
+            Schedule_SpElement_list(SCHEDULER,
+                                    temp_SpElement_list,
+                                    item.pieces[p],
+                                    0,
+                                    0,
+                                    M,
+                                    NUM_PE,
+                                    WINDOWS,
+                                    workspaces[omp_get_thread_num()]
+                                   );
         }
+
+        scheduled.push(std::move(item));
+    }
+    scheduled.close();
+    packer.join();
+
+    INDEX_TYPE Matrix_fpga_data_channel_size = ((8 * SpElement_list_ptr[Batch_num] + 512 - 1) / 512) * 512;
+    for(INDEX_TYPE c = 0; c < CHANNEL_NUM; ++c) {
+        Matrix_A_fpga_data[c].resize(Matrix_fpga_data_channel_size, 0);
     }
 }
 
@@ -917,6 +1703,386 @@ void Create_SpElement_list_data_FPGA(const vector<INDEX_TYPE> &SpElement_list_pt
     }
 }
 
+// 16-bit A values, rounded to nearest even; fp16 flushes what would be a
+// subnormal to zero and saturates at the largest finite value, so the MMU
+// only has to widen normal numbers
+inline unsigned short Float_to_half_bits(const VALUE_TYPE x) {
+    unsigned int b;
+    memcpy(&b, &x, sizeof(b));
+    unsigned int sign = (b >> 16) & 0x8000;
+    INDEX_TYPE e = (INDEX_TYPE)((b >> 23) & 0xFF) - 127 + 15;
+    unsigned int m = b & 0x7FFFFF;
+    if(((b >> 23) & 0xFF) == 0xFF) {
+        return sign | 0x7C00 | (m ? 0x200 : 0);
+    }
+    if(e <= 0) {
+        return sign;
+    }
+    unsigned int h = ((unsigned int)e << 10) | (m >> 13);
+    unsigned int rest = m & 0x1FFF;
+    if(rest > 0x1000 || (rest == 0x1000 && (h & 1))) {
+        ++h;
+    }
+    return sign | min(h, 0x7BFFu);
+}
+
+inline VALUE_TYPE Half_bits_to_float(const unsigned short h) {
+    unsigned int e = (h >> 10) & 0x1F;
+    unsigned int b = (unsigned int)(h & 0x8000) << 16;
+    if(e == 0x1F) {
+        b |= 0x7F800000 | ((unsigned int)(h & 0x3FF) << 13);
+    }
+    else if(e != 0) {
+        b |= ((e + 112) << 23) | ((unsigned int)(h & 0x3FF) << 13);
+    }
+    VALUE_TYPE x;
+    memcpy(&x, &b, sizeof(x));
+    return x;
+}
+
+inline unsigned short Float_to_bf16_bits(const VALUE_TYPE x) {
+    unsigned int b;
+    memcpy(&b, &x, sizeof(b));
+    if((b & 0x7FFFFFFF) > 0x7F800000) {
+        return (b >> 16) | 0x40;
+    }
+    return (b + 0x7FFF + ((b >> 16) & 1)) >> 16;
+}
+
+inline VALUE_TYPE Bf16_bits_to_float(const unsigned short h) {
+    unsigned int b = (unsigned int)h << 16;
+    VALUE_TYPE x;
+    memcpy(&x, &b, sizeof(x));
+    return x;
+}
+
+// round the values of A to a 16-bit format, so the CPU references multiply
+// the A the kernel sees; returns the largest relative change
+VALUE_TYPE Quantize_A_values(const INDEX_TYPE A_format, vector<VALUE_TYPE> &Val_COO) {
+    if(A_format != A_FORMAT_FP16 && A_format != A_FORMAT_BF16) {
+        return 0;
+    }
+    VALUE_TYPE max_error = 0;
+#pragma omp parallel for reduction(max : max_error)
+    for(size_t i = 0; i < Val_COO.size(); ++i) {
+        VALUE_TYPE x = Val_COO[i];
+        VALUE_TYPE q = (A_format == A_FORMAT_FP16) ? Half_bits_to_float(Float_to_half_bits(x)) : Bf16_bits_to_float(Float_to_bf16_bits(x));
+        max_error = max(max_error, std::fabs(q - x) / max(std::fabs(x), (VALUE_TYPE)1e-30));
+        Val_COO[i] = q;
+    }
+    return max_error;
+}
+
+bool Is_pattern_values(const vector<VALUE_TYPE> &Val_COO) {
+    bool pattern = true;
+#pragma omp parallel for reduction(&& : pattern)
+    for(size_t i = 0; i < Val_COO.size(); ++i) {
+        pattern = pattern && (Val_COO[i] == 1.0f);
+    }
+    return pattern;
+}
+
+// the distinct values of A by their bits, false when there are more than
+// the A_CODEBOOK_SIZE - 1 codebook entries
+bool Build_A_codebook(const vector<VALUE_TYPE> &Val_COO, vector<unsigned int> &codebook) {
+    codebook.resize(Val_COO.size());
+    memcpy(codebook.data(), Val_COO.data(), Val_COO.size() * sizeof(unsigned int));
+    std::sort(codebook.begin(), codebook.end());
+    codebook.erase(std::unique(codebook.begin(), codebook.end()), codebook.end());
+    return codebook.size() < (size_t)A_CODEBOOK_SIZE;
+}
+
+inline INDEX_TYPE A_format_word_bits(const INDEX_TYPE A_format) {
+    return (A_format == A_FORMAT_FP32) ? 64 : (A_format < A_FORMAT_FP16) ? 32 : 42;
+}
+
+// a 64-bit A word of Pack_SpElement in a compressed format
+inline unsigned long Pack_A_word(const INDEX_TYPE A_format,
+                                 const unsigned long a,
+                                 const vector<unsigned int> &codebook
+                                ) {
+    unsigned long row = (a >> 32) & 0x3FFFF;
+    unsigned long col = (a >> 50) & 0x3FFF;
+    unsigned int val_bits = a & 0xFFFFFFFF;
+    VALUE_TYPE val;
+    memcpy(&val, &val_bits, sizeof(val));
+    bool padding = (row & 0x20000) != 0;
+
+    switch(A_format) {
+        case A_FORMAT_PATTERN:
+            return a >> 32;
+        case A_FORMAT_CODEBOOK:
+            if(padding) {
+                return (unsigned long)(A_CODEBOOK_SIZE - 1) << 24;
+            }
+            return ((unsigned long)(std::lower_bound(codebook.begin(), codebook.end(), val_bits) - codebook.begin()) << 24) |
+                   (col << 12) | row;
+        case A_FORMAT_FP16:
+        case A_FORMAT_BF16:
+            if(padding) {
+                return 1UL << 13;
+            }
+            return ((unsigned long)(A_format == A_FORMAT_FP16 ? Float_to_half_bits(val) : Float_to_bf16_bits(val)) << 26) |
+                   (col << 14) | row;
+        default:
+            return a;
+    }
+}
+
+// the 64-bit word of a compressed one, as Decode_A_word of the kernel
+inline unsigned long Unpack_A_word(const INDEX_TYPE A_format,
+                                   const unsigned long w,
+                                   const INDEX_TYPE *codebook
+                                  ) {
+    unsigned long row;
+    unsigned long col;
+    unsigned int val_bits;
+    if(A_format == A_FORMAT_PATTERN) {
+        return (w << 32) | 0x3F800000;
+    }
+    else if(A_format == A_FORMAT_CODEBOOK) {
+        unsigned long idx = w >> 24;
+        col = (w >> 12) & 0xFFF;
+        row = (idx == A_CODEBOOK_SIZE - 1) ? 0x3FFFF : (w & 0xFFF);
+        val_bits = codebook[idx];
+    }
+    else if(A_format == A_FORMAT_FP16 || A_format == A_FORMAT_BF16) {
+        unsigned short h = (w >> 26) & 0xFFFF;
+        VALUE_TYPE val = (A_format == A_FORMAT_FP16) ? Half_bits_to_float(h) : Bf16_bits_to_float(h);
+        memcpy(&val_bits, &val, sizeof(val_bits));
+        col = (w >> 14) & 0xFFF;
+        row = (w & 0x2000) ? 0x3FFFF : (w & 0x1FFF);
+    }
+    else {
+        return w;
+    }
+    return (col << 50) | (row << 32) | val_bits;
+}
+
+// a delta header, a padding slot that loads tile register t of its lane
+// with a row and the 32-column window of col
+inline unsigned long Delta_A_header(const INDEX_TYPE t, const unsigned long row, const unsigned long col) {
+    return (1UL << 41) | ((unsigned long)t << 37) | ((col >> 5) << 18) | row;
+}
+
+// the delta words of slots [begin, end) of word w of the fp32 channel in.
+// The tile registers are replaced least recently used first; a padding
+// slot becomes a header for a padding row, which the next element may take
+// over for its own tile, so only a tile switch right after an element
+// costs an extra slot. No register is read before it is loaded in the
+// batch, so the lanes need no reset between batches.
+inline void Delta_encode_A_lane(const unsigned long *in,
+                                const INDEX_TYPE begin,
+                                const INDEX_TYPE end,
+                                const INDEX_TYPE w,
+                                vector<unsigned long> &lane
+                               ) {
+    unsigned long tile[A_DELTA_TILES];
+    INDEX_TYPE used[A_DELTA_TILES];
+    for(INDEX_TYPE t = 0; t < A_DELTA_TILES; ++t) {
+        tile[t] = ~0UL;
+        used[t] = -1;
+    }
+    auto victim = [&]() {
+        return (INDEX_TYPE)(std::min_element(used, used + A_DELTA_TILES) - used);
+    };
+
+    lane.resize(0);
+    for(INDEX_TYPE slot = begin; slot < end; ++slot) {
+        unsigned long a = in[(size_t)slot * 8 + w];
+        unsigned long row = (a >> 32) & 0x3FFFF;
+        unsigned long col = (a >> 50) & 0x3FFF;
+        if(row & 0x20000) {
+            INDEX_TYPE t = victim();
+            tile[t] = ~0UL;
+            used[t] = slot;
+            lane.push_back(Delta_A_header(t, 0x3FFFF, 0));
+            continue;
+        }
+        unsigned long key = ((col >> 5) << 18) | row;
+        INDEX_TYPE t = std::find(tile, tile + A_DELTA_TILES, key) - tile;
+        if(t == A_DELTA_TILES) {
+            if(!lane.empty() && (lane.back() >> 41)) {
+                t = (lane.back() >> 37) & (A_DELTA_TILES - 1);
+                lane.back() = Delta_A_header(t, row, col);
+            }
+            else {
+                t = victim();
+                lane.push_back(Delta_A_header(t, row, col));
+            }
+            tile[t] = key;
+        }
+        used[t] = slot;
+        lane.push_back(((unsigned long)t << 37) | ((col & 0x1F) << 32) | (a & 0xFFFFFFFF));
+    }
+}
+
+// the 64-bit word of a delta word against the tile registers of its lane
+inline unsigned long Unpack_delta_A_word(const unsigned long w, unsigned long tile[A_DELTA_TILES]) {
+    INDEX_TYPE t = (w >> 37) & (A_DELTA_TILES - 1);
+    if(w >> 41) {
+        tile[t] = w & 0x7FFFFFF;
+        return 0x3FFFFUL << 32;
+    }
+    unsigned long col = ((tile[t] >> 18) << 5) | ((w >> 32) & 0x1F);
+    unsigned long row = tile[t] & 0x3FFFF;
+    return (col << 50) | (row << 32) | (w & 0xFFFFFFFF);
+}
+
+// word bits [pos, pos + bits) of a 256-bit line half, stored as 4 longs
+inline void Put_A_bits(unsigned long *half, const INDEX_TYPE pos, const INDEX_TYPE bits, const unsigned long word) {
+    half[pos / 64] |= word << (pos % 64);
+    if(pos % 64 + bits > 64) {
+        half[pos / 64 + 1] |= word >> (64 - pos % 64);
+    }
+}
+
+inline unsigned long Get_A_bits(const unsigned long *half, const INDEX_TYPE pos, const INDEX_TYPE bits) {
+    unsigned long word = half[pos / 64] >> (pos % 64);
+    if(pos % 64 + bits > 64) {
+        word |= half[pos / 64 + 1] << (64 - pos % 64);
+    }
+    return word & ((1UL << bits) - 1);
+}
+
+// line and bit position of word w of a slot in the group layout of leda.h;
+// the MMU of word w takes half w / 4 of the channel lines
+inline void A_word_position(const INDEX_TYPE A_format,
+                            const INDEX_TYPE slot,
+                            const INDEX_TYPE w,
+                            size_t &line,
+                            INDEX_TYPE &pos
+                           ) {
+    const INDEX_TYPE bits = A_format_word_bits(A_format);
+    const INDEX_TYPE words_per_beat = 256 / bits;
+    const INDEX_TYPE k = slot % A_format_slots(A_format) * 4 + w % 4;
+    line = (size_t)slot / A_format_slots(A_format) * A_format_beats(A_format) + k / words_per_beat;
+    pos = (w / 4) * 256 + k % words_per_beat * bits;
+}
+
+// A lines before and after Compress_A_image, summed over the channels,
+// and the delta headers that took a slot of their own
+struct A_Compression {
+    long long fp32_lines;
+    long long lines;
+    long long delta_headers;
+};
+
+// repack an A_FORMAT_FP32 image in a compressed format: every batch is
+// padded to whole groups of slots, SpElement_list_ptr becomes the padded
+// pointers and SpElement_list_ptr_fpga holds them, then the codebook. A
+// delta batch is as long as the longest delta list of its lanes.
+A_Compression Compress_A_image(const INDEX_TYPE A_format,
+                               const vector<unsigned int> &codebook,
+                               vector<INDEX_TYPE> &SpElement_list_ptr,
+                               aligned_vector<INDEX_TYPE> &SpElement_list_ptr_fpga,
+                               vector<aligned_vector<unsigned long> > &Matrix_A_fpga_data
+                              ) {
+    const INDEX_TYPE Batch_num = SpElement_list_ptr.size() - 1;
+    A_Compression stats;
+    stats.fp32_lines = (long long)SpElement_list_ptr[Batch_num] * Matrix_A_fpga_data.size();
+    stats.lines = stats.fp32_lines;
+    stats.delta_headers = 0;
+    if(A_format == A_FORMAT_FP32) {
+        return stats;
+    }
+    const INDEX_TYPE slots = A_format_slots(A_format);
+    const INDEX_TYPE bits = A_format_word_bits(A_format);
+    const bool delta = (A_format == A_FORMAT_DELTA);
+
+    vector<INDEX_TYPE> batch_len(Batch_num);
+#pragma omp parallel for schedule(dynamic)
+    for(INDEX_TYPE i = 0; i < Batch_num; ++i) {
+        batch_len[i] = SpElement_list_ptr[i + 1] - SpElement_list_ptr[i];
+        vector<unsigned long> lane;
+        for(size_t c = 0; delta && c < Matrix_A_fpga_data.size(); ++c) {
+            for(INDEX_TYPE w = 0; w < 8; ++w) {
+                Delta_encode_A_lane(Matrix_A_fpga_data[c].data(), SpElement_list_ptr[i], SpElement_list_ptr[i + 1], w, lane);
+                batch_len[i] = max(batch_len[i], (INDEX_TYPE)lane.size());
+            }
+        }
+    }
+
+    vector<INDEX_TYPE> padded_ptr(Batch_num + 1, 0);
+    for(INDEX_TYPE i = 0; i < Batch_num; ++i) {
+        padded_ptr[i + 1] = padded_ptr[i] + (batch_len[i] + slots - 1) / slots * slots;
+    }
+    const INDEX_TYPE lines = A_format_lines(padded_ptr[Batch_num], A_format);
+    const size_t channel_size = ((8 * (size_t)lines + 512 - 1) / 512) * 512;
+    const unsigned long padding = delta ? Delta_A_header(0, 0x3FFFF, 0) : Pack_A_word(A_format, 0x3FFFFUL << 32, codebook);
+
+    long long delta_headers = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+ : delta_headers)
+    for(size_t c = 0; c < Matrix_A_fpga_data.size(); ++c) {
+        aligned_vector<unsigned long> out(channel_size, 0);
+        const unsigned long *in = Matrix_A_fpga_data[c].data();
+        vector<unsigned long> lane;
+        for(INDEX_TYPE i = 0; i < Batch_num; ++i) {
+            for(INDEX_TYPE w = 0; w < 8; ++w) {
+                if(delta) {
+                    Delta_encode_A_lane(in, SpElement_list_ptr[i], SpElement_list_ptr[i + 1], w, lane);
+                    delta_headers += lane.size() - (SpElement_list_ptr[i + 1] - SpElement_list_ptr[i]);
+                }
+                for(INDEX_TYPE slot = padded_ptr[i]; slot < padded_ptr[i + 1]; ++slot) {
+                    INDEX_TYPE k = slot - padded_ptr[i];
+                    INDEX_TYPE src = SpElement_list_ptr[i] + k;
+                    unsigned long word = delta                           ? ((k < (INDEX_TYPE)lane.size()) ? lane[k] : padding) :
+                                         (src < SpElement_list_ptr[i + 1]) ? Pack_A_word(A_format, in[(size_t)src * 8 + w], codebook) :
+                                                                             padding;
+                    size_t line;
+                    INDEX_TYPE pos;
+                    A_word_position(A_format, slot, w, line, pos);
+                    Put_A_bits(out.data() + line * 8, pos, bits, word);
+                }
+            }
+        }
+        Matrix_A_fpga_data[c].swap(out);
+    }
+    stats.lines = (long long)lines * Matrix_A_fpga_data.size();
+    stats.delta_headers = delta_headers;
+
+    SpElement_list_ptr.swap(padded_ptr);
+    Create_SpElement_list_data_FPGA(SpElement_list_ptr, SpElement_list_ptr_fpga);
+    if(A_format == A_FORMAT_CODEBOOK) {
+        size_t size = ((Batch_num + 1 + A_CODEBOOK_SIZE + 1023) / 1024) * 1024;
+        SpElement_list_ptr_fpga.resize(max(size, SpElement_list_ptr_fpga.size()), 0);
+        for(size_t e = 0; e < codebook.size(); ++e) {
+            SpElement_list_ptr_fpga[Batch_num + 1 + e] = codebook[e];
+        }
+    }
+    return stats;
+}
+
+// the A_FORMAT_FP32 image of a compressed one, on the padded pointers;
+// delta headers become padding slots
+void Expand_A_image(const INDEX_TYPE A_format,
+                    const INDEX_TYPE Batch_num,
+                    const aligned_vector<INDEX_TYPE> &SpElement_list_ptr_fpga,
+                    const vector<aligned_vector<unsigned long> > &Matrix_A_fpga_data,
+                    vector<aligned_vector<unsigned long> > &Matrix_A_fp32_data
+                   ) {
+    const INDEX_TYPE Sparse_Matrix_len = SpElement_list_ptr_fpga[Batch_num];
+    const INDEX_TYPE bits = A_format_word_bits(A_format);
+    const INDEX_TYPE *codebook = SpElement_list_ptr_fpga.data() + Batch_num + 1;
+
+    Matrix_A_fp32_data.resize(Matrix_A_fpga_data.size());
+#pragma omp parallel for schedule(dynamic)
+    for(size_t c = 0; c < Matrix_A_fpga_data.size(); ++c) {
+        Matrix_A_fp32_data[c].assign(((8 * (size_t)Sparse_Matrix_len + 512 - 1) / 512) * 512, 0);
+        unsigned long tile[8][A_DELTA_TILES] = {};
+        for(INDEX_TYPE slot = 0; slot < Sparse_Matrix_len; ++slot) {
+            for(INDEX_TYPE w = 0; w < 8; ++w) {
+                size_t line;
+                INDEX_TYPE pos;
+                A_word_position(A_format, slot, w, line, pos);
+                unsigned long word = Get_A_bits(Matrix_A_fpga_data[c].data() + line * 8, pos, bits);
+                Matrix_A_fp32_data[c][(size_t)slot * 8 + w] = (A_format == A_FORMAT_DELTA) ? Unpack_delta_A_word(word, tile[w]) :
+                                                                                            Unpack_A_word(A_format, word, codebook);
+            }
+        }
+    }
+}
+
 void Create_Matrix_B_data_FPGA(const INDEX_TYPE K,
                                const INDEX_TYPE N,
                                const INDEX_TYPE HBM_CHANNEL_B_NUM,
@@ -960,6 +2126,268 @@ void Create_Matrix_C_data_FPGA(const INDEX_TYPE M,
                               
 }
 
+// the kernel multiplies and adds with separate operators, so the products
+// must be rounded before they are accumulated
+#if defined(__GNUC__) && !defined(__clang__)
+#define LEDA_NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define LEDA_NO_FP_CONTRACT
+#endif
+
+// run the packed A image on the CPU the way the Leda kernel does: MAU c
+// accumulates the 8 words of A channel c, one lane per word, for every pass
+// over 8 columns of B, and its rows are written out through the Merger
+// layout. B is read from the FPGA layout as well, so the result matches
+// Matrix_C_fpga_data of a kernel run bit by bit. Returns false when the
+// image does not fit the kernel: a band row beyond URAM_DEPTH / N_slices,
+// or a column outside the B window the MMU fills for its batch
+LEDA_NO_FP_CONTRACT
+bool SpMM_FPGA_image_CPU(const INDEX_TYPE M,
+                         const INDEX_TYPE K,
+                         const INDEX_TYPE N,
+                         const INDEX_TYPE Batch_num,
+                         const aligned_vector<INDEX_TYPE> &SpElement_list_ptr_fpga,
+                         const vector<aligned_vector<unsigned long> > &Matrix_A_fpga_data,
+                         const vector<aligned_vector<VALUE_TYPE> > &Matrix_B_fpga_data,
+                         vector<aligned_vector<VALUE_TYPE> > &Matrix_C_fpga_data,
+                         const INDEX_TYPE N_slices = 1,
+                         const INDEX_TYPE A_format = A_FORMAT_FP32
+                        ) {
+    if(A_format != A_FORMAT_FP32) {
+        vector<aligned_vector<unsigned long> > Matrix_A_fp32_data;
+        Expand_A_image(A_format, Batch_num, SpElement_list_ptr_fpga, Matrix_A_fpga_data, Matrix_A_fp32_data);
+        return SpMM_FPGA_image_CPU(M, K, N, Batch_num, SpElement_list_ptr_fpga, Matrix_A_fp32_data,
+                                   Matrix_B_fpga_data, Matrix_C_fpga_data, N_slices);
+    }
+
+    const INDEX_TYPE num_pass = (N + 7) / 8;
+    const INDEX_TYPE num_v_out = (M + 15) / 16;
+    const INDEX_TYPE B_lines = (K + 7) / 8;
+    const INDEX_TYPE C_rows = (num_v_out + 3) / 4;
+    const INDEX_TYPE Slice_width = Tile_WIDTH / N_slices;
+    const INDEX_TYPE Slice_lines = Slice_width / 8;
+
+    if(C_rows > URAM_DEPTH / N_slices) {
+        return false;
+    }
+
+    bool fits = true;
+
+#pragma omp parallel for schedule(dynamic) reduction(&& : fits)
+    for(INDEX_TYPE cp = 0; cp < HBM_CHANNEL_A_NUM * num_pass; ++cp) {
+        INDEX_TYPE c = cp / num_pass;
+        INDEX_TYPE nb = cp % num_pass;
+
+        // Matrix_C_onchip of MAU c: [lane][row][column of the pass]
+        vector<VALUE_TYPE> C_onchip((size_t)8 * C_rows * 8, 0);
+        // the slice of Matrix_B_onchip that holds N-block nb: [column][B row]
+        vector<VALUE_TYPE> B_onchip((size_t)8 * Slice_width, 0);
+        const unsigned long *A = Matrix_A_fpga_data[c].data();
+
+        for(INDEX_TYPE i = 0; i < Batch_num; ++i) {
+            // fill: the B lines of batch i, fewer in the last batch of B
+            const INDEX_TYPE B_line_base = nb * B_lines + i * Slice_lines;
+            const INDEX_TYPE fill_len = max(min(B_lines - i * Slice_lines, Slice_lines), (INDEX_TYPE)0);
+            for(INDEX_TYPE jj = 0; jj < fill_len; ++jj) {
+                for(INDEX_TYPE d = 0; d < 8; ++d) {
+                    for(INDEX_TYPE k = 0; k < 8; ++k) {
+                        B_onchip[(size_t)d * Slice_width + jj * 8 + k] =
+                            Matrix_B_fpga_data[d / 2][(size_t)(B_line_base + jj) * 16 + (d % 2) * 8 + k];
+                    }
+                }
+            }
+
+            for(INDEX_TYPE slot = SpElement_list_ptr_fpga[i]; slot < SpElement_list_ptr_fpga[i + 1]; ++slot) {
+                for(INDEX_TYPE w = 0; w < 8; ++w) {
+                    unsigned long a = A[(size_t)slot * 8 + w];
+                    INDEX_TYPE a_row = (a >> 32) & 0x3FFFF;
+                    if(a_row & 0x20000) {
+                        continue;
+                    }
+                    if(a_row >= C_rows) {
+                        fits = false;
+                        continue;
+                    }
+                    INDEX_TYPE a_col = (a >> 50) & 0x3FFF;
+                    if((a_col >> 3) >= fill_len) {
+                        fits = false;
+                        continue;
+                    }
+                    unsigned int a_val_bits = a & 0xFFFFFFFF;
+                    VALUE_TYPE a_val;
+                    memcpy(&a_val, &a_val_bits, sizeof(a_val));
+
+                    VALUE_TYPE *C_row = C_onchip.data() + ((size_t)w * C_rows + a_row) * 8;
+                    for(INDEX_TYPE d = 0; d < 8; ++d) {
+                        VALUE_TYPE b = B_onchip[(size_t)d * Slice_width + a_col];
+                        VALUE_TYPE prod = a_val * b;
+                        C_row[d] = C_row[d] + prod;
+                    }
+                }
+            }
+        }
+
+        // Write_C_onchip and Merger: output vector idx of C channel d holds
+        // lanes 2 (idx % 4) and 2 (idx % 4) + 1 of row idx / 4 of every MAU
+        for(INDEX_TYPE idx = 0; idx < num_v_out; ++idx) {
+            for(INDEX_TYPE k = 0; k < 2; ++k) {
+                INDEX_TYPE w = 2 * (idx % 4) + k;
+                const VALUE_TYPE *C_row = C_onchip.data() + ((size_t)w * C_rows + idx / 4) * 8;
+                for(INDEX_TYPE d = 0; d < 8; ++d) {
+                    Matrix_C_fpga_data[d][((size_t)nb * num_v_out + idx) * 16 + 2 * c + k] = C_row[d];
+                }
+            }
+        }
+    }
+
+    return fits;
+}
+
+// decode the LEDA_PERF_COUNTERS records of one iteration into per unit
+// cycle breakdowns, per PE utilization and the HBM bandwidth of the kernel
+void Report_perf_counters(const INDEX_TYPE N,
+                          const INDEX_TYPE Batch_num,
+                          const double kernel_time,
+                          const aligned_vector<INDEX_TYPE> &Perf_counters,
+                          const INDEX_TYPE N_slices = 1
+                         ) {
+    const INDEX_TYPE num_pass = Pass_num(N, N_slices);
+    const INDEX_TYPE MMU_NUM = PERF_MAU_BASE - PERF_MMU_BASE;
+    const INDEX_TYPE Record_num = Perf_record_num(Batch_num, N, N_slices);
+
+    vector<double> unit(PERF_SOURCE_NUM * PERF_WORDS, 0);
+    vector<double> pass_cycles(num_pass * PERF_SOURCE_NUM, 0);
+    INDEX_TYPE bad_records = 0;
+
+    for(INDEX_TYPE r = 0; r < Record_num; ++r) {
+        const INDEX_TYPE *record = Perf_counters.data() + (size_t)r * PERF_WORDS;
+        INDEX_TYPE src = record[PERF_SOURCE];
+        // writers count N-blocks, the MMUs and MAUs passes over A
+        INDEX_TYPE nb = (src >= PERF_WRITER_BASE && record[PERF_N_BLOCK] >= 0) ? record[PERF_N_BLOCK] / N_slices : record[PERF_N_BLOCK];
+        if(src < 0 || src >= PERF_SOURCE_NUM || nb < 0 || nb >= num_pass) {
+            bad_records++;
+            continue;
+        }
+        double cycles = 0;
+        for(INDEX_TYPE f = PERF_BATCH + 1; f < PERF_WORDS; ++f) {
+            unit[src * PERF_WORDS + f] += record[f];
+        }
+        if(src < PERF_MAU_BASE) {
+            cycles = record[PERF_MMU_CYCLES];
+        }
+        else if(src < PERF_WRITER_BASE) {
+            cycles = (double)record[PERF_ACC_ACTIVE] + record[PERF_ACC_WAIT];
+        }
+        else {
+            cycles = (double)record[PERF_WRITE_ACTIVE] + record[PERF_WRITE_WAIT_C] +
+                     record[PERF_WRITE_WAIT_MEM] + record[PERF_WRITE_WAIT_RESP];
+        }
+        unit[src * PERF_WORDS + PERF_SOURCE] += cycles;
+        pass_cycles[nb * PERF_SOURCE_NUM + src] += cycles;
+    }
+    if(bad_records > 0) {
+        cout << "Warning: " << bad_records << " of " << Record_num << " counter records are invalid\n";
+    }
+
+    auto pct = [](const double part, const double total) {
+        return total > 0 ? 100.0 * part / total : 0.0;
+    };
+
+    // fill and multiply run side by side, so their shares can add up to more
+    // than 100%; hidden is the part of the fill cycles under a multiply
+    printf("%-8s %12s %7s %7s %7s %7s %7s %7s %7s %7s\n",
+           "MMU", "cycles", "fill", "B wait", "fwd", "mult", "A wait", "C full", "slots", "hidden");
+    for(INDEX_TYPE u = 0; u < MMU_NUM; ++u) {
+        const double *c = unit.data() + (PERF_MMU_BASE + u) * PERF_WORDS;
+        double useful = 0;
+        for(INDEX_TYPE p = 0; p < 4; ++p) {
+            useful += c[PERF_MULT_USEFUL + p];
+        }
+        double fill = c[PERF_FILL_ACTIVE] + c[PERF_FILL_WAIT_B] + c[PERF_FILL_WAIT_OUT];
+        double mult = c[PERF_MULT_ACTIVE] + c[PERF_MULT_WAIT_A] + c[PERF_MULT_WAIT_OUT];
+        printf("%-8d %12.0f %6.1f%% %6.1f%% %6.1f%% %6.1f%% %6.1f%% %6.1f%% %6.1f%% %6.1f%%\n",
+               u,
+               c[PERF_SOURCE],
+               pct(c[PERF_FILL_ACTIVE], c[PERF_SOURCE]),
+               pct(c[PERF_FILL_WAIT_B], c[PERF_SOURCE]),
+               pct(c[PERF_FILL_WAIT_OUT], c[PERF_SOURCE]),
+               pct(c[PERF_MULT_ACTIVE], c[PERF_SOURCE]),
+               pct(c[PERF_MULT_WAIT_A], c[PERF_SOURCE]),
+               pct(c[PERF_MULT_WAIT_OUT], c[PERF_SOURCE]),
+               pct(useful, 4 * c[PERF_MULT_ACTIVE]),
+               pct(max(0.0, fill + mult - c[PERF_SOURCE]), fill));
+    }
+
+    printf("%-8s %12s %7s %7s %7s\n", "MAU", "cycles", "active", "wait", "slots");
+    for(INDEX_TYPE m = 0; m < HBM_CHANNEL_C_NUM; ++m) {
+        const double *c = unit.data() + (PERF_MAU_BASE + m) * PERF_WORDS;
+        printf("%-8d %12.0f %6.1f%% %6.1f%% %6.1f%%\n",
+               m,
+               c[PERF_SOURCE],
+               pct(c[PERF_ACC_ACTIVE], c[PERF_SOURCE]),
+               pct(c[PERF_ACC_WAIT], c[PERF_SOURCE]),
+               pct(c[PERF_ACC_USEFUL], 8 * c[PERF_ACC_ACTIVE]));
+    }
+
+    printf("%-8s %12s %7s %7s %7s %7s\n", "Writer", "cycles", "active", "C wait", "mem", "resp");
+    for(INDEX_TYPE w = 0; w < HBM_CHANNEL_C_NUM; ++w) {
+        const double *c = unit.data() + (PERF_WRITER_BASE + w) * PERF_WORDS;
+        printf("%-8d %12.0f %6.1f%% %6.1f%% %6.1f%% %6.1f%%\n",
+               w,
+               c[PERF_SOURCE],
+               pct(c[PERF_WRITE_ACTIVE], c[PERF_SOURCE]),
+               pct(c[PERF_WRITE_WAIT_C], c[PERF_SOURCE]),
+               pct(c[PERF_WRITE_WAIT_MEM], c[PERF_SOURCE]),
+               pct(c[PERF_WRITE_WAIT_RESP], c[PERF_SOURCE]));
+    }
+
+    // MMU u reads half u % 2 of A channel u / 2, lane p is word 4 (u % 2) + p
+    cout << "PE utilization (non-padding elements / MMU cycles):\n";
+    for(INDEX_TYPE row = 0; row < HBM_CHANNEL_A_NUM * 8; row += 8) {
+        printf("PE %3d-%3d:", row, row + 7);
+        for(INDEX_TYPE pe = row; pe < row + 8; ++pe) {
+            double useful = 0;
+            double cycles = 0;
+            for(INDEX_TYPE u = 0; u < MMU_NUM; ++u) {
+                for(INDEX_TYPE p = 0; p < 4; ++p) {
+                    if(A_channel_word_PE(HBM_CHANNEL_A_NUM, u / 2, 4 * (u % 2) + p) == pe) {
+                        useful = unit[(PERF_MMU_BASE + u) * PERF_WORDS + PERF_MULT_USEFUL + p];
+                        cycles = unit[(PERF_MMU_BASE + u) * PERF_WORDS + PERF_SOURCE];
+                    }
+                }
+            }
+            printf(" %5.1f%%", pct(useful, cycles));
+        }
+        printf("\n");
+    }
+
+    for(INDEX_TYPE nb = 0; nb < num_pass; ++nb) {
+        const double *c = pass_cycles.data() + nb * PERF_SOURCE_NUM;
+        printf("Pass %d: slowest MMU %.0f, MAU %.0f, writer %.0f cycles\n",
+               nb,
+               *std::max_element(c + PERF_MMU_BASE, c + PERF_MAU_BASE),
+               *std::max_element(c + PERF_MAU_BASE, c + PERF_WRITER_BASE),
+               *std::max_element(c + PERF_WRITER_BASE, c + PERF_SOURCE_NUM));
+    }
+
+    // bytes moved: every MMU reads 256 bits of A per A word, MMU 0 takes
+    // 4 x 512 bits of B per fill cycle, writers 512 bits per active cycle
+    double A_bytes = 0;
+    double C_bytes = 0;
+    for(INDEX_TYPE u = 0; u < MMU_NUM; ++u) {
+        A_bytes += 32.0 * unit[(PERF_MMU_BASE + u) * PERF_WORDS + PERF_MULT_A_READS];
+    }
+    double B_bytes = 64.0 * HBM_CHANNEL_B_NUM * unit[PERF_MMU_BASE * PERF_WORDS + PERF_FILL_ACTIVE];
+    for(INDEX_TYPE w = 0; w < HBM_CHANNEL_C_NUM; ++w) {
+        C_bytes += 64.0 * unit[(PERF_WRITER_BASE + w) * PERF_WORDS + PERF_WRITE_ACTIVE];
+    }
+    printf("A read: %.1f MB in %d passes\n", A_bytes / 1048576.0, num_pass);
+    if(kernel_time > 0) {
+        printf("Bandwidth: A %.2f GB/s, B %.2f GB/s, C %.2f GB/s\n",
+               A_bytes / 1e9 / kernel_time, B_bytes / 1e9 / kernel_time, C_bytes / 1e9 / kernel_time);
+    }
+}
+
 void Verify_correctness(INDEX_TYPE &error_num,
                         const VALUE_TYPE &CPU_val,
                         const VALUE_TYPE &FPGA_val,
@@ -0,0 +1,192 @@
+#ifndef LEDA_GENERATOR_H
+#define LEDA_GENERATOR_H
+
+#include <vector>
+#include <string>
+#include <random>
+#include <cstdio>
+#include <cstdint>
+#include <omp.h>
+
+#include "leda_common.h"
+
+// synthetic sparse matrices in COO for benchmarks; every generator is
+// deterministic for a given seed whatever the number of threads, since
+// the nonzeros are drawn in fixed-size blocks with their own generator
+
+const INDEX_TYPE GENERATOR_BLOCK = 1 << 16;
+
+inline uint64_t Generator_seed(const uint64_t seed, const INDEX_TYPE block) {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL * (block + 1);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// R-MAT / Kronecker power-law graph with 2^scale vertices and
+// degree * 2^scale edges, quadrant probabilities a, b, c, 1 - a - b - c
+void Generate_RMAT_COO(const INDEX_TYPE scale,
+                       const INDEX_TYPE degree,
+                       const uint64_t seed,
+                       INDEX_TYPE &M,
+                       INDEX_TYPE &K,
+                       INDEX_TYPE &nnzR,
+                       vector<INDEX_TYPE> &RowIdx_COO,
+                       vector<INDEX_TYPE> &ColIdx_COO,
+                       vector<VALUE_TYPE> &Val_COO,
+                       const double a = 0.57,
+                       const double b = 0.19,
+                       const double c = 0.19
+                      ) {
+    M = K = 1 << scale;
+    nnzR = degree * M;
+    RowIdx_COO.resize(nnzR);
+    ColIdx_COO.resize(nnzR);
+    Val_COO.resize(nnzR);
+
+#pragma omp parallel for schedule(dynamic)
+    for(INDEX_TYPE block = 0; block < (nnzR + GENERATOR_BLOCK - 1) / GENERATOR_BLOCK; ++block) {
+        std::mt19937_64 rng(Generator_seed(seed, block));
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for(INDEX_TYPE i = block * GENERATOR_BLOCK; i < min((block + 1) * GENERATOR_BLOCK, nnzR); ++i) {
+            INDEX_TYPE row = 0;
+            INDEX_TYPE col = 0;
+            for(INDEX_TYPE bit = 0; bit < scale; ++bit) {
+                double r = uniform(rng);
+                row = (row << 1) | (r >= a + b);
+                col = (col << 1) | ((r >= a && r < a + b) || r >= a + b + c);
+            }
+            RowIdx_COO[i] = row;
+            ColIdx_COO[i] = col;
+            Val_COO[i] = (VALUE_TYPE)uniform(rng);
+        }
+    }
+}
+
+// n x n band matrix, row i holds the columns i - width / 2 .. i + width / 2
+void Generate_Banded_COO(const INDEX_TYPE n,
+                         const INDEX_TYPE width,
+                         const uint64_t seed,
+                         INDEX_TYPE &M,
+                         INDEX_TYPE &K,
+                         INDEX_TYPE &nnzR,
+                         vector<INDEX_TYPE> &RowIdx_COO,
+                         vector<INDEX_TYPE> &ColIdx_COO,
+                         vector<VALUE_TYPE> &Val_COO
+                        ) {
+    M = K = n;
+    const INDEX_TYPE half = width / 2;
+
+    vector<INDEX_TYPE> row_ptr(n + 1, 0);
+    for(INDEX_TYPE i = 0; i < n; ++i) {
+        row_ptr[i + 1] = row_ptr[i] + min(n - 1, i + half) - max((INDEX_TYPE)0, i - half) + 1;
+    }
+    nnzR = row_ptr[n];
+    RowIdx_COO.resize(nnzR);
+    ColIdx_COO.resize(nnzR);
+    Val_COO.resize(nnzR);
+
+#pragma omp parallel for schedule(dynamic)
+    for(INDEX_TYPE block = 0; block < (n + GENERATOR_BLOCK - 1) / GENERATOR_BLOCK; ++block) {
+        std::mt19937_64 rng(Generator_seed(seed, block));
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for(INDEX_TYPE i = block * GENERATOR_BLOCK; i < min((block + 1) * GENERATOR_BLOCK, n); ++i) {
+            INDEX_TYPE pos = row_ptr[i];
+            for(INDEX_TYPE j = max((INDEX_TYPE)0, i - half); j <= min(n - 1, i + half); ++j) {
+                RowIdx_COO[pos] = i;
+                ColIdx_COO[pos] = j;
+                Val_COO[pos] = (VALUE_TYPE)uniform(rng);
+                pos++;
+            }
+        }
+    }
+}
+
+// n x n matrix with degree * n nonzeros at uniformly random positions
+void Generate_Uniform_COO(const INDEX_TYPE n,
+                          const INDEX_TYPE degree,
+                          const uint64_t seed,
+                          INDEX_TYPE &M,
+                          INDEX_TYPE &K,
+                          INDEX_TYPE &nnzR,
+                          vector<INDEX_TYPE> &RowIdx_COO,
+                          vector<INDEX_TYPE> &ColIdx_COO,
+                          vector<VALUE_TYPE> &Val_COO
+                         ) {
+    M = K = n;
+    nnzR = degree * n;
+    RowIdx_COO.resize(nnzR);
+    ColIdx_COO.resize(nnzR);
+    Val_COO.resize(nnzR);
+
+#pragma omp parallel for schedule(dynamic)
+    for(INDEX_TYPE block = 0; block < (nnzR + GENERATOR_BLOCK - 1) / GENERATOR_BLOCK; ++block) {
+        std::mt19937_64 rng(Generator_seed(seed, block));
+        std::uniform_int_distribution<INDEX_TYPE> index(0, n - 1);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for(INDEX_TYPE i = block * GENERATOR_BLOCK; i < min((block + 1) * GENERATOR_BLOCK, nnzR); ++i) {
+            RowIdx_COO[i] = index(rng);
+            ColIdx_COO[i] = index(rng);
+            Val_COO[i] = (VALUE_TYPE)uniform(rng);
+        }
+    }
+}
+
+// n x n block-diagonal matrix of block_size x block_size blocks, every row
+// holds degree nonzeros at random columns of its own block
+void Generate_Block_Diagonal_COO(const INDEX_TYPE n,
+                                 const INDEX_TYPE block_size,
+                                 const INDEX_TYPE degree,
+                                 const uint64_t seed,
+                                 INDEX_TYPE &M,
+                                 INDEX_TYPE &K,
+                                 INDEX_TYPE &nnzR,
+                                 vector<INDEX_TYPE> &RowIdx_COO,
+                                 vector<INDEX_TYPE> &ColIdx_COO,
+                                 vector<VALUE_TYPE> &Val_COO
+                                ) {
+    M = K = n;
+    nnzR = degree * n;
+    RowIdx_COO.resize(nnzR);
+    ColIdx_COO.resize(nnzR);
+    Val_COO.resize(nnzR);
+
+#pragma omp parallel for schedule(dynamic)
+    for(INDEX_TYPE block = 0; block < (n + GENERATOR_BLOCK - 1) / GENERATOR_BLOCK; ++block) {
+        std::mt19937_64 rng(Generator_seed(seed, block));
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for(INDEX_TYPE i = block * GENERATOR_BLOCK; i < min((block + 1) * GENERATOR_BLOCK, n); ++i) {
+            INDEX_TYPE base = i / block_size * block_size;
+            INDEX_TYPE width = min(block_size, n - base);
+            for(INDEX_TYPE d = 0; d < degree; ++d) {
+                INDEX_TYPE pos = i * degree + d;
+                RowIdx_COO[pos] = i;
+                ColIdx_COO[pos] = base + (INDEX_TYPE)(uniform(rng) * width);
+                Val_COO[pos] = (VALUE_TYPE)uniform(rng);
+            }
+        }
+    }
+}
+
+// write a COO matrix as a general real Matrix Market file
+bool Write_matrix_COO(const std::string &filename,
+                      const INDEX_TYPE M,
+                      const INDEX_TYPE K,
+                      const INDEX_TYPE nnzR,
+                      const vector<INDEX_TYPE> &RowIdx_COO,
+                      const vector<INDEX_TYPE> &ColIdx_COO,
+                      const vector<VALUE_TYPE> &Val_COO
+                     ) {
+    FILE *f = fopen(filename.c_str(), "w");
+    if(f == NULL) {
+        return false;
+    }
+    fprintf(f, "%%%%MatrixMarket matrix coordinate real general\n");
+    fprintf(f, "%d %d %d\n", M, K, nnzR);
+    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
+        fprintf(f, "%d %d %.9g\n", RowIdx_COO[i] + 1, ColIdx_COO[i] + 1, Val_COO[i]);
+    }
+    return fclose(f) == 0;
+}
+
+#endif
@@ -0,0 +1,272 @@
+#ifndef LEDA_GRAPH_BATCH_H
+#define LEDA_GRAPH_BATCH_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+
+#include "leda.h"
+#include "leda_common.h"
+#include "leda_session.h"
+
+// Many small graphs in one kernel run, for graph classification and other
+// workloads of thousands of molecules or subgraphs. Graph g with its
+// features B_g is placed on the diagonal of one large A,
+//   A = diag(A_0, A_1, ...), B = [B_0; B_1; ...], C = [C_0; C_1; ...],
+// so one preprocessing pass and one tapa::invoke cover the whole group, and
+// the fixed costs of a run (Init_C_onchip, the B fill of every batch, the
+// C writeback) are shared. Consecutive graphs are grouped as long as their
+// rows fit the accumulators of one run.
+
+struct Graph_COO {
+    INDEX_TYPE M;
+    INDEX_TYPE K;
+    INDEX_TYPE nnzR;
+
+    vector<INDEX_TYPE> RowIdx;
+    vector<INDEX_TYPE> ColIdx;
+    vector<VALUE_TYPE> Val;
+};
+
+// graphs [begin, end) on the diagonal; graph g starts at row row_offset[g]
+// and column col_offset[g], relative to begin
+struct Block_Diagonal {
+    INDEX_TYPE M;
+    INDEX_TYPE K;
+    INDEX_TYPE nnzR;
+
+    vector<INDEX_TYPE> row_offset;
+    vector<INDEX_TYPE> col_offset;
+    vector<INDEX_TYPE> nnz_offset;
+
+    vector<INDEX_TYPE> RowIdx;
+    vector<INDEX_TYPE> ColIdx;
+    vector<VALUE_TYPE> Val;
+};
+
+// one .mtx path per line, empty lines skipped; false when a file fails
+bool Read_graph_list(const char *list_path, vector<Graph_COO> &graphs) {
+    std::ifstream list(list_path);
+    if(!list) {
+        return false;
+    }
+    std::string path;
+    while(std::getline(list, path)) {
+        if(path.empty()) {
+            continue;
+        }
+        Graph_COO graph;
+        INDEX_TYPE isSymmetric;
+        if(Read_matrix_2_COO(&path[0], &graph.M, &graph.K, &graph.nnzR, &isSymmetric,
+                             graph.RowIdx, graph.ColIdx, graph.Val) != 0) {
+            printf("Cannot read graph %s\n", path.c_str());
+            return false;
+        }
+        graphs.push_back(std::move(graph));
+    }
+    return true;
+}
+
+// group_ptr[i] .. group_ptr[i + 1] are the graphs of kernel run i: at most
+// max_graphs (0 for no limit) and max_rows rows, a larger graph alone
+vector<INDEX_TYPE> Graph_batch_groups(const vector<Graph_COO> &graphs,
+                                      const INDEX_TYPE max_graphs,
+                                      const INDEX_TYPE max_rows
+                                     ) {
+    vector<INDEX_TYPE> group_ptr(1, 0);
+    INDEX_TYPE rows = 0;
+    for(INDEX_TYPE g = 0; g < (INDEX_TYPE)graphs.size(); ++g) {
+        INDEX_TYPE count = g - group_ptr.back();
+        if(count > 0 && ((max_graphs > 0 && count >= max_graphs) || rows + graphs[g].M > max_rows)) {
+            group_ptr.push_back(g);
+            rows = 0;
+        }
+        rows += graphs[g].M;
+    }
+    if(!graphs.empty()) {
+        group_ptr.push_back(graphs.size());
+    }
+    return group_ptr;
+}
+
+void Pack_block_diagonal(const vector<Graph_COO> &graphs,
+                         const INDEX_TYPE begin,
+                         const INDEX_TYPE end,
+                         Block_Diagonal &block
+                        ) {
+    const INDEX_TYPE num = end - begin;
+    block.row_offset.assign(num + 1, 0);
+    block.col_offset.assign(num + 1, 0);
+    block.nnz_offset.assign(num + 1, 0);
+    for(INDEX_TYPE g = 0; g < num; ++g) {
+        block.row_offset[g + 1] = block.row_offset[g] + graphs[begin + g].M;
+        block.col_offset[g + 1] = block.col_offset[g] + graphs[begin + g].K;
+        block.nnz_offset[g + 1] = block.nnz_offset[g] + graphs[begin + g].nnzR;
+    }
+    block.M = block.row_offset[num];
+    block.K = block.col_offset[num];
+    block.nnzR = block.nnz_offset[num];
+
+    block.RowIdx.resize(block.nnzR);
+    block.ColIdx.resize(block.nnzR);
+    block.Val.resize(block.nnzR);
+#pragma omp parallel for schedule(dynamic)
+    for(INDEX_TYPE g = 0; g < num; ++g) {
+        const Graph_COO &graph = graphs[begin + g];
+        const INDEX_TYPE base = block.nnz_offset[g];
+        for(INDEX_TYPE i = 0; i < graph.nnzR; ++i) {
+            block.RowIdx[base + i] = graph.RowIdx[i] + block.row_offset[g];
+            block.ColIdx[base + i] = graph.ColIdx[i] + block.col_offset[g];
+            block.Val[base + i] = graph.Val[i];
+        }
+    }
+}
+
+// B[g] is column-major K_g x N; the block B stacks them, column-major K x N
+void Pack_block_diagonal_B(const Block_Diagonal &block,
+                           const vector<const vector<VALUE_TYPE> *> &B,
+                           const INDEX_TYPE N,
+                           vector<VALUE_TYPE> &Matrix_B_block
+                          ) {
+    const INDEX_TYPE num = B.size();
+    Matrix_B_block.resize((size_t)block.K * N);
+#pragma omp parallel for
+    for(INDEX_TYPE nn = 0; nn < N; ++nn) {
+        VALUE_TYPE *out = Matrix_B_block.data() + (size_t)block.K * nn;
+        for(INDEX_TYPE g = 0; g < num; ++g) {
+            const INDEX_TYPE K_g = block.col_offset[g + 1] - block.col_offset[g];
+            const VALUE_TYPE *in = B[g]->data() + (size_t)K_g * nn;
+            std::copy(in, in + K_g, out + block.col_offset[g]);
+        }
+    }
+}
+
+// C[g] gets the rows of graph g, column-major M_g x N
+void Split_block_diagonal_C(const Block_Diagonal &block,
+                            const vector<VALUE_TYPE> &Matrix_C_block,
+                            const INDEX_TYPE N,
+                            const vector<vector<VALUE_TYPE> *> &C
+                           ) {
+    const INDEX_TYPE num = C.size();
+#pragma omp parallel for schedule(dynamic)
+    for(INDEX_TYPE g = 0; g < num; ++g) {
+        const INDEX_TYPE M_g = block.row_offset[g + 1] - block.row_offset[g];
+        C[g]->resize((size_t)M_g * N);
+        for(INDEX_TYPE nn = 0; nn < N; ++nn) {
+            const VALUE_TYPE *in = Matrix_C_block.data() + (size_t)block.M * nn + block.row_offset[g];
+            std::copy(in, in + M_g, C[g]->data() + (size_t)M_g * nn);
+        }
+    }
+}
+
+struct Graph_Batch_Stats {
+    INDEX_TYPE graphs;
+    INDEX_TYPE runs;
+    long long  nnzR;
+    double     pack_time;
+    double     preprocess_time;
+    double     run_time;
+    double     split_time;
+};
+
+// C[g] = A_g * B[g] for every graph, max_graphs per kernel run (0 for as
+// many as fit); returns false when a graph does not fit a run or a run fails
+bool Run_graph_batch(const std::string &bitstream,
+                     const bool cpu_executor,
+                     const vector<Graph_COO> &graphs,
+                     const vector<const vector<VALUE_TYPE> *> &B,
+                     const INDEX_TYPE N,
+                     const vector<vector<VALUE_TYPE> *> &C,
+                     const INDEX_TYPE max_graphs,
+                     const INDEX_TYPE SCHEDULER,
+                     Graph_Batch_Stats &stats
+                    ) {
+    const INDEX_TYPE max_rows = PE_NUM * HBM_CHANNEL_A_NUM * URAM_DEPTH;
+    stats.graphs = graphs.size();
+    stats.runs = 0;
+    stats.nnzR = 0;
+    stats.pack_time = 0;
+    stats.preprocess_time = 0;
+    stats.run_time = 0;
+    stats.split_time = 0;
+
+    vector<INDEX_TYPE> group_ptr = Graph_batch_groups(graphs, max_graphs, max_rows);
+    Block_Diagonal block;
+    vector<VALUE_TYPE> Matrix_B_block;
+    vector<VALUE_TYPE> Matrix_C_block;
+    for(size_t r = 0; r + 1 < group_ptr.size(); ++r) {
+        const INDEX_TYPE begin = group_ptr[r];
+        const INDEX_TYPE end = group_ptr[r + 1];
+
+        auto start = std::chrono::steady_clock::now();
+        Pack_block_diagonal(graphs, begin, end, block);
+        if(block.M > max_rows) {
+            printf("Graph %d has %d rows, one kernel run holds %d\n", begin, block.M, max_rows);
+            return false;
+        }
+        Pack_block_diagonal_B(block, vector<const vector<VALUE_TYPE> *>(B.begin() + begin, B.begin() + end), N, Matrix_B_block);
+        auto pack_end = std::chrono::steady_clock::now();
+
+        vector<INDEX_TYPE> SpElement_list_ptr;
+        aligned_vector<INDEX_TYPE> SpElement_list_ptr_fpga;
+        vector<aligned_vector<unsigned long> > Matrix_A_fpga_data(HBM_CHANNEL_A_NUM);
+        Create_Matrix_A_data_FPGA_pipelined<HBM_CHANNEL_A_NUM>(block.M,
+                                                               block.K,
+                                                               block.nnzR,
+                                                               block.RowIdx,
+                                                               block.ColIdx,
+                                                               block.Val,
+                                                               Tile_SIZE,
+                                                               BATCH_SIZE,
+                                                               WINDOWS,
+                                                               SCHEDULER,
+                                                               SpElement_list_ptr,
+                                                               Matrix_A_fpga_data
+                                                              );
+        Create_SpElement_list_data_FPGA(SpElement_list_ptr, SpElement_list_ptr_fpga);
+        auto preprocess_end = std::chrono::steady_clock::now();
+
+        Leda_Session session(bitstream,
+                             cpu_executor,
+                             block.M,
+                             block.K,
+                             1,
+                             A_FORMAT_FP32,
+                             std::move(SpElement_list_ptr),
+                             std::move(SpElement_list_ptr_fpga),
+                             std::move(Matrix_A_fpga_data)
+                            );
+        if(!session.Run(Matrix_B_block, N, Matrix_C_block)) {
+            return false;
+        }
+        auto run_end = std::chrono::steady_clock::now();
+
+        Split_block_diagonal_C(block, Matrix_C_block, N, vector<vector<VALUE_TYPE> *>(C.begin() + begin, C.begin() + end));
+        auto split_end = std::chrono::steady_clock::now();
+
+        stats.runs++;
+        stats.nnzR += block.nnzR;
+        stats.pack_time       += std::chrono::duration<double>(pack_end - start).count();
+        stats.preprocess_time += std::chrono::duration<double>(preprocess_end - pack_end).count();
+        stats.run_time        += std::chrono::duration<double>(run_end - preprocess_end).count();
+        stats.split_time      += std::chrono::duration<double>(split_end - run_end).count();
+    }
+    return true;
+}
+
+void Report_graph_batch(const Graph_Batch_Stats &stats, const INDEX_TYPE N) {
+    double total = stats.pack_time + stats.preprocess_time + stats.run_time + stats.split_time;
+    printf("Graph batch: %d graphs, %lld nonzeros, %d kernel runs, %.1f graphs per run\n",
+           stats.graphs, stats.nnzR, stats.runs, stats.runs > 0 ? (double)stats.graphs / stats.runs : 0.0);
+    printf("  pack %f ms, preprocess %f ms, run %f ms, split %f ms\n",
+           stats.pack_time * 1000, stats.preprocess_time * 1000, stats.run_time * 1000, stats.split_time * 1000);
+    printf("Throughput: %.1f graphs/s end to end, %.1f graphs/s in the runs, %f GFLOPS\n",
+           total > 0 ? stats.graphs / total : 0.0,
+           stats.run_time > 0 ? stats.graphs / stats.run_time : 0.0,
+           total > 0 ? 2.0 * N * stats.nnzR / 1e9 / total : 0.0);
+}
+
+#endif
@@ -2,6 +2,8 @@
 #include <algorithm>
 #include <vector>
 #include <cstdlib>
+#include <cstring>
+#include <omp.h>
 #include <chrono>
 #include <iostream>
 
@@ -11,6 +13,15 @@
 #include "mmio.h"
 #include "leda.h"
 #include "leda_common.h"
+#include "leda_cache.h"
+#include "leda_profile.h"
+#include "leda_session.h"
+#include "leda_row_window.h"
+#include "leda_row_balance.h"
+#include "leda_autotune.h"
+#include "leda_model.h"
+#include "leda_reorder.h"
+#include "leda_graph_batch.h"
 
 using namespace std;
 
@@ -19,12 +30,127 @@ int main(int argc, char **argv) {
     cout << "Run SpMM... " << endl;
     
     INDEX_TYPE ITERATION_NUM = 1;
+    INDEX_TYPE SCHEDULER = SCHEDULER_WINDOW;
+    bool PIPELINE = true;
+    INDEX_TYPE THREADS = omp_get_max_threads();
+    bool CPU_EXECUTOR = false;
+    bool PROFILE_TABLE = false;
+    std::string profile_json;
+    INDEX_TYPE SESSION_CALLS = 0;
+    INDEX_TYPE SESSION_GROUP = 1;
+    INDEX_TYPE ROW_WINDOW = 0;
+    INDEX_TYPE N_SLICES = 1;
+    INDEX_TYPE A_FORMAT = A_FORMAT_FP32;
+    bool A_FORMAT_AUTO = false;
+    INDEX_TYPE REORDER = REORDER_NONE;
+    bool ROW_BALANCE = false;
+    bool AUTOTUNE = false;
+    bool AUTOTUNE_SWEEP = false;
+    bool MODEL = false;
+    INDEX_TYPE GRAPH_BATCH = -1;
+    Model_Params model_params = Default_model_params();
+
+    // options come first as --name=value, then the positional arguments
+    INDEX_TYPE argi = 1;
+    for(; argi < argc && strncmp(argv[argi], "--", 2) == 0; ++argi) {
+        std::string option = argv[argi];
+        bool valid = false;
+        if(option.compare(0, 12, "--scheduler=") == 0) {
+            SCHEDULER = Parse_scheduler(option.substr(12));
+            valid = (SCHEDULER >= 0);
+        }
+        else if(option.compare(0, 10, "--threads=") == 0) {
+            THREADS = atoi(option.c_str() + 10);
+            valid = (THREADS > 0);
+        }
+        else if(option == "--device=fpga" || option == "--device=cpu") {
+            CPU_EXECUTOR = (option == "--device=cpu");
+            valid = true;
+        }
+        else if(option == "--pipeline=on" || option == "--pipeline=off") {
+            PIPELINE = (option == "--pipeline=on");
+            valid = true;
+        }
+        else if(option == "--profile=table") {
+            PROFILE_TABLE = true;
+            valid = true;
+        }
+        else if(option.compare(0, 15, "--profile-json=") == 0) {
+            profile_json = option.substr(15);
+            valid = !profile_json.empty();
+        }
+        else if(option.compare(0, 10, "--session=") == 0) {
+            SESSION_CALLS = atoi(option.c_str() + 10);
+            valid = (SESSION_CALLS > 0);
+        }
+        else if(option.compare(0, 16, "--session-group=") == 0) {
+            SESSION_GROUP = atoi(option.c_str() + 16);
+            valid = (SESSION_GROUP > 0);
+        }
+        else if(option.compare(0, 13, "--row-window=") == 0) {
+            ROW_WINDOW = atoi(option.c_str() + 13);
+            valid = (ROW_WINDOW > 0);
+        }
+        else if(option.compare(0, 11, "--n-slices=") == 0) {
+            N_SLICES = atoi(option.c_str() + 11);
+            valid = (N_SLICES > 0 && N_SLICES <= N_SLICES_MAX && (N_SLICES & (N_SLICES - 1)) == 0);
+        }
+        else if(option == "--a-format=auto") {
+            A_FORMAT_AUTO = true;
+            valid = true;
+        }
+        else if(option.compare(0, 11, "--a-format=") == 0) {
+            A_FORMAT = Parse_A_format(option.substr(11));
+            valid = (A_FORMAT >= 0);
+        }
+        else if(option.compare(0, 10, "--reorder=") == 0) {
+            REORDER = Parse_reorder(option.substr(10));
+            valid = (REORDER >= 0);
+        }
+        else if(option == "--row-balance=mod" || option == "--row-balance=lpt") {
+            ROW_BALANCE = (option == "--row-balance=lpt");
+            valid = true;
+        }
+        else if(option == "--autotune=off" || option == "--autotune=on" || option == "--autotune=sweep") {
+            AUTOTUNE = (option != "--autotune=off");
+            AUTOTUNE_SWEEP = (option == "--autotune=sweep");
+            valid = true;
+        }
+        else if(option.compare(0, 14, "--graph-batch=") == 0) {
+            char *end = NULL;
+            GRAPH_BATCH = strtol(option.c_str() + 14, &end, 10);
+            valid = (end != option.c_str() + 14 && *end == '\0' && GRAPH_BATCH >= 0);
+        }
+        else if(option == "--model=on" || option == "--model=off") {
+            MODEL = (option == "--model=on");
+            valid = true;
+        }
+        else if(option.compare(0, 14, "--model-clock=") == 0) {
+            model_params.clock_MHz = atof(option.c_str() + 14);
+            valid = (model_params.clock_MHz > 0);
+        }
+        if(!valid) {
+            cout << "Unknown option " << option << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    argc -= argi - 1;
+    argv += argi - 1;
+
+    // the graphs of a batch run as one FP32 image with one slice, and their
+    // rows stay in the order of the block diagonal
+    if(GRAPH_BATCH >= 0 && (A_FORMAT != A_FORMAT_FP32 || A_FORMAT_AUTO || N_SLICES != 1 || REORDER != REORDER_NONE ||
+                            ROW_BALANCE || AUTOTUNE || SESSION_CALLS > 0 || ROW_WINDOW > 0 || MODEL)) {
+        cout << "--graph-batch cannot be combined with --a-format, --n-slices, --reorder, --row-balance=lpt, "
+             << "--autotune, --session, --row-window or --model\n";
+        return EXIT_FAILURE;
+    }
 
     if(argc == 4) {
         ITERATION_NUM = atoi(argv[3]);
     }
     else if(argc != 3) {
-        cout << "Message: " << argv[0] << " [Sparse Matrix Path] [N] [ITERATION_NUM] " << std::endl;
+        cout << "Message: " << argv[0] << " [--scheduler=window|list] [--pipeline=on|off] [--threads=T] [--device=fpga|cpu] [--profile=table] [--profile-json=FILE] [--session=R] [--session-group=G] [--row-window=R] [--n-slices=S] [--a-format=fp32|pattern|codebook|fp16|bf16|delta|auto] [--reorder=none|rcm|degree|community] [--row-balance=mod|lpt] [--autotune=off|on|sweep] [--model=on|off] [--model-clock=MHz] [--graph-batch=G] [Sparse Matrix Path | Graph List] [N] [ITERATION_NUM] " << std::endl;
         return EXIT_FAILURE;
     }
 
@@ -37,6 +163,69 @@ int main(int argc, char **argv) {
         bitstream = bitstream_ptr;
     }
 
+    std::string cache_dir;
+    if(const auto cache_dir_ptr = getenv("LEDA_CACHE")) {
+        cache_dir = cache_dir_ptr;
+    }
+
+    // --graph-batch=G reads a list of graphs, one .mtx per line, and runs
+    // them G per kernel run (0 for as many as fit) on the block diagonal
+    if(GRAPH_BATCH >= 0) {
+        vector<Graph_COO> graphs;
+        cout << "\nReading graphs... ";
+        if(!Read_graph_list(filename, graphs)) {
+            cout << "failed\n";
+            return EXIT_FAILURE;
+        }
+        cout << graphs.size() << " graphs\n";
+
+        // features differ per row, column and graph, so a misplaced block shows
+        vector<vector<VALUE_TYPE> > B_graphs(graphs.size());
+        vector<vector<VALUE_TYPE> > C_graphs(graphs.size());
+        vector<const vector<VALUE_TYPE> *> B_ptrs(graphs.size());
+        vector<vector<VALUE_TYPE> *> C_ptrs(graphs.size());
+        for(size_t g = 0; g < graphs.size(); ++g) {
+            B_graphs[g].resize((size_t)graphs[g].K * N);
+            for(INDEX_TYPE nn = 0; nn < N; ++nn) {
+                for(INDEX_TYPE kk = 0; kk < graphs[g].K; ++kk) {
+                    B_graphs[g][(size_t)nn * graphs[g].K + kk] = (VALUE_TYPE)((kk + nn + g) % 8 + 1) / 8;
+                }
+            }
+            B_ptrs[g] = &B_graphs[g];
+            C_ptrs[g] = &C_graphs[g];
+        }
+
+        cout << "Run SpMM on " << (CPU_EXECUTOR ? "CPU executor" : "FPGA") << " in block-diagonal batches... ";
+        Graph_Batch_Stats stats;
+        bool ok = Run_graph_batch(bitstream, CPU_EXECUTOR, graphs, B_ptrs, N, C_ptrs, GRAPH_BATCH, SCHEDULER, stats);
+        if(!ok) {
+            cout << "failed\n";
+            return EXIT_FAILURE;
+        }
+        cout << "done\n";
+        Report_graph_batch(stats, N);
+
+        INDEX_TYPE error_num = 0;
+        long long C_size = 0;
+        for(size_t g = 0; g < graphs.size(); ++g) {
+            const Graph_COO &graph = graphs[g];
+            vector<INDEX_TYPE> ColPtr_CSC;
+            vector<INDEX_TYPE> RowIdx_CSC;
+            vector<VALUE_TYPE> Val_CSC;
+            COO_2_CSC(graph.M, graph.K, graph.nnzR, graph.RowIdx, graph.ColIdx, graph.Val, ColPtr_CSC, RowIdx_CSC, Val_CSC);
+            vector<VALUE_TYPE> C_CPU((size_t)graph.M * N, 0.0);
+            SpMM_CPU_CSC(graph.M, N, graph.K, graph.nnzR, ColPtr_CSC, RowIdx_CSC, Val_CSC, B_graphs[g], C_CPU);
+            for(size_t i = 0; i < C_CPU.size(); ++i) {
+                Verify_correctness(error_num, C_CPU[i], C_graphs[g][i], 1e-4);
+            }
+            C_size += C_CPU.size();
+        }
+        float diffpercent = C_size > 0 ? 100.0 * error_num / C_size : 0.0;
+        cout << (diffpercent < 2.0 ? "||PASSED||\n" : "[[FAILED]]\n");
+        printf("error_num = [%d], percent = [%.2f%%]\n", error_num, diffpercent);
+        return EXIT_SUCCESS;
+    }
+
     cout << "\nConfiguration : \n";
     cout << "Iter_num = " << ITERATION_NUM <<  "\n";
 
@@ -44,87 +233,441 @@ int main(int argc, char **argv) {
 
     cout << "TileSize = " << Tile_SIZE << endl;
 
+    // --n-slices=S reads A once per S N-blocks, with batches S times narrower;
+    // --autotune may change all three for the matrix
+    INDEX_TYPE Tile_size = Tile_SIZE;
+    INDEX_TYPE Batch_size = BATCH_SIZE / N_SLICES;
+    INDEX_TYPE Windows = WINDOWS;
+    cout << "N_slices = " << N_SLICES << ", BatchSize = " << Batch_size << endl;
+
+    cout << "Scheduler = " << Scheduler_name(SCHEDULER) << endl;
+
+    cout << "Pipeline = " << (PIPELINE ? "on" : "off") << endl;
+
     cout << "HBM_CHANNEL_A_NUM = " << HBM_CHANNEL_A_NUM << endl;
     cout << "HBM_CHANNEL_B_NUM = " << HBM_CHANNEL_B_NUM << endl;
     cout << "HBM_CHANNEL_C_NUM = " << HBM_CHANNEL_C_NUM << endl;
 
     INDEX_TYPE M, K, nnzR, isSymmetric;
 
-    Read_matrix_size(filename,
-                     &M,
-                     &K,
-                     &nnzR,
-                     &isSymmetric
-                    );
+    vector<INDEX_TYPE> RowIdx_COO;
+    vector<INDEX_TYPE> ColIdx_COO;
+    vector<VALUE_TYPE> Val_COO;
+
+    Stage_Profile profile;
+
+    cout << "\nReading Sparse Matrix A... ";
+
+    Scoped_Stage stage_read(profile, "read");
+
+    INDEX_TYPE read_ret = Read_matrix_2_COO(filename,
+                                            &M,
+                                            &K,
+                                            &nnzR,
+                                            &isSymmetric,
+                                            RowIdx_COO,
+                                            ColIdx_COO,
+                                            Val_COO
+                                           );
+    if(read_ret != 0) {
+        cout << "failed (error " << read_ret << ")\n";
+        return EXIT_FAILURE;
+    }
+    stage_read.add_bytes(Bytes_of(RowIdx_COO) + Bytes_of(ColIdx_COO) + Bytes_of(Val_COO));
+    stage_read.finish();
+
+    cout << "done\n";
 
     cout << "\nMatrix Size: \n";
     cout << "Sparse matrix A: #Rows = " << M << ", #Cols = " << K << ", #nnzR = " << nnzR <<  "\n";
     cout << "Dense  matrix B: #Rows = "  << K << ", #Cols = " << N << "\n";
-    cout << "Dense  matrix C: #Rows = "  << M << ", #Cols = " << N << "\n";
+    cout << "Dense  matrix C: #Rows = "  << M << ", #Cols = " << N << "\n\n";
+
+    // --a-format picks the A word: pattern and codebook are lossless and need
+    // A to allow them, the 16-bit formats round the values of A up front so
+    // the CPU references multiply the same A as the kernel; auto takes the
+    // smallest lossless word that does not add row windows. delta is only
+    // taken when asked for, its size depends on the tile switches of the
+    // scheduled lists
+    auto A_format_windows = [&](const INDEX_TYPE A_format) {
+        INDEX_TYPE rows = Row_window_rows(ROW_WINDOW, N_SLICES, A_format);
+        return (M + rows - 1) / rows;
+    };
+    vector<unsigned int> A_codebook;
+    if(A_FORMAT_AUTO) {
+        A_FORMAT = Is_pattern_values(Val_COO) ? A_FORMAT_PATTERN :
+                   (Build_A_codebook(Val_COO, A_codebook) &&
+                    A_format_windows(A_FORMAT_CODEBOOK) == A_format_windows(A_FORMAT_FP32)) ? A_FORMAT_CODEBOOK :
+                   A_FORMAT_FP32;
+    }
+    else if(A_FORMAT == A_FORMAT_PATTERN && !Is_pattern_values(Val_COO)) {
+        cout << "A has values other than 1.0, it cannot use the pattern format\n";
+        return EXIT_FAILURE;
+    }
+    else if(A_FORMAT == A_FORMAT_CODEBOOK && !Build_A_codebook(Val_COO, A_codebook)) {
+        cout << "A has " << A_codebook.size() << " distinct values, the codebook format holds " << A_CODEBOOK_SIZE - 1 << "\n";
+        return EXIT_FAILURE;
+    }
+    VALUE_TYPE A_format_error = Quantize_A_values(A_FORMAT, Val_COO);
+    cout << "A format = " << A_format_name(A_FORMAT);
+    if(A_FORMAT == A_FORMAT_FP16 || A_FORMAT == A_FORMAT_BF16) {
+        printf(", max relative rounding error = %e", A_format_error);
+    }
+    else if(A_FORMAT == A_FORMAT_CODEBOOK) {
+        cout << ", " << A_codebook.size() << " distinct values";
+    }
+    cout << "\n\n";
+
+    // --reorder renumbers the vertices of a square A, rows and columns alike;
+    // the image is built on A' = P A P^T with the rows of B permuted, the CPU
+    // references keep A and B, and C is put back after the run
+    vector<INDEX_TYPE> vertex_perm;
+    if(REORDER != REORDER_NONE && M != K) {
+        cout << "Reorder needs a square A, skipped\n\n";
+        REORDER = REORDER_NONE;
+    }
+    else if(REORDER != REORDER_NONE) {
+        Scoped_Stage stage(profile, "reorder");
+        Reorder_vertices(REORDER, M, nnzR, RowIdx_COO, ColIdx_COO, vertex_perm);
+        Report_tile_density("input", M, K, nnzR, RowIdx_COO, ColIdx_COO, PE_NUM * HBM_CHANNEL_A_NUM, Tile_size);
+        Permute_rows_COO(vertex_perm, RowIdx_COO);
+        Permute_rows_COO(vertex_perm, ColIdx_COO);
+        Report_tile_density(Reorder_name(REORDER), M, K, nnzR, RowIdx_COO, ColIdx_COO, PE_NUM * HBM_CHANNEL_A_NUM, Tile_size);
+        stage.add_bytes(Bytes_of(vertex_perm));
+        cout << "\n";
+    }
+
+    // --row-balance=lpt renumbers the rows so the PEs get even nonzeros; the
+    // image is built on the renumbered rows, the CPU references keep the
+    // rows of A and C is put back in their order after the run
+    vector<INDEX_TYPE> row_perm;
+    if(ROW_BALANCE) {
+        Scoped_Stage stage(profile, "row_balance");
+        Balance_rows_LPT(M, nnzR, RowIdx_COO, PE_NUM * HBM_CHANNEL_A_NUM, row_perm);
+        Report_row_balance("mod", K, nnzR, RowIdx_COO, ColIdx_COO, vector<INDEX_TYPE>(), PE_NUM * HBM_CHANNEL_A_NUM, Batch_size * Tile_size);
+        Report_row_balance("lpt", K, nnzR, RowIdx_COO, ColIdx_COO, row_perm, PE_NUM * HBM_CHANNEL_A_NUM, Batch_size * Tile_size);
+        Permute_rows_COO(row_perm, RowIdx_COO);
+        stage.add_bytes(Bytes_of(row_perm));
+        cout << "\n";
+    }
+
+    // --autotune=on takes the choice recorded next to the matrix if it was
+    // made for the same rows, kernel and limits, and sweeps the candidates
+    // otherwise; --autotune=sweep always sweeps. N_slices only goes up from
+    // --n-slices, and only as far as it adds no row windows
+    if(AUTOTUNE && M > Row_window_rows(ROW_WINDOW, N_SLICES, A_FORMAT)) {
+        cout << "Autotune skipped, A runs as row windows\n\n";
+    }
+    else if(AUTOTUNE) {
+        Scoped_Stage stage(profile, "autotune");
+        INDEX_TYPE N_slices_max = N_SLICES;
+        while(N_slices_max * 2 <= N_SLICES_MAX && M <= Row_window_rows(ROW_WINDOW, N_slices_max * 2, A_FORMAT)) {
+            N_slices_max *= 2;
+        }
+        Tune_Key tune_key = {Hash_matrix_COO(M, K, nnzR, RowIdx_COO, ColIdx_COO, Val_COO),
+                             Tile_WIDTH, WINDOWS, URAM_DEPTH, PE_NUM * HBM_CHANNEL_A_NUM,
+                             N_SLICES, N_slices_max, SCHEDULER, N, A_FORMAT};
+        std::string tune_path = Tune_record_path(filename);
+
+        Tune_Config tuned;
+        bool recorded = !AUTOTUNE_SWEEP && Load_tune_record(tune_path, tune_key, tuned);
+        if(recorded && !Valid_tune_config(tuned, N_SLICES, N_slices_max)) {
+            cout << "Autotune: " << tune_path << " is not a candidate of the kernel, BatchSize * TileSize = "
+                 << tuned.BATCH_SIZE * tuned.Tile_SIZE << " for N_slices = " << tuned.N_slices << "\n";
+            recorded = false;
+        }
+        if(recorded) {
+            cout << "Autotune: loaded " << tune_path << "\n";
+        }
+        else {
+            cout << "Autotune: sweep N_slices " << N_SLICES << " .. " << N_slices_max << "\n";
+            vector<Tune_Result> results;
+            size_t best = 0;
+            for(const auto &config : Autotune_candidates(N_SLICES, N_slices_max)) {
+                results.push_back(Evaluate_tune_config(config, M, K, N, nnzR, RowIdx_COO, ColIdx_COO, Val_COO, SCHEDULER, A_FORMAT, model_params));
+                const Tune_Result &r = results.back();
+                if(r.cycles < results[best].cycles ||
+                   (r.cycles == results[best].cycles && r.A_bytes < results[best].A_bytes)) {
+                    best = results.size() - 1;
+                }
+            }
+            Print_tune_results(results, best);
+            tuned = results[best].config;
+            bool saved = Save_tune_record(tune_path, tune_key, results[best]);
+            cout << "Autotune: " << (saved ? "recorded in " : "could not record in ") << tune_path << "\n";
+        }
+        Tile_size = tuned.Tile_SIZE;
+        Batch_size = tuned.BATCH_SIZE;
+        Windows = tuned.WINDOWS;
+        N_SLICES = tuned.N_slices;
+        cout << "Autotune: TileSize = " << Tile_size << ", BatchSize = " << Batch_size << ", WINDOWS = " << Windows << ", N_slices = " << N_SLICES << "\n\n";
+    }
 
-    cout << "\nCreate Date Struct: \n";
-    vector<INDEX_TYPE> RowPtr_CSR(M + 1, 0);
-    vector<INDEX_TYPE> ColIdx_CSR(nnzR, 0);
-    vector<VALUE_TYPE> Val_CSR(nnzR, 0.0);
+    // every builder cuts A into batches of the B window the kernel fills
+    if(Batch_size * Tile_size != Tile_WIDTH / N_SLICES) {
+        cout << "BatchSize * TileSize = " << Batch_size * Tile_size << " does not match the B window of "
+             << Tile_WIDTH / N_SLICES << " columns\n";
+        return EXIT_FAILURE;
+    }
 
-    vector<INDEX_TYPE> ColPtr_CSC(K + 1, 0);
-    vector<INDEX_TYPE> RowIdx_CSC(nnzR, 0);
-    vector<VALUE_TYPE> Val_CSC(nnzR, 0.0);
+    vector<SparseTile> Matrix_Band_Tile(PE_NUM * HBM_CHANNEL_A_NUM);
 
-    vector<INDEX_TYPE> RowIdx_COO(nnzR, 0);
-    vector<INDEX_TYPE> ColIdx_COO(nnzR, 0);
-    vector<VALUE_TYPE> Val_COO(nnzR, 0.0);
+    vector<INDEX_TYPE> SpElement_list_ptr;
+    aligned_vector<INDEX_TYPE> SpElement_list_ptr_fpga;
+    vector<aligned_vector<unsigned long> > Matrix_A_fpga_data(HBM_CHANNEL_A_NUM);
 
+    // rows beyond the URAM accumulators (or --row-window=R) run as row windows,
+    // one A image and one kernel run per window
+    const INDEX_TYPE window_rows = Row_window_rows(ROW_WINDOW, N_SLICES, A_FORMAT);
+    const bool row_windowed = (M > window_rows);
+    vector<Row_Window> row_windows;
+
+    Leda_Image_Header image_header;
+    std::string image_path;
+    bool image_cached = false;
+
+    if(!cache_dir.empty() && !row_windowed) {
+        cout << "Look up Sparse Matrix A image... ";
+        Scoped_Stage stage(profile, "cache_lookup");
+
+        uint64_t content_hash = Hash_matrix_COO(M, K, nnzR, RowIdx_COO, ColIdx_COO, Val_COO);
+        Init_image_header(image_header, M, K, nnzR, content_hash, SCHEDULER, Batch_size, Tile_size, Windows);
+        image_path = Leda_image_path(cache_dir, filename, image_header);
+
+        image_cached = Load_Leda_image(image_path,
+                                       image_header,
+                                       SpElement_list_ptr,
+                                       SpElement_list_ptr_fpga,
+                                       Matrix_A_fpga_data
+                                      );
+
+        stage.add_bytes(Bytes_of(SpElement_list_ptr_fpga) + Bytes_of(Matrix_A_fpga_data));
+        cout << (image_cached ? "hit " : "miss ") << image_path << "\n";
+    }
 
-    cout << "Reading Sparse Matrix A... ";
-    
-    Read_matrix_2_CSC(filename, 
-                      M, 
-                      K, 
-                      nnzR, 
-                      ColPtr_CSC, 
-                      RowIdx_CSC, 
-                      Val_CSC
-                     );
+    if(row_windowed) {
+        cout << "\nCreate Date for FPGA: \n";
+        cout << "Create Sparse Matrix A data for FPGA (" << (M + window_rows - 1) / window_rows << " row windows of " << window_rows << " rows)... ";
+
+        Scoped_Stage stage(profile, "row_windows");
+        Create_row_windows(M,
+                           K,
+                           nnzR,
+                           RowIdx_COO,
+                           ColIdx_COO,
+                           Val_COO,
+                           window_rows,
+                           Tile_size,
+                           Batch_size,
+                           Windows,
+                           SCHEDULER,
+                           row_windows
+                          );
+        for(const auto &window : row_windows) {
+            stage.add_bytes(Bytes_of(window.SpElement_list_ptr_fpga) + Bytes_of(window.Matrix_A_fpga_data));
+        }
+        stage.finish();
 
-    cout << "done\n";
-    
-    CSC_2_COO(M, 
-              K, 
-              nnzR,
-              ColPtr_CSC, 
-              RowIdx_CSC, 
-              Val_CSC,
-              RowIdx_COO,
-              ColIdx_COO,
-              Val_COO
-             );
-
-    cout << "Create Matrix Band... ";
-    vector<Matrix_COO> Matrix_Band_COO(PE_NUM * HBM_CHANNEL_A_NUM);
-
-    Matrix_Scatter(M,
-                   K,
-                   nnzR,
-                   RowIdx_COO,
-                   ColIdx_COO,
-                   Val_COO,
-                   PE_NUM * HBM_CHANNEL_A_NUM,
-                   Matrix_Band_COO
-                  );
+        cout << "done\n";
+    }
+    else if(!image_cached && PIPELINE) {
+        cout << "\nCreate Date for FPGA: \n";
+        cout << "Create Sparse Matrix A data for FPGA (pipelined)... ";
+
+        Scoped_Stage stage_pipelined(profile, "pipelined");
+        Create_Matrix_A_data_FPGA_pipelined<HBM_CHANNEL_A_NUM>(M,
+                                                               K,
+                                                               nnzR,
+                                                               RowIdx_COO,
+                                                               ColIdx_COO,
+                                                               Val_COO,
+                                                               Tile_size,
+                                                               Batch_size,
+                                                               Windows,
+                                                               SCHEDULER,
+                                                               SpElement_list_ptr,
+                                                               Matrix_A_fpga_data
+                                                              );
+        stage_pipelined.add_bytes(Bytes_of(Matrix_A_fpga_data));
+        stage_pipelined.finish();
+
+        cout << "done\n";
+
+        cout << "Create SpElement_list data for FPGA... ";
+
+        Scoped_Stage stage_ptr(profile, "layout_ptr");
+        Create_SpElement_list_data_FPGA(SpElement_list_ptr, SpElement_list_ptr_fpga);
+        stage_ptr.add_bytes(Bytes_of(SpElement_list_ptr_fpga));
+        stage_ptr.finish();
+
+        cout << "done\n";
+    }
+    else if(!image_cached) {
+        cout << "Create Matrix Band... ";
+        Scoped_Stage stage_scatter(profile, "scatter");
+        vector<Matrix_COO> Matrix_Band_COO(PE_NUM * HBM_CHANNEL_A_NUM);
+
+        Matrix_Scatter(M,
+                       K,
+                       nnzR,
+                       RowIdx_COO,
+                       ColIdx_COO,
+                       Val_COO,
+                       PE_NUM * HBM_CHANNEL_A_NUM,
+                       Matrix_Band_COO
+                      );
+        for(const auto &band : Matrix_Band_COO) {
+            stage_scatter.add_bytes(Bytes_of(band.RowIdx) + Bytes_of(band.RowIdx_copy) + Bytes_of(band.ColIdx) + Bytes_of(band.Val));
+        }
+        stage_scatter.finish();
 
-    cout << "done\n";
+        cout << "done\n";
 
-    cout << "Create Matrix Band Tile... ";
+        cout << "Create Matrix Band Tile... ";
 
-    vector<SparseTile> Matrix_Band_Tile(PE_NUM * HBM_CHANNEL_A_NUM);
+        Scoped_Stage stage_tile(profile, "tile");
 
-    Create_Matrix_Band_SparseTile_ex(Matrix_Band_COO,
-                                      Matrix_Band_Tile
-                                     );
+        Create_Matrix_Band_SparseTile_ex(Tile_size,
+                                         Matrix_Band_COO,
+                                         Matrix_Band_Tile
+                                        );
+        vector<Matrix_COO>().swap(Matrix_Band_COO);
+        for(const auto &tile : Matrix_Band_Tile) {
+            stage_tile.add_bytes(Bytes_of(tile.TileColPtr) + Bytes_of(tile.TileRowIdx) + Bytes_of(tile.TilePtr) +
+                                 Bytes_of(tile.RowIdx) + Bytes_of(tile.RowIdx_copy) + Bytes_of(tile.ColIdx) +
+                                 Bytes_of(tile.Val) + Bytes_of(tile.Mask));
+        }
+        stage_tile.finish();
 
-    cout << "done\n";
+        cout << "done\n";
+
+        cout << "Create SpElement_list... ";
+
+        Scoped_Stage stage_schedule(profile, "schedule");
 
+        vector<vector<SpElement> > SpElement_list_pes;
+
+        Create_SpElement_list_for_all_PEs(HBM_CHANNEL_A_NUM * PE_NUM, 
+                                          M, 
+                                          K, 
+                                          Tile_size, 
+                                          Batch_size, 
+                                          Matrix_Band_Tile, 
+                                          SpElement_list_pes, 
+                                          SpElement_list_ptr,
+                                          Windows,
+                                          SCHEDULER
+                                         );
+        stage_schedule.add_bytes(Bytes_of(SpElement_list_pes) + Bytes_of(SpElement_list_ptr));
+        stage_schedule.finish();
+        cout << "done\n";
+
+        cout << "\nCreate Date for FPGA: \n";
+        cout << "Create SpElement_list data for FPGA... ";
+
+        Scoped_Stage stage_ptr(profile, "layout_ptr");
+        Create_SpElement_list_data_FPGA(SpElement_list_ptr, SpElement_list_ptr_fpga);
+        stage_ptr.add_bytes(Bytes_of(SpElement_list_ptr_fpga));
+        stage_ptr.finish();
+
+        cout << "done\n";
+
+        cout << "Create Sparse Matrix A data for FPGA... ";
+
+        Scoped_Stage stage_pack(profile, "pack");
+        Create_SpElement_list_for_all_channels<HBM_CHANNEL_A_NUM>(SpElement_list_pes,
+                                                                  SpElement_list_ptr,
+                                                                  Matrix_A_fpga_data
+                                                                 );
+        stage_pack.add_bytes(Bytes_of(Matrix_A_fpga_data));
+        stage_pack.finish();
+
+        cout << "done\n";
+    }
+
+    if(!image_cached && !image_path.empty()) {
+        cout << "Save Sparse Matrix A image... ";
+        Scoped_Stage stage(profile, "cache_save");
+        bool saved = Save_Leda_image(image_path,
+                                     image_header,
+                                     SpElement_list_ptr,
+                                     SpElement_list_ptr_fpga,
+                                     Matrix_A_fpga_data
+                                    );
+        stage.add_bytes(saved ? Bytes_of(SpElement_list_ptr_fpga) + Bytes_of(Matrix_A_fpga_data) : 0);
+        cout << (saved ? "done\n" : "failed\n");
+    }
+
+    if(ROW_BALANCE) {
+        Permute_rows_COO(Inverse_row_perm(row_perm), RowIdx_COO);
+    }
+    // C comes back through both renumberings
+    if(REORDER != REORDER_NONE) {
+        vector<INDEX_TYPE> inverse = Inverse_row_perm(vertex_perm);
+        Permute_rows_COO(inverse, RowIdx_COO);
+        Permute_rows_COO(inverse, ColIdx_COO);
+        row_perm = ROW_BALANCE ? Compose_perm(vertex_perm, row_perm) : vertex_perm;
+    }
+
+    // the cache keeps the fp32 image, the other formats are repacked from it
+    if(A_FORMAT != A_FORMAT_FP32) {
+        cout << "Compress Sparse Matrix A data to " << A_format_name(A_FORMAT) << "... ";
+        Scoped_Stage stage(profile, "compress_A");
+        A_Compression A_stats = {0, 0, 0};
+        auto add_stats = [&](const A_Compression &window_stats) {
+            A_stats.fp32_lines += window_stats.fp32_lines;
+            A_stats.lines += window_stats.lines;
+            A_stats.delta_headers += window_stats.delta_headers;
+        };
+        if(row_windowed) {
+            for(auto &window : row_windows) {
+                add_stats(Compress_A_image(A_FORMAT, A_codebook, window.SpElement_list_ptr, window.SpElement_list_ptr_fpga, window.Matrix_A_fpga_data));
+                stage.add_bytes(Bytes_of(window.SpElement_list_ptr_fpga) + Bytes_of(window.Matrix_A_fpga_data));
+            }
+        }
+        else {
+            add_stats(Compress_A_image(A_FORMAT, A_codebook, SpElement_list_ptr, SpElement_list_ptr_fpga, Matrix_A_fpga_data));
+            stage.add_bytes(Bytes_of(SpElement_list_ptr_fpga) + Bytes_of(Matrix_A_fpga_data));
+        }
+        cout << "done\n";
+        printf("A image = %.1f MB, %.1f MB in fp32, %.2fx compression\n",
+               64.0 * A_stats.lines / 1048576.0, 64.0 * A_stats.fp32_lines / 1048576.0,
+               A_stats.lines > 0 ? (double)A_stats.fp32_lines / A_stats.lines : 1.0);
+        if(A_FORMAT == A_FORMAT_DELTA) {
+            printf("Delta tile switches = %lld headers, %.3f per nonzero\n",
+                   A_stats.delta_headers, nnzR > 0 ? (double)A_stats.delta_headers / nnzR : 0.0);
+        }
+    }
+
+    cout << "\nSchedule of Sparse Matrix A: \n";
+    if(row_windowed) {
+        for(const auto &window : row_windows) {
+            cout << "Row window " << window.row_start << " .. " << window.row_start + window.M - 1 << ", #nnzR = " << window.nnzR << "\n";
+            Report_SpElement_list(SCHEDULER, window.M, K, N, window.nnzR, HBM_CHANNEL_A_NUM * PE_NUM, window.SpElement_list_ptr, N_SLICES, A_FORMAT);
+        }
+    }
+    else {
+        Report_SpElement_list(SCHEDULER, M, K, N, nnzR, HBM_CHANNEL_A_NUM * PE_NUM, SpElement_list_ptr, N_SLICES, A_FORMAT);
+    }
+    cout << "\n";
+
+    // --model=on follows the batches through every kernel stage; the time of
+    // the run calibrates it afterwards
+    Model_Result model = {};
+    if(MODEL) {
+        if(row_windowed) {
+            for(const auto &window : row_windows) {
+                Add_model_result(model, Model_kernel_cycles(window.M, K, N, window.SpElement_list_ptr, N_SLICES, A_FORMAT, model_params));
+            }
+        }
+        else {
+            model = Model_kernel_cycles(M, K, N, SpElement_list_ptr, N_SLICES, A_FORMAT, model_params);
+        }
+        Report_model(model, model_params);
+        cout << "\n";
+    }
+
+    Scoped_Stage stage_dense(profile, "dense_B_C");
     vector<VALUE_TYPE> Matrix_B_CPU_Dense(K * N, 0.0);
     vector<VALUE_TYPE> Matrix_C_CPU_Dense(M * N, 0.0);
 
@@ -142,59 +685,32 @@ int main(int argc, char **argv) {
             Matrix_C_CPU_Dense[nn * M + mm] = 0.0;
         }
     }
-
-    cout << "done\n";
-
-    cout << "Create SpElement_list... ";
-
-    vector<vector<SpElement> > SpElement_list_pes;
-    vector<INDEX_TYPE> SpElement_list_ptr;
-    
-    
-    Create_SpElement_list_for_all_PEs(HBM_CHANNEL_A_NUM * PE_NUM, 
-                                      M, 
-                                      K, 
-                                      Tile_SIZE, 
-                                      BATCH_SIZE, 
-                                      Matrix_Band_Tile, 
-                                      SpElement_list_pes, 
-                                      SpElement_list_ptr,
-                                      WINDOWS
-                                     );   
-    cout << "done\n";
-
-    cout << "\nCreate Date for FPGA: \n";
-    cout << "Create SpElement_list data for FPGA... ";
-
-    aligned_vector<INDEX_TYPE> SpElement_list_ptr_fpga;
-    Create_SpElement_list_data_FPGA(SpElement_list_ptr, SpElement_list_ptr_fpga);
-
-    cout << "done\n";
-
-    cout << "Create Sparse Matrix A data for FPGA... ";
-
-    vector<aligned_vector<unsigned long> > Matrix_A_fpga_data(HBM_CHANNEL_A_NUM);
-    Create_SpElement_list_for_all_channels(SpElement_list_pes,
-                                           SpElement_list_ptr,
-                                           Matrix_A_fpga_data,
-                                           HBM_CHANNEL_A_NUM
-                                          );
+    stage_dense.add_bytes(Bytes_of(Matrix_B_CPU_Dense) + Bytes_of(Matrix_C_CPU_Dense));
+    stage_dense.finish();
 
     cout << "done\n";
 
     cout << "Create Dense Matrix B data for FPGA... ";
 
+    Scoped_Stage stage_B(profile, "layout_B");
+    vector<VALUE_TYPE> Matrix_B_reordered;
+    if(REORDER != REORDER_NONE) {
+        Permute_rows_B(vertex_perm, K, N, Matrix_B_CPU_Dense, Matrix_B_reordered);
+    }
     vector<aligned_vector<VALUE_TYPE> > Matrix_B_fpga_data(HBM_CHANNEL_B_NUM);
     Create_Matrix_B_data_FPGA(K,
                               N,
                               HBM_CHANNEL_B_NUM,
-                              Matrix_B_CPU_Dense,
+                              (REORDER != REORDER_NONE) ? Matrix_B_reordered : Matrix_B_CPU_Dense,
                               Matrix_B_fpga_data
                              );
+    stage_B.add_bytes(Bytes_of(Matrix_B_fpga_data));
+    stage_B.finish();
     cout << "done\n";
 
     cout << "Create Dense Matrix C data for FPGA... ";
 
+    Scoped_Stage stage_C(profile, "layout_C");
     vector<aligned_vector<VALUE_TYPE> > Matrix_C_fpga_data(HBM_CHANNEL_C_NUM);
 
     Create_Matrix_C_data_FPGA(M,
@@ -203,22 +719,48 @@ int main(int argc, char **argv) {
                               Matrix_C_CPU_Dense,
                               Matrix_C_fpga_data
                              );
+    stage_C.add_bytes(Bytes_of(Matrix_C_fpga_data));
+    stage_C.finish();
 
     cout << "done\n";
     
     cout << "\nRun kernel: \n";
     cout << "Run SpMM on CPU... ";
+    Scoped_Stage stage_cpu(profile, "cpu_reference");
     auto CPU_start = std::chrono::steady_clock::now();
 
-    SpMM_CPU_Tile(M,
-                   N, 
-                   K, 
-                   Matrix_Band_Tile, 
-                   Matrix_B_CPU_Dense, 
-                   Matrix_C_CPU_Dense
-                  );
+    // the band tiles only exist on the staged path, with the rows of A
+    if(image_cached || PIPELINE || row_windowed || !row_perm.empty()) {
+        vector<INDEX_TYPE> ColPtr_CSC;
+        vector<INDEX_TYPE> RowIdx_CSC;
+        vector<VALUE_TYPE> Val_CSC;
+
+        COO_2_CSC(M, K, nnzR, RowIdx_COO, ColIdx_COO, Val_COO, ColPtr_CSC, RowIdx_CSC, Val_CSC);
+
+        SpMM_CPU_CSC(M,
+                     N,
+                     K,
+                     nnzR,
+                     ColPtr_CSC,
+                     RowIdx_CSC,
+                     Val_CSC,
+                     Matrix_B_CPU_Dense,
+                     Matrix_C_CPU_Dense
+                    );
+    }
+    else {
+        SpMM_CPU_Tile(M,
+                       N, 
+                       K, 
+                       Matrix_Band_Tile, 
+                       Matrix_B_CPU_Dense, 
+                       Matrix_C_CPU_Dense
+                      );
+    }
 
     auto CPU_end = std::chrono::steady_clock::now();
+    stage_cpu.add_bytes(Bytes_of(Matrix_C_CPU_Dense));
+    stage_cpu.finish();
     cout << "done\n";
 
     double CPU_time = std::chrono::duration_cast<std::chrono::nanoseconds>(CPU_end - CPU_start).count();
@@ -226,34 +768,202 @@ int main(int argc, char **argv) {
     printf("CPU time is %f ms\n", CPU_time * 1000);
     cout << "CPU GFLOPS: " << (2.0 * N * nnzR) / 1e9 / CPU_time << endl << endl;
 
-    INDEX_TYPE Batch_num = SpElement_list_ptr.size() - 1;
-    INDEX_TYPE Sparse_Matrix_len = SpElement_list_ptr[Batch_num];
-
-    cout << "Run SpMM on FPGA... ";
-    double FPGA_time = tapa::invoke(Leda, 
-                                    bitstream,
-                                    tapa::read_only_mmap<INDEX_TYPE>(SpElement_list_ptr_fpga),
-                                    tapa::read_only_mmaps<unsigned long, HBM_CHANNEL_A_NUM>(Matrix_A_fpga_data).reinterpret<ap_uint<512>>(),
-                                    tapa::read_only_mmaps<VALUE_TYPE,    HBM_CHANNEL_B_NUM>(Matrix_B_fpga_data).reinterpret<VALUE_TYPE_v16>(),
-                                    tapa::write_only_mmaps<VALUE_TYPE,   HBM_CHANNEL_C_NUM>(Matrix_C_fpga_data).reinterpret<VALUE_TYPE_v16>(),
-                                    Batch_num,
-                                    Sparse_Matrix_len,
-                                    M,
-                                    K,
-                                    N,
-                                    ITERATION_NUM
-                                   );
+    cout << "Run optimized SpMM on CPU (" << THREADS << " threads)... ";
+
+    double CPU_opt_time = 0;
+    VALUE_TYPE CPU_opt_error = 0;
+    {
+        Scoped_Stage stage(profile, "cpu_optimized");
+        vector<INDEX_TYPE> RowPtr_CSR;
+        vector<INDEX_TYPE> ColIdx_CSR;
+        vector<VALUE_TYPE> Val_CSR;
+
+        COO_2_CSC(K, M, nnzR, ColIdx_COO, RowIdx_COO, Val_COO, RowPtr_CSR, ColIdx_CSR, Val_CSR);
+
+        vector<VALUE_TYPE> Matrix_B_rowmajor(K * N);
+        vector<VALUE_TYPE> Matrix_C_rowmajor(M * N);
+
+#pragma omp parallel for
+        for(INDEX_TYPE kk = 0; kk < K; ++kk) {
+            for(INDEX_TYPE nn = 0; nn < N; ++nn) {
+                Matrix_B_rowmajor[kk * N + nn] = Matrix_B_CPU_Dense[nn * K + kk];
+            }
+        }
+
+        for(INDEX_TYPE it = 0; it < ITERATION_NUM; ++it) {
+            auto CPU_opt_start = std::chrono::steady_clock::now();
+            SpMM_CPU_CSR_rowmajor(M, N, K, RowPtr_CSR, ColIdx_CSR, Val_CSR, Matrix_B_rowmajor, Matrix_C_rowmajor, THREADS);
+            auto CPU_opt_end = std::chrono::steady_clock::now();
+            CPU_opt_time += std::chrono::duration_cast<std::chrono::nanoseconds>(CPU_opt_end - CPU_opt_start).count();
+        }
+        CPU_opt_time *= (1e-9 / ITERATION_NUM);
+
+        for(INDEX_TYPE nn = 0; nn < N; ++nn) {
+            for(INDEX_TYPE mm = 0; mm < M; ++mm) {
+                VALUE_TYPE ref = Matrix_C_CPU_Dense[nn * M + mm];
+                VALUE_TYPE diff = fabs(Matrix_C_rowmajor[mm * N + nn] - ref);
+                CPU_opt_error = max(CPU_opt_error, diff / max(fabs(ref), (VALUE_TYPE)1.0));
+            }
+        }
+        stage.add_bytes(Bytes_of(Matrix_C_rowmajor));
+    }
+    cout << "done\n";
+
+    printf("Optimized CPU time is %f ms\n", CPU_opt_time * 1000);
+    cout << "Optimized CPU GFLOPS: " << (2.0 * N * nnzR) / 1e9 / CPU_opt_time << endl;
+    printf("Optimized CPU max relative error = %e\n\n", CPU_opt_error);
+
+    INDEX_TYPE Batch_num = row_windowed ? 0 : SpElement_list_ptr.size() - 1;
+    INDEX_TYPE Sparse_Matrix_len = row_windowed ? 0 : SpElement_list_ptr[Batch_num];
+
+    // --device=cpu runs the packed image on the host executor instead of the kernel
+    const char *device_name = CPU_EXECUTOR ? "CPU executor" : "FPGA";
+    double FPGA_time;
+
+#ifdef LEDA_PERF_COUNTERS
+    aligned_vector<INDEX_TYPE> Perf_counters_fpga((size_t)Perf_record_num(Batch_num, N, N_SLICES) * PERF_WORDS, 0);
+    vector<aligned_vector<INDEX_TYPE> > Perf_counters_windows(row_windows.size());
+    vector<double> window_time(row_windows.size(), 0);
+#endif
+
+    cout << "Run SpMM on " << device_name << "... ";
+    Scoped_Stage stage_invoke(profile, CPU_EXECUTOR ? "executor" : "invoke");
+    if(row_windowed) {
+        // the windows share B, each writes its rows of C through its own buffers
+        FPGA_time = 0;
+        for(size_t w = 0; w < row_windows.size(); ++w) {
+            Row_Window &window = row_windows[w];
+            INDEX_TYPE window_Batch_num = window.SpElement_list_ptr.size() - 1;
+            vector<aligned_vector<VALUE_TYPE> > Matrix_C_window_data(HBM_CHANNEL_C_NUM);
+            Create_Matrix_C_data_FPGA(window.M, N, HBM_CHANNEL_C_NUM, Matrix_C_CPU_Dense, Matrix_C_window_data);
+
+            if(CPU_EXECUTOR) {
+                auto executor_start = std::chrono::steady_clock::now();
+                bool fits = SpMM_FPGA_image_CPU(window.M,
+                                                K,
+                                                N,
+                                                window_Batch_num,
+                                                window.SpElement_list_ptr_fpga,
+                                                window.Matrix_A_fpga_data,
+                                                Matrix_B_fpga_data,
+                                                Matrix_C_window_data,
+                                                N_SLICES,
+                                                A_FORMAT
+                                               );
+                auto executor_end = std::chrono::steady_clock::now();
+                if(!fits) {
+                    cout << "failed, the image does not fit the kernel (URAM_DEPTH or the B window)\n";
+                    return EXIT_FAILURE;
+                }
+                FPGA_time += std::chrono::duration_cast<std::chrono::nanoseconds>(executor_end - executor_start).count();
+            }
+            else {
+#ifdef LEDA_PERF_COUNTERS
+                double window_start_time = FPGA_time;
+                Perf_counters_windows[w].resize((size_t)Perf_record_num(window_Batch_num, N, N_SLICES) * PERF_WORDS, 0);
+#endif
+                FPGA_time += tapa::invoke(Leda,
+                                          bitstream,
+                                          tapa::read_only_mmap<INDEX_TYPE>(window.SpElement_list_ptr_fpga),
+                                          tapa::read_only_mmaps<unsigned long, HBM_CHANNEL_A_NUM>(window.Matrix_A_fpga_data).reinterpret<ap_uint<512>>(),
+                                          tapa::read_only_mmaps<VALUE_TYPE,    HBM_CHANNEL_B_NUM>(Matrix_B_fpga_data).reinterpret<VALUE_TYPE_v16>(),
+                                          tapa::write_only_mmaps<VALUE_TYPE,   HBM_CHANNEL_C_NUM>(Matrix_C_window_data).reinterpret<VALUE_TYPE_v16>(),
+#ifdef LEDA_PERF_COUNTERS
+                                          tapa::write_only_mmap<INDEX_TYPE>(Perf_counters_windows[w]).reinterpret<INDEX_TYPE_v16>(),
+#endif
+                                          window_Batch_num,
+                                          window.SpElement_list_ptr[window_Batch_num],
+                                          window.M,
+                                          K,
+                                          N,
+                                          N_SLICES,
+                                          A_FORMAT,
+                                          ITERATION_NUM
+                                         ) / ITERATION_NUM;
+#ifdef LEDA_PERF_COUNTERS
+                window_time[w] = (FPGA_time - window_start_time) * 1e-9;
+#endif
+            }
+
+            Gather_row_window_C(window, M, N, Matrix_C_window_data, Matrix_C_fpga_data);
+        }
+    }
+    else if(CPU_EXECUTOR) {
+        auto executor_start = std::chrono::steady_clock::now();
+        bool fits = SpMM_FPGA_image_CPU(M,
+                                        K,
+                                        N,
+                                        Batch_num,
+                                        SpElement_list_ptr_fpga,
+                                        Matrix_A_fpga_data,
+                                        Matrix_B_fpga_data,
+                                        Matrix_C_fpga_data,
+                                        N_SLICES,
+                                        A_FORMAT
+                                       );
+        auto executor_end = std::chrono::steady_clock::now();
+        if(!fits) {
+            cout << "failed, the image does not fit the kernel (URAM_DEPTH or the B window)\n";
+            return EXIT_FAILURE;
+        }
+        FPGA_time = std::chrono::duration_cast<std::chrono::nanoseconds>(executor_end - executor_start).count();
+    }
+    else {
+        FPGA_time = tapa::invoke(Leda, 
+                                 bitstream,
+                                 tapa::read_only_mmap<INDEX_TYPE>(SpElement_list_ptr_fpga),
+                                 tapa::read_only_mmaps<unsigned long, HBM_CHANNEL_A_NUM>(Matrix_A_fpga_data).reinterpret<ap_uint<512>>(),
+                                 tapa::read_only_mmaps<VALUE_TYPE,    HBM_CHANNEL_B_NUM>(Matrix_B_fpga_data).reinterpret<VALUE_TYPE_v16>(),
+                                 tapa::write_only_mmaps<VALUE_TYPE,   HBM_CHANNEL_C_NUM>(Matrix_C_fpga_data).reinterpret<VALUE_TYPE_v16>(),
+#ifdef LEDA_PERF_COUNTERS
+                                 tapa::write_only_mmap<INDEX_TYPE>(Perf_counters_fpga).reinterpret<INDEX_TYPE_v16>(),
+#endif
+                                 Batch_num,
+                                 Sparse_Matrix_len,
+                                 M,
+                                 K,
+                                 N,
+                                 N_SLICES,
+                                 A_FORMAT,
+                                 ITERATION_NUM
+                                ) / ITERATION_NUM;
+    }
+    stage_invoke.add_bytes(Bytes_of(Matrix_C_fpga_data));
+    stage_invoke.finish();
     cout << "done\n";
-    FPGA_time *= (1e-9 / ITERATION_NUM);
-    printf("FPGA time is %f ms\n", FPGA_time * 1000);
+    FPGA_time *= 1e-9;
+    printf("%s time is %f ms\n", device_name, FPGA_time * 1000);
 
     float GFLOPS = (2.0 * N * nnzR) / 1e9 / FPGA_time;
-    printf("FPGA GFLOPS: %f \n", GFLOPS);
+    printf("%s GFLOPS: %f \n", device_name, GFLOPS);
+    printf("%s speedup over optimized CPU: %.2fx \n", device_name, CPU_opt_time / FPGA_time);
+    if(MODEL && !CPU_EXECUTOR) {
+        Report_model_calibration(model, model_params, FPGA_time);
+    }
+
+#ifdef LEDA_PERF_COUNTERS
+    if(!CPU_EXECUTOR && row_windowed) {
+        for(size_t w = 0; w < row_windows.size(); ++w) {
+            cout << "\nKernel counters (row window " << w << ", first iteration): \n";
+            Report_perf_counters(N, row_windows[w].SpElement_list_ptr.size() - 1, window_time[w], Perf_counters_windows[w], N_SLICES);
+        }
+    }
+    else if(!CPU_EXECUTOR) {
+        cout << "\nKernel counters (first iteration): \n";
+        Report_perf_counters(N, Batch_num, FPGA_time, Perf_counters_fpga, N_SLICES);
+    }
+#endif
+
+    if(!row_perm.empty()) {
+        Scoped_Stage stage(profile, "restore_C");
+        Restore_row_order_C(row_perm, M, N, Matrix_C_fpga_data);
+    }
 
     INDEX_TYPE error_num = 0;
     INDEX_TYPE mat_C_fpga_column_size = ((M + 16 - 1) / 16) * 16;
 
     cout << "Verify the correctness of result... ";
+    Scoped_Stage stage_verify(profile, "verify");
 
     for(INDEX_TYPE nn = 0; nn < N; ++nn) {
         for(INDEX_TYPE mm = 0; mm < M; ++mm) {
@@ -265,6 +975,7 @@ int main(int argc, char **argv) {
             Verify_correctness(error_num, CPU_val, FPGA_val, 1e-4);
         }
     }
+    stage_verify.finish();
     cout << "done\n";
 
     float diffpercent = 100.0 * error_num / M / N;
@@ -278,5 +989,76 @@ int main(int argc, char **argv) {
     }
     printf("error_num = [%d], percent = [%.2f%%]\n", error_num, diffpercent);
 
+    // --session=R keeps the A image on the host and runs R more B through it, in
+    // kernel runs of --session-group=G matrices; B r is the first B scaled by r + 2
+    if(SESSION_CALLS > 0 && row_windowed) {
+        cout << "\nThe session keeps one A image, it does not run row windows\n";
+    }
+    else if(SESSION_CALLS > 0) {
+        cout << "\nRun SpMM session of " << SESSION_CALLS << " B on " << device_name << "... ";
+        Leda_Session session(bitstream,
+                             CPU_EXECUTOR,
+                             M,
+                             K,
+                             N_SLICES,
+                             A_FORMAT,
+                             std::move(SpElement_list_ptr),
+                             std::move(SpElement_list_ptr_fpga),
+                             std::move(Matrix_A_fpga_data),
+                             std::move(row_perm),
+                             std::move(vertex_perm)
+                            );
+
+        INDEX_TYPE session_error_num = 0;
+        bool session_ok = true;
+        for(INDEX_TYPE r0 = 0; r0 < SESSION_CALLS && session_ok; r0 += SESSION_GROUP) {
+            INDEX_TYPE group = min(SESSION_GROUP, SESSION_CALLS - r0);
+            vector<vector<VALUE_TYPE> > B_group(group, vector<VALUE_TYPE>(Matrix_B_CPU_Dense.size()));
+            vector<vector<VALUE_TYPE> > C_group(group);
+            vector<const vector<VALUE_TYPE> *> B_list;
+            vector<vector<VALUE_TYPE> *> C_list;
+            for(INDEX_TYPE g = 0; g < group; ++g) {
+                VALUE_TYPE scale = r0 + g + 2;
+                for(size_t i = 0; i < Matrix_B_CPU_Dense.size(); ++i) {
+                    B_group[g][i] = scale * Matrix_B_CPU_Dense[i];
+                }
+                B_list.push_back(&B_group[g]);
+                C_list.push_back(&C_group[g]);
+            }
+
+            session_ok = session.Run(B_list, vector<INDEX_TYPE>(group, N), C_list);
+
+            for(INDEX_TYPE g = 0; g < group && session_ok; ++g) {
+                VALUE_TYPE scale = r0 + g + 2;
+                for(size_t i = 0; i < Matrix_C_CPU_Dense.size(); ++i) {
+                    Verify_correctness(session_error_num, scale * Matrix_C_CPU_Dense[i], C_group[g][i], 1e-4);
+                }
+            }
+        }
+        if(!session_ok) {
+            cout << "failed, the image does not fit the kernel (URAM_DEPTH or the B window)\n";
+            return EXIT_FAILURE;
+        }
+        cout << "done\n";
+
+        session.Report(nnzR);
+        float session_diffpercent = 100.0 * session_error_num / M / N / SESSION_CALLS;
+        if(session_diffpercent < 2.0) {
+            cout << "||PASSED||\n";
+        }
+        else {
+            cout << "[[FAILED]]\n";
+        }
+        printf("error_num = [%d], percent = [%.2f%%]\n", session_error_num, session_diffpercent);
+    }
+
+    if(PROFILE_TABLE) {
+        cout << "\nHost stages: \n";
+        Print_stage_profile(profile);
+    }
+    if(!profile_json.empty() && !Write_stage_profile_JSON(profile_json, profile)) {
+        cout << "Failed to write " << profile_json << "\n";
+    }
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,226 @@
+#ifndef LEDA_MODEL_H
+#define LEDA_MODEL_H
+
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+
+#include "leda.h"
+#include "leda_common.h"
+
+// Cycle-approximate model of the Leda dataflow at batch granularity, driven
+// by the batch pointers of the packed image. All MMUs and MAUs step through
+// the same batches in lockstep, so one of each is followed:
+//   SpElement_list_ptr_Loader  one pointer per batch and pass
+//   Sparse_Matrix_Loader       the A lines of a batch, at A_line_rate
+//   Dense_Matrix_Loader        the B window of a batch, at B_line_rate
+//   MMU fill                   one B line per cycle, into the buffer the
+//                              batch B_BUFFERS back has released
+//   MMU multiply               one slot per slice and cycle, once the window
+//                              is in and the previous batch is done
+//   MAU init / writeback       the C slices before and after every pass; the
+//                              first batch of a pass waits for them because
+//                              the product FIFOs are only FIFO_DEPTH deep
+//   MAU accumulate             in step with the multiply
+//   Merger, Dense_Matrix_Writer the C lines of a pass, at C_line_rate
+// Every cycle of the run is charged to the stage that held the multiply
+// engine up, and the stage with the most cycles is the bottleneck. The rates,
+// the memory latency and the clock are parameters to calibrate against the
+// time tapa::invoke returns.
+
+struct Model_Params {
+    double     clock_MHz;
+    double     A_line_rate;
+    double     B_line_rate;
+    double     C_line_rate;
+    INDEX_TYPE mem_latency;
+    INDEX_TYPE batch_overhead;
+};
+
+// the MMU spends one cycle reading the end pointer and one closing a batch
+inline Model_Params Default_model_params() {
+    Model_Params params = {225.0, 1.0, 1.0, 1.0, 64, 2};
+    return params;
+}
+
+enum {
+    MODEL_PTR_LOADER = 0,
+    MODEL_A_LOADER,
+    MODEL_B_LOADER,
+    MODEL_MMU_FILL,
+    MODEL_MMU_MULT,
+    MODEL_MAU_INIT,
+    MODEL_MAU_ACC,
+    MODEL_MAU_WRITEBACK,
+    MODEL_MERGER,
+    MODEL_C_WRITER,
+    MODEL_STAGE_NUM
+};
+
+const char *Model_stage_name(const INDEX_TYPE stage) {
+    switch(stage) {
+        case MODEL_PTR_LOADER:    return "SpElement_list_ptr_Loader";
+        case MODEL_A_LOADER:      return "Sparse_Matrix_Loader";
+        case MODEL_B_LOADER:      return "Dense_Matrix_Loader";
+        case MODEL_MMU_FILL:      return "MMU fill";
+        case MODEL_MMU_MULT:      return "MMU multiply";
+        case MODEL_MAU_INIT:      return "MAU init";
+        case MODEL_MAU_ACC:       return "MAU accumulate";
+        case MODEL_MAU_WRITEBACK: return "MAU writeback";
+        case MODEL_MERGER:        return "Merger";
+        case MODEL_C_WRITER:      return "Dense_Matrix_Writer";
+        default:                  return "unknown";
+    }
+}
+
+// busy: the cycles a stage works; critical: the cycles of the run charged
+// to it, which add up to cycles
+struct Model_Result {
+    double     cycles;
+    double     busy[MODEL_STAGE_NUM];
+    double     critical[MODEL_STAGE_NUM];
+    INDEX_TYPE bottleneck;
+};
+
+inline INDEX_TYPE Model_bottleneck(const Model_Result &result) {
+    return std::max_element(result.critical, result.critical + MODEL_STAGE_NUM) - result.critical;
+}
+
+// one kernel run of the image, one iteration
+Model_Result Model_kernel_cycles(const INDEX_TYPE M,
+                                 const INDEX_TYPE K,
+                                 const INDEX_TYPE N,
+                                 const vector<INDEX_TYPE> &SpElement_list_ptr,
+                                 const INDEX_TYPE N_slices = 1,
+                                 const INDEX_TYPE A_format = A_FORMAT_FP32,
+                                 const Model_Params &params = Default_model_params()
+                                ) {
+    Model_Result result;
+    for(INDEX_TYPE s = 0; s < MODEL_STAGE_NUM; ++s) {
+        result.busy[s] = 0;
+        result.critical[s] = 0;
+    }
+
+    const INDEX_TYPE Batch_num = SpElement_list_ptr.size() - 1;
+    const INDEX_TYPE B_lines = (K + 7) / 8;
+    const INDEX_TYPE Slice_lines = Tile_WIDTH / N_slices / 8;
+    const INDEX_TYPE Block_num = (N + 7) / 8;
+    const INDEX_TYPE num_v_init = (M + 63) / 64;
+    const INDEX_TYPE num_v_out = (M + 15) / 16;
+    const INDEX_TYPE B_stage = (params.B_line_rate < 1.0) ? MODEL_B_LOADER : MODEL_MMU_FILL;
+    const INDEX_TYPE C_stage = (params.C_line_rate < 1.0) ? MODEL_C_WRITER : MODEL_MAU_WRITEBACK;
+
+    result.busy[MODEL_PTR_LOADER] += (A_format == A_FORMAT_CODEBOOK) ? A_CODEBOOK_SIZE : 0;
+
+    double mmu_free = 0;
+    double mau_free = 0;
+    double a_ready = params.mem_latency;
+    double b_ready = params.mem_latency;
+    vector<double> mult_end(Batch_num);
+
+    for(INDEX_TYPE block = 0; block < Block_num; block += N_slices) {
+        const INDEX_TYPE Slices = min(N_slices, Block_num - block);
+
+        const double init = Slices * num_v_init;
+        const double mau_ready = mau_free + init;
+        result.busy[MODEL_MAU_INIT] += init;
+
+        double prev_end = mmu_free;
+        double fill_end = max(mmu_free, b_ready);
+        for(INDEX_TYPE i = 0; i < Batch_num; ++i) {
+            const INDEX_TYPE fill_lines = max(min(Slice_lines, B_lines - i * Slice_lines), (INDEX_TYPE)0) * Slices;
+            fill_end = max(fill_end, (i >= B_BUFFERS) ? mult_end[i - B_BUFFERS] : mmu_free) + fill_lines / params.B_line_rate;
+            result.busy[MODEL_MMU_FILL] += fill_lines;
+            result.busy[MODEL_B_LOADER] += fill_lines / params.B_line_rate;
+
+            const INDEX_TYPE slots = SpElement_list_ptr[i + 1] - SpElement_list_ptr[i];
+            const double mult = (double)slots * Slices;
+            const double a_time = A_format_lines(slots, A_format) / params.A_line_rate;
+
+            // the latest of what the multiply of batch i waits for
+            double start = prev_end + params.batch_overhead;
+            INDEX_TYPE held_by = MODEL_MMU_MULT;
+            if(fill_end > start) {
+                start = fill_end;
+                held_by = B_stage;
+            }
+            if((i == 0) && (a_ready > start)) {
+                start = a_ready;
+                held_by = MODEL_A_LOADER;
+            }
+            if((i == 0) && (mau_ready > start)) {
+                start = mau_ready;
+                held_by = MODEL_MAU_INIT;
+            }
+            if(held_by == MODEL_MAU_INIT) {
+                double writeback = max(min(mau_free, start) - prev_end, 0.0);
+                result.critical[C_stage] += writeback;
+                result.critical[MODEL_MAU_INIT] += start - prev_end - writeback;
+            }
+            else {
+                result.critical[held_by] += start - prev_end;
+            }
+
+            const double length = max(mult, a_time);
+            result.critical[MODEL_MMU_MULT] += mult;
+            result.critical[MODEL_A_LOADER] += length - mult;
+            result.busy[MODEL_MMU_MULT] += mult + params.batch_overhead;
+            result.busy[MODEL_MAU_ACC] += mult;
+            result.busy[MODEL_A_LOADER] += a_time;
+            result.busy[MODEL_PTR_LOADER] += 1;
+
+            mult_end[i] = start + length;
+            prev_end = mult_end[i];
+        }
+        result.busy[MODEL_PTR_LOADER] += 1;
+
+        // the loaders start the next pass once the last line of this one is in
+        mmu_free = prev_end;
+        a_ready = mmu_free + params.mem_latency;
+        b_ready = fill_end + params.mem_latency;
+
+        const double writeback = Slices * num_v_out;
+        mau_free = max(mau_free, mmu_free) + writeback / min(params.C_line_rate, 1.0);
+        result.busy[MODEL_MAU_WRITEBACK] += writeback;
+        result.busy[MODEL_MERGER] += writeback;
+        result.busy[MODEL_C_WRITER] += writeback / min(params.C_line_rate, 1.0);
+    }
+
+    // the run ends when the writers have drained the last pass
+    result.critical[C_stage] += mau_free - mmu_free;
+    result.cycles = mau_free;
+    result.bottleneck = Model_bottleneck(result);
+    return result;
+}
+
+// row windows run one after another
+void Add_model_result(Model_Result &sum, const Model_Result &result) {
+    sum.cycles += result.cycles;
+    for(INDEX_TYPE s = 0; s < MODEL_STAGE_NUM; ++s) {
+        sum.busy[s] += result.busy[s];
+        sum.critical[s] += result.critical[s];
+    }
+    sum.bottleneck = Model_bottleneck(sum);
+}
+
+void Report_model(const Model_Result &result, const Model_Params &params) {
+    printf("Model cycles = %.0f, %.3f ms at %.0f MHz, bottleneck = %s\n",
+           result.cycles, result.cycles / params.clock_MHz * 1e-3, params.clock_MHz, Model_stage_name(result.bottleneck));
+    printf("%-26s %12s %8s %9s\n", "stage", "busy", "util", "critical");
+    for(INDEX_TYPE s = 0; s < MODEL_STAGE_NUM; ++s) {
+        printf("%-26s %12.0f %7.1f%% %8.1f%%\n",
+               Model_stage_name(s), result.busy[s],
+               result.cycles > 0 ? 100.0 * result.busy[s] / result.cycles : 0.0,
+               result.cycles > 0 ? 100.0 * result.critical[s] / result.cycles : 0.0);
+    }
+}
+
+// the clock at which the model would match the measured time of one run
+void Report_model_calibration(const Model_Result &result, const Model_Params &params, const double seconds) {
+    double predicted = result.cycles / (params.clock_MHz * 1e6);
+    printf("Model calibration: measured %.3f ms, predicted %.3f ms, measured / predicted = %.2f, %.1f MHz would match\n",
+           seconds * 1e3, predicted * 1e3, predicted > 0 ? seconds / predicted : 0.0,
+           seconds > 0 ? result.cycles / seconds * 1e-6 : 0.0);
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef LEDA_PROFILE_H
+#define LEDA_PROFILE_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "leda_common.h"
+
+// per-stage accounting of the host driver: every stage records its wall
+// time, process CPU time (all threads), resident set change and the bytes
+// of data it produced; the stages are summed, not nested
+
+struct Stage_Record {
+    std::string name;
+    double      wall_time;
+    double      cpu_time;
+    int64_t     rss_delta;
+    int64_t     peak_rss;
+    uint64_t    bytes;
+};
+
+inline double Process_cpu_time() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+// current resident set in bytes, 0 when /proc is not available
+inline int64_t Process_rss() {
+    FILE *f = fopen("/proc/self/statm", "r");
+    if(f == NULL) {
+        return 0;
+    }
+    long pages = 0;
+    long resident = 0;
+    bool ok = (fscanf(f, "%ld %ld", &pages, &resident) == 2);
+    fclose(f);
+    return ok ? (int64_t)resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+inline int64_t Process_peak_rss() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (int64_t)usage.ru_maxrss * 1024;
+}
+
+struct Stage_Profile {
+    vector<Stage_Record> stages;
+};
+
+// times the enclosing scope, or up to finish() when the stage's results
+// have to outlive it
+class Scoped_Stage {
+public:
+    Scoped_Stage(Stage_Profile &profile, const std::string &name)
+        : profile_(profile), name_(name), bytes_(0), finished_(false) {
+        rss_start_ = Process_rss();
+        cpu_start_ = Process_cpu_time();
+        wall_start_ = std::chrono::steady_clock::now();
+    }
+
+    ~Scoped_Stage() {
+        finish();
+    }
+
+    void add_bytes(const uint64_t bytes) {
+        bytes_ += bytes;
+    }
+
+    void finish() {
+        if(finished_) {
+            return;
+        }
+        finished_ = true;
+        auto wall_end = std::chrono::steady_clock::now();
+        Stage_Record record;
+        record.name      = name_;
+        record.wall_time = std::chrono::duration<double>(wall_end - wall_start_).count();
+        record.cpu_time  = Process_cpu_time() - cpu_start_;
+        record.rss_delta = Process_rss() - rss_start_;
+        record.peak_rss  = Process_peak_rss();
+        record.bytes     = bytes_;
+        profile_.stages.push_back(record);
+    }
+
+private:
+    Stage_Profile &profile_;
+    std::string    name_;
+    uint64_t       bytes_;
+    bool           finished_;
+    int64_t        rss_start_;
+    double         cpu_start_;
+    std::chrono::steady_clock::time_point wall_start_;
+};
+
+template<typename T, typename A>
+inline uint64_t Bytes_of(const vector<T, A> &v) {
+    return v.size() * sizeof(T);
+}
+
+template<typename T, typename A>
+inline uint64_t Bytes_of(const vector<vector<T, A> > &vs) {
+    uint64_t bytes = 0;
+    for(const auto &v : vs) {
+        bytes += v.size() * sizeof(T);
+    }
+    return bytes;
+}
+
+void Print_stage_profile(const Stage_Profile &profile) {
+    double total_wall = 0;
+    for(const auto &s : profile.stages) {
+        total_wall += s.wall_time;
+    }
+
+    printf("%-16s %12s %7s %12s %8s %12s %12s\n",
+           "stage", "wall (ms)", "wall %", "cpu (ms)", "cpu/wall", "rss +/- (MB)", "out (MB)");
+    for(const auto &s : profile.stages) {
+        printf("%-16s %12.3f %6.1f%% %12.3f %8.2f %12.1f %12.1f\n",
+               s.name.c_str(),
+               s.wall_time * 1e3,
+               total_wall > 0 ? 100.0 * s.wall_time / total_wall : 0.0,
+               s.cpu_time * 1e3,
+               s.wall_time > 0 ? s.cpu_time / s.wall_time : 0.0,
+               s.rss_delta / 1048576.0,
+               s.bytes / 1048576.0);
+    }
+    printf("%-16s %12.3f\n", "total", total_wall * 1e3);
+    printf("peak RSS = %.1f MB\n", Process_peak_rss() / 1048576.0);
+}
+
+bool Write_stage_profile_JSON(const std::string &filename, const Stage_Profile &profile) {
+    FILE *f = fopen(filename.c_str(), "w");
+    if(f == NULL) {
+        return false;
+    }
+    fprintf(f, "{\n  \"peak_rss_bytes\": %lld,\n  \"stages\": [\n", (long long)Process_peak_rss());
+    for(size_t i = 0; i < profile.stages.size(); ++i) {
+        const Stage_Record &s = profile.stages[i];
+        fprintf(f, "    {\"stage\": \"%s\", \"wall_s\": %.9f, \"cpu_s\": %.9f, "
+                   "\"rss_delta_bytes\": %lld, \"peak_rss_bytes\": %lld, \"bytes\": %llu}%s\n",
+                s.name.c_str(),
+                s.wall_time,
+                s.cpu_time,
+                (long long)s.rss_delta,
+                (long long)s.peak_rss,
+                (unsigned long long)s.bytes,
+                i + 1 < profile.stages.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+#endif
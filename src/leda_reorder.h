@@ -0,0 +1,366 @@
+#ifndef LEDA_REORDER_H
+#define LEDA_REORDER_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+
+#include "leda.h"
+#include "leda_common.h"
+
+// Vertex reordering of a square A before Matrix_Scatter. The tiles of a PE
+// band are Tile_SIZE of its rows by Tile_SIZE columns, so how many nonzeros
+// share a tile, and with it the padding of the schedule, depends on the
+// order of the vertices. The permutation is applied to the rows and the
+// columns of A, A' = P A P^T, so the kernel computes C' = A' (P B) = P C;
+// B is laid out with its rows permuted and C is put back afterwards.
+//   rcm        reverse Cuthill-McKee, bandwidth reduction from a
+//              pseudo-peripheral vertex of every component
+//   degree     vertices by decreasing degree, hubs first
+//   community  label propagation, the vertices of a community together
+// All of them work on the pattern of A + A^T.
+
+enum {
+    REORDER_NONE      = 0,
+    REORDER_RCM       = 1,
+    REORDER_DEGREE    = 2,
+    REORDER_COMMUNITY = 3,
+    REORDER_NUM
+};
+
+const char *Reorder_name(const INDEX_TYPE method) {
+    switch(method) {
+        case REORDER_NONE:      return "none";
+        case REORDER_RCM:       return "rcm";
+        case REORDER_DEGREE:    return "degree";
+        case REORDER_COMMUNITY: return "community";
+        default:                return "unknown";
+    }
+}
+
+INDEX_TYPE Parse_reorder(const std::string &name) {
+    for(INDEX_TYPE m = 0; m < REORDER_NUM; ++m) {
+        if(name == Reorder_name(m)) {
+            return m;
+        }
+    }
+    return -1;
+}
+
+// pattern of A + A^T without the diagonal, every list sorted and without
+// duplicates; adj_end[v] is the end of the list of v
+void Build_symmetric_adjacency(const INDEX_TYPE M,
+                               const INDEX_TYPE nnzR,
+                               const vector<INDEX_TYPE> &RowIdx_COO,
+                               const vector<INDEX_TYPE> &ColIdx_COO,
+                               vector<INDEX_TYPE> &adj_ptr,
+                               vector<INDEX_TYPE> &adj_end,
+                               vector<INDEX_TYPE> &adj
+                              ) {
+    adj_ptr.assign(M + 1, 0);
+    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
+        if(RowIdx_COO[i] != ColIdx_COO[i]) {
+            adj_ptr[RowIdx_COO[i] + 1]++;
+            adj_ptr[ColIdx_COO[i] + 1]++;
+        }
+    }
+    for(INDEX_TYPE v = 0; v < M; ++v) {
+        adj_ptr[v + 1] += adj_ptr[v];
+    }
+    adj.resize(adj_ptr[M]);
+    vector<INDEX_TYPE> offsets(adj_ptr.begin(), adj_ptr.end() - 1);
+    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
+        if(RowIdx_COO[i] != ColIdx_COO[i]) {
+            adj[offsets[RowIdx_COO[i]]++] = ColIdx_COO[i];
+            adj[offsets[ColIdx_COO[i]]++] = RowIdx_COO[i];
+        }
+    }
+
+    adj_end.resize(M);
+#pragma omp parallel for schedule(dynamic, 1024)
+    for(INDEX_TYPE v = 0; v < M; ++v) {
+        std::sort(adj.begin() + adj_ptr[v], adj.begin() + adj_ptr[v + 1]);
+        adj_end[v] = std::unique(adj.begin() + adj_ptr[v], adj.begin() + adj_ptr[v + 1]) - adj.begin();
+    }
+}
+
+// BFS over the component of root; returns its depth and sets far to a
+// vertex of lowest degree in the last level. level is -1 everywhere on entry
+// and on return
+INDEX_TYPE BFS_depth(const INDEX_TYPE root,
+                     const vector<INDEX_TYPE> &adj_ptr,
+                     const vector<INDEX_TYPE> &adj_end,
+                     const vector<INDEX_TYPE> &adj,
+                     vector<INDEX_TYPE> &level,
+                     vector<INDEX_TYPE> &queue,
+                     INDEX_TYPE &far
+                    ) {
+    queue.clear();
+    queue.push_back(root);
+    level[root] = 0;
+    for(size_t head = 0; head < queue.size(); ++head) {
+        INDEX_TYPE v = queue[head];
+        for(INDEX_TYPE e = adj_ptr[v]; e < adj_end[v]; ++e) {
+            if(level[adj[e]] < 0) {
+                level[adj[e]] = level[v] + 1;
+                queue.push_back(adj[e]);
+            }
+        }
+    }
+    const INDEX_TYPE depth = level[queue.back()];
+    far = queue.back();
+    for(size_t q = queue.size(); q-- > 0 && level[queue[q]] == depth;) {
+        INDEX_TYPE v = queue[q];
+        if(adj_end[v] - adj_ptr[v] <= adj_end[far] - adj_ptr[far]) {
+            far = v;
+        }
+    }
+    for(INDEX_TYPE v : queue) {
+        level[v] = -1;
+    }
+    return depth;
+}
+
+void Reorder_RCM(const INDEX_TYPE M,
+                 const vector<INDEX_TYPE> &adj_ptr,
+                 const vector<INDEX_TYPE> &adj_end,
+                 vector<INDEX_TYPE> &adj,
+                 vector<INDEX_TYPE> &vertex_perm
+                ) {
+    vector<INDEX_TYPE> degree(M);
+    for(INDEX_TYPE v = 0; v < M; ++v) {
+        degree[v] = adj_end[v] - adj_ptr[v];
+    }
+    // Cuthill-McKee visits the neighbors of a vertex by increasing degree
+#pragma omp parallel for schedule(dynamic, 1024)
+    for(INDEX_TYPE v = 0; v < M; ++v) {
+        std::sort(adj.begin() + adj_ptr[v], adj.begin() + adj_end[v], [&](const INDEX_TYPE a, const INDEX_TYPE b) {
+            return degree[a] < degree[b] || (degree[a] == degree[b] && a < b);
+        });
+    }
+    vector<INDEX_TYPE> by_degree(M);
+    for(INDEX_TYPE v = 0; v < M; ++v) {
+        by_degree[v] = v;
+    }
+    std::stable_sort(by_degree.begin(), by_degree.end(), [&](const INDEX_TYPE a, const INDEX_TYPE b) {
+        return degree[a] < degree[b];
+    });
+
+    vector<INDEX_TYPE> level(M, -1);
+    vector<INDEX_TYPE> queue;
+    vector<char> visited(M, 0);
+    vector<INDEX_TYPE> order;
+    order.reserve(M);
+    for(INDEX_TYPE seed : by_degree) {
+        if(visited[seed]) {
+            continue;
+        }
+        // pseudo-peripheral root: move to the far end while the component
+        // gets deeper from there
+        INDEX_TYPE root = seed;
+        INDEX_TYPE far;
+        INDEX_TYPE depth = BFS_depth(root, adj_ptr, adj_end, adj, level, queue, far);
+        for(INDEX_TYPE round = 0; round < 8 && far != root; ++round) {
+            INDEX_TYPE far_next;
+            INDEX_TYPE far_depth = BFS_depth(far, adj_ptr, adj_end, adj, level, queue, far_next);
+            if(far_depth <= depth) {
+                break;
+            }
+            root = far;
+            depth = far_depth;
+            far = far_next;
+        }
+
+        size_t head = order.size();
+        order.push_back(root);
+        visited[root] = 1;
+        for(; head < order.size(); ++head) {
+            INDEX_TYPE v = order[head];
+            for(INDEX_TYPE e = adj_ptr[v]; e < adj_end[v]; ++e) {
+                if(!visited[adj[e]]) {
+                    visited[adj[e]] = 1;
+                    order.push_back(adj[e]);
+                }
+            }
+        }
+    }
+
+    vertex_perm.resize(M);
+    for(INDEX_TYPE i = 0; i < M; ++i) {
+        vertex_perm[order[i]] = M - 1 - i;
+    }
+}
+
+void Reorder_degree(const INDEX_TYPE M,
+                    const vector<INDEX_TYPE> &adj_ptr,
+                    const vector<INDEX_TYPE> &adj_end,
+                    vector<INDEX_TYPE> &vertex_perm
+                   ) {
+    vector<INDEX_TYPE> order(M);
+    for(INDEX_TYPE v = 0; v < M; ++v) {
+        order[v] = v;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](const INDEX_TYPE a, const INDEX_TYPE b) {
+        return adj_end[a] - adj_ptr[a] > adj_end[b] - adj_ptr[b];
+    });
+    vertex_perm.resize(M);
+    for(INDEX_TYPE i = 0; i < M; ++i) {
+        vertex_perm[order[i]] = i;
+    }
+}
+
+// synchronous label propagation: every vertex takes the label most of its
+// neighbors have, keeping its own on a tie with it and the smallest
+// otherwise; communities are laid out in the order of their first vertex
+void Reorder_community(const INDEX_TYPE M,
+                       const vector<INDEX_TYPE> &adj_ptr,
+                       const vector<INDEX_TYPE> &adj_end,
+                       const vector<INDEX_TYPE> &adj,
+                       vector<INDEX_TYPE> &vertex_perm,
+                       const INDEX_TYPE max_rounds = 20
+                      ) {
+    vector<INDEX_TYPE> label(M);
+    vector<INDEX_TYPE> next(M);
+    for(INDEX_TYPE v = 0; v < M; ++v) {
+        label[v] = v;
+    }
+    for(INDEX_TYPE round = 0; round < max_rounds; ++round) {
+        long long changed = 0;
+#pragma omp parallel reduction(+:changed)
+        {
+            vector<INDEX_TYPE> labels;
+#pragma omp for schedule(dynamic, 1024)
+            for(INDEX_TYPE v = 0; v < M; ++v) {
+                labels.clear();
+                for(INDEX_TYPE e = adj_ptr[v]; e < adj_end[v]; ++e) {
+                    labels.push_back(label[adj[e]]);
+                }
+                std::sort(labels.begin(), labels.end());
+                INDEX_TYPE best = label[v];
+                INDEX_TYPE best_count = std::count(labels.begin(), labels.end(), label[v]);
+                for(size_t i = 0; i < labels.size();) {
+                    size_t j = i;
+                    while(j < labels.size() && labels[j] == labels[i]) {
+                        ++j;
+                    }
+                    if((INDEX_TYPE)(j - i) > best_count) {
+                        best = labels[i];
+                        best_count = j - i;
+                    }
+                    i = j;
+                }
+                next[v] = best;
+                changed += (best != label[v]);
+            }
+        }
+        label.swap(next);
+        if(changed * 100 < M) {
+            break;
+        }
+    }
+
+    // communities by their first vertex, the vertices of one in input order
+    vector<INDEX_TYPE> first(M, M);
+    for(INDEX_TYPE v = M - 1; v >= 0; --v) {
+        first[label[v]] = v;
+    }
+    vector<INDEX_TYPE> order(M);
+    for(INDEX_TYPE v = 0; v < M; ++v) {
+        order[v] = v;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](const INDEX_TYPE a, const INDEX_TYPE b) {
+        return first[label[a]] < first[label[b]];
+    });
+    vertex_perm.resize(M);
+    for(INDEX_TYPE i = 0; i < M; ++i) {
+        vertex_perm[order[i]] = i;
+    }
+}
+
+// vertex_perm[v] is the new number of vertex v
+void Reorder_vertices(const INDEX_TYPE method,
+                      const INDEX_TYPE M,
+                      const INDEX_TYPE nnzR,
+                      const vector<INDEX_TYPE> &RowIdx_COO,
+                      const vector<INDEX_TYPE> &ColIdx_COO,
+                      vector<INDEX_TYPE> &vertex_perm
+                     ) {
+    vector<INDEX_TYPE> adj_ptr;
+    vector<INDEX_TYPE> adj_end;
+    vector<INDEX_TYPE> adj;
+    Build_symmetric_adjacency(M, nnzR, RowIdx_COO, ColIdx_COO, adj_ptr, adj_end, adj);
+
+    if(method == REORDER_RCM) {
+        Reorder_RCM(M, adj_ptr, adj_end, adj, vertex_perm);
+    }
+    else if(method == REORDER_DEGREE) {
+        Reorder_degree(M, adj_ptr, adj_end, vertex_perm);
+    }
+    else if(method == REORDER_COMMUNITY) {
+        Reorder_community(M, adj_ptr, adj_end, adj, vertex_perm);
+    }
+    else {
+        vertex_perm.resize(M);
+        for(INDEX_TYPE v = 0; v < M; ++v) {
+            vertex_perm[v] = v;
+        }
+    }
+}
+
+// B for the reordered A: row vertex_perm[k] of every column is row k
+void Permute_rows_B(const vector<INDEX_TYPE> &vertex_perm,
+                    const INDEX_TYPE K,
+                    const INDEX_TYPE N,
+                    const vector<VALUE_TYPE> &Matrix_B_Dense,
+                    vector<VALUE_TYPE> &Matrix_B_permuted
+                   ) {
+    Matrix_B_permuted.resize(Matrix_B_Dense.size());
+#pragma omp parallel for
+    for(INDEX_TYPE nn = 0; nn < N; ++nn) {
+        const VALUE_TYPE *in = Matrix_B_Dense.data() + (size_t)K * nn;
+        VALUE_TYPE *out = Matrix_B_permuted.data() + (size_t)K * nn;
+        for(INDEX_TYPE kk = 0; kk < K; ++kk) {
+            out[vertex_perm[kk]] = in[kk];
+        }
+    }
+}
+
+// first, then second: result[r] = second[first[r]]
+inline vector<INDEX_TYPE> Compose_perm(const vector<INDEX_TYPE> &first, const vector<INDEX_TYPE> &second) {
+    vector<INDEX_TYPE> result(first.size());
+    for(size_t r = 0; r < first.size(); ++r) {
+        result[r] = second[first[r]];
+    }
+    return result;
+}
+
+// nonzeros per non-empty tile of the PE bands: row r is local row
+// r / NUM_PE of PE r % NUM_PE, a tile is Tile_size local rows by Tile_size
+// columns
+void Report_tile_density(const char *name,
+                         const INDEX_TYPE M,
+                         const INDEX_TYPE K,
+                         const INDEX_TYPE nnzR,
+                         const vector<INDEX_TYPE> &RowIdx_COO,
+                         const vector<INDEX_TYPE> &ColIdx_COO,
+                         const INDEX_TYPE NUM_PE,
+                         const INDEX_TYPE Tile_size
+                        ) {
+    const uint64_t Row_tiles = ((M + NUM_PE - 1) / NUM_PE + Tile_size - 1) / Tile_size;
+    const uint64_t Col_tiles = (K + Tile_size - 1) / Tile_size;
+    vector<uint64_t> tiles(nnzR);
+#pragma omp parallel for
+    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
+        uint64_t pe = RowIdx_COO[i] % NUM_PE;
+        uint64_t row_tile = RowIdx_COO[i] / NUM_PE / Tile_size;
+        tiles[i] = (pe * Row_tiles + row_tile) * Col_tiles + ColIdx_COO[i] / Tile_size;
+    }
+    std::sort(tiles.begin(), tiles.end());
+    size_t tile_num = std::unique(tiles.begin(), tiles.end()) - tiles.begin();
+    printf("Tile density (%s): %zu non-empty tiles, %.3f nonzeros per tile\n",
+           name, tile_num, tile_num > 0 ? (double)nnzR / tile_num : 0.0);
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef LEDA_ROW_BALANCE_H
+#define LEDA_ROW_BALANCE_H
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+
+#include "leda.h"
+#include "leda_common.h"
+
+// Nonzero-aware row placement. Matrix_Scatter gives row r to PE r % NUM_PE
+// and every batch of the image is as long as its busiest PE, so on
+// power-law graphs the PEs that hold the hub rows set the length while the
+// others stream padding. Balance_rows_LPT renumbers the rows so that
+// r % NUM_PE still picks the PE, but the rows go longest first to the PE
+// with the fewest nonzeros that has a row left. Every PE keeps its number
+// of rows, so the renumbering is a permutation of [0, M) and C keeps its
+// layout; the kernel computes C in the new row order and
+// Restore_row_order_C puts the rows back.
+
+// row_perm[r] is the kernel row of row r
+void Balance_rows_LPT(const INDEX_TYPE M,
+                      const INDEX_TYPE nnzR,
+                      const vector<INDEX_TYPE> &RowIdx_COO,
+                      const INDEX_TYPE NUM_PE,
+                      vector<INDEX_TYPE> &row_perm
+                     ) {
+    vector<INDEX_TYPE> row_nnz(M, 0);
+    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
+        row_nnz[RowIdx_COO[i]]++;
+    }
+    vector<INDEX_TYPE> order(M);
+    for(INDEX_TYPE r = 0; r < M; ++r) {
+        order[r] = r;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](const INDEX_TYPE a, const INDEX_TYPE b) {
+        return row_nnz[a] > row_nnz[b];
+    });
+
+    // PE p owns the rows p, p + NUM_PE, ... below M
+    typedef std::pair<long long, INDEX_TYPE> PE_Load;
+    std::priority_queue<PE_Load, vector<PE_Load>, std::greater<PE_Load> > pes;
+    vector<INDEX_TYPE> next_row(NUM_PE);
+    for(INDEX_TYPE p = 0; p < min(NUM_PE, M); ++p) {
+        next_row[p] = p;
+        pes.push(PE_Load(0, p));
+    }
+
+    row_perm.resize(M);
+    for(INDEX_TYPE i = 0; i < M; ++i) {
+        PE_Load pe = pes.top();
+        pes.pop();
+        INDEX_TYPE p = pe.second;
+        row_perm[order[i]] = next_row[p];
+        next_row[p] += NUM_PE;
+        if(next_row[p] < M) {
+            pes.push(PE_Load(pe.first + row_nnz[order[i]], p));
+        }
+    }
+}
+
+// rows of the COO in place: RowIdx_COO[i] becomes row_perm[RowIdx_COO[i]]
+void Permute_rows_COO(const vector<INDEX_TYPE> &row_perm, vector<INDEX_TYPE> &RowIdx_COO) {
+#pragma omp parallel for
+    for(size_t i = 0; i < RowIdx_COO.size(); ++i) {
+        RowIdx_COO[i] = row_perm[RowIdx_COO[i]];
+    }
+}
+
+inline vector<INDEX_TYPE> Inverse_row_perm(const vector<INDEX_TYPE> &row_perm) {
+    vector<INDEX_TYPE> inverse(row_perm.size());
+    for(size_t r = 0; r < row_perm.size(); ++r) {
+        inverse[row_perm[r]] = r;
+    }
+    return inverse;
+}
+
+// the nonzeros of the busiest PE over the mean, for the whole matrix and
+// summed over the batches, which is what the padded image pays for; an
+// empty row_perm is the row % NUM_PE placement
+void Report_row_balance(const char *name,
+                        const INDEX_TYPE K,
+                        const INDEX_TYPE nnzR,
+                        const vector<INDEX_TYPE> &RowIdx_COO,
+                        const vector<INDEX_TYPE> &ColIdx_COO,
+                        const vector<INDEX_TYPE> &row_perm,
+                        const INDEX_TYPE NUM_PE,
+                        const INDEX_TYPE batch_width
+                       ) {
+    const INDEX_TYPE Batch_num = (K + batch_width - 1) / batch_width;
+    vector<long long> load((size_t)Batch_num * NUM_PE, 0);
+    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
+        INDEX_TYPE row = row_perm.empty() ? RowIdx_COO[i] : row_perm[RowIdx_COO[i]];
+        load[(size_t)(ColIdx_COO[i] / batch_width) * NUM_PE + row % NUM_PE]++;
+    }
+
+    vector<long long> pe_load(NUM_PE, 0);
+    long long batch_max_sum = 0;
+    for(INDEX_TYPE b = 0; b < Batch_num; ++b) {
+        long long batch_max = 0;
+        for(INDEX_TYPE p = 0; p < NUM_PE; ++p) {
+            pe_load[p] += load[(size_t)b * NUM_PE + p];
+            batch_max = max(batch_max, load[(size_t)b * NUM_PE + p]);
+        }
+        batch_max_sum += batch_max;
+    }
+    double mean = (double)nnzR / NUM_PE;
+    printf("Row balance (%s): busiest PE %.2fx the mean, busiest PE per batch %.2fx the mean\n",
+           name,
+           mean > 0 ? *std::max_element(pe_load.begin(), pe_load.end()) / mean : 1.0,
+           mean > 0 ? batch_max_sum / mean : 1.0);
+}
+
+// C rows of the kernel back in the order of A: row r of every column comes
+// from kernel row row_perm[r]
+void Restore_row_order_C(const vector<INDEX_TYPE> &row_perm,
+                         const INDEX_TYPE M,
+                         const INDEX_TYPE N,
+                         vector<aligned_vector<VALUE_TYPE> > &Matrix_C_fpga_data
+                        ) {
+    const INDEX_TYPE column_size = ((M + 16 - 1) / 16) * 16;
+
+#pragma omp parallel for
+    for(INDEX_TYPE nn = 0; nn < N; ++nn) {
+        VALUE_TYPE *column = Matrix_C_fpga_data[nn % 8].data() + (size_t)column_size * (nn / 8);
+        vector<VALUE_TYPE> kernel_column(column, column + M);
+        for(INDEX_TYPE r = 0; r < M; ++r) {
+            column[r] = kernel_column[row_perm[r]];
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef LEDA_ROW_WINDOW_H
+#define LEDA_ROW_WINDOW_H
+
+#include <vector>
+#include <algorithm>
+
+#include "leda.h"
+#include "leda_common.h"
+
+// Row windows for matrices with more rows than the MAU accumulators hold.
+// Every PE keeps its rows of C in URAM_DEPTH words, so one kernel run covers
+// at most PE_NUM * HBM_CHANNEL_A_NUM * URAM_DEPTH rows. Larger matrices are
+// cut into windows of consecutive rows, each with its own A image built from
+// the rows of the window rebased to 0; the windows run one after another
+// with the same B and their C is gathered at the row offset of the window.
+
+constexpr INDEX_TYPE ROW_WINDOW_MAX = PE_NUM * HBM_CHANNEL_A_NUM * URAM_DEPTH;
+
+struct Row_Window {
+    INDEX_TYPE row_start;
+    INDEX_TYPE M;
+    INDEX_TYPE nnzR;
+
+    vector<INDEX_TYPE>                     SpElement_list_ptr;
+    aligned_vector<INDEX_TYPE>             SpElement_list_ptr_fpga;
+    vector<aligned_vector<unsigned long> > Matrix_A_fpga_data;
+};
+
+// window height: the requested rows (0 for the largest window), rounded to
+// whole C vectors and capped by the URAM capacity left to each N-slice and
+// by the rows the A word format can address
+inline INDEX_TYPE Row_window_rows(const INDEX_TYPE requested,
+                                  const INDEX_TYPE N_slices = 1,
+                                  const INDEX_TYPE A_format = A_FORMAT_FP32
+                                 ) {
+    INDEX_TYPE rows = (requested > 0) ? requested : ROW_WINDOW_MAX;
+    INDEX_TYPE max_rows = min(ROW_WINDOW_MAX / N_slices, PE_NUM * HBM_CHANNEL_A_NUM * A_format_rows(A_format));
+    return min(max_rows, (rows + 15) / 16 * 16);
+}
+
+void Create_row_windows(const INDEX_TYPE M,
+                        const INDEX_TYPE K,
+                        const INDEX_TYPE nnzR,
+
+                        const vector<INDEX_TYPE> &RowIdx_COO,
+                        const vector<INDEX_TYPE> &ColIdx_COO,
+                        const vector<VALUE_TYPE> &Val_COO,
+
+                        const INDEX_TYPE window_rows,
+                        const INDEX_TYPE Tile_SIZE,
+                        const INDEX_TYPE BATCH_SIZE,
+                        const INDEX_TYPE WINDOWS,
+                        const INDEX_TYPE SCHEDULER,
+
+                        vector<Row_Window> &row_windows
+                       ) {
+    const INDEX_TYPE window_num = (M + window_rows - 1) / window_rows;
+    row_windows.resize(window_num);
+
+    // counting sort of the nonzeros by window, keeping the input order
+    vector<INDEX_TYPE> window_ptr(window_num + 1, 0);
+    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
+        window_ptr[RowIdx_COO[i] / window_rows + 1]++;
+    }
+    for(INDEX_TYPE w = 0; w < window_num; ++w) {
+        window_ptr[w + 1] += window_ptr[w];
+    }
+    vector<INDEX_TYPE> order(nnzR);
+    vector<INDEX_TYPE> offsets(window_ptr.begin(), window_ptr.end() - 1);
+    for(INDEX_TYPE i = 0; i < nnzR; ++i) {
+        order[offsets[RowIdx_COO[i] / window_rows]++] = i;
+    }
+
+    vector<INDEX_TYPE> RowIdx_window;
+    vector<INDEX_TYPE> ColIdx_window;
+    vector<VALUE_TYPE> Val_window;
+
+    for(INDEX_TYPE w = 0; w < window_num; ++w) {
+        Row_Window &window = row_windows[w];
+        window.row_start = w * window_rows;
+        window.M = min(window_rows, M - window.row_start);
+        window.nnzR = window_ptr[w + 1] - window_ptr[w];
+
+        RowIdx_window.resize(window.nnzR);
+        ColIdx_window.resize(window.nnzR);
+        Val_window.resize(window.nnzR);
+
+#pragma omp parallel for
+        for(INDEX_TYPE i = 0; i < window.nnzR; ++i) {
+            INDEX_TYPE src = order[window_ptr[w] + i];
+            RowIdx_window[i] = RowIdx_COO[src] - window.row_start;
+            ColIdx_window[i] = ColIdx_COO[src];
+            Val_window[i] = Val_COO[src];
+        }
+
+        window.Matrix_A_fpga_data.resize(HBM_CHANNEL_A_NUM);
+        Create_Matrix_A_data_FPGA_pipelined<HBM_CHANNEL_A_NUM>(window.M,
+                                                               K,
+                                                               window.nnzR,
+                                                               RowIdx_window,
+                                                               ColIdx_window,
+                                                               Val_window,
+                                                               Tile_SIZE,
+                                                               BATCH_SIZE,
+                                                               WINDOWS,
+                                                               SCHEDULER,
+                                                               window.SpElement_list_ptr,
+                                                               window.Matrix_A_fpga_data
+                                                              );
+        Create_SpElement_list_data_FPGA(window.SpElement_list_ptr, window.SpElement_list_ptr_fpga);
+    }
+}
+
+// copy the C of one window, laid out for window.M rows, into the C of the
+// whole matrix at the rows of the window
+void Gather_row_window_C(const Row_Window &window,
+                         const INDEX_TYPE M,
+                         const INDEX_TYPE N,
+                         const vector<aligned_vector<VALUE_TYPE> > &Matrix_C_window_data,
+                         vector<aligned_vector<VALUE_TYPE> > &Matrix_C_fpga_data
+                        ) {
+    const INDEX_TYPE window_column_size = ((window.M + 16 - 1) / 16) * 16;
+    const INDEX_TYPE column_size = ((M + 16 - 1) / 16) * 16;
+
+#pragma omp parallel for
+    for(INDEX_TYPE nn = 0; nn < N; ++nn) {
+        const VALUE_TYPE *in = Matrix_C_window_data[nn % 8].data() + (size_t)window_column_size * (nn / 8);
+        VALUE_TYPE *out = Matrix_C_fpga_data[nn % 8].data() + (size_t)column_size * (nn / 8) + window.row_start;
+        std::copy(in, in + window.M, out);
+    }
+}
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef LEDA_SESSION_H
+#define LEDA_SESSION_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <utility>
+
+#include "leda.h"
+#include "leda_common.h"
+
+// A sparse matrix for many SpMM calls with the same A, e.g. the layers and
+// requests of GNN inference. The session keeps the packed A image on the
+// host, so A is preprocessed once, together with B and C buffers that are
+// only grown; a call lays out its B matrices, runs the kernel and reads C
+// back. Every kernel run is a full tapa::invoke, which loads the bitstream
+// and moves A to the device again. What a call amortizes is that cost over
+// the B matrices it places side by side in N.
+
+struct Session_Call {
+    INDEX_TYPE num_B;
+    INDEX_TYPE N;
+    double     layout_B_time;
+    double     run_time;
+    double     layout_C_time;
+};
+
+class Leda_Session {
+public:
+    // row_perm is the row renumbering the image was built with, C comes back
+    // in the row order of A; col_perm is the column renumbering of --reorder,
+    // the rows of B follow it; empty for none
+    Leda_Session(const std::string &bitstream,
+                 const bool cpu_executor,
+                 const INDEX_TYPE M,
+                 const INDEX_TYPE K,
+                 const INDEX_TYPE N_slices,
+                 const INDEX_TYPE A_format,
+                 vector<INDEX_TYPE> &&SpElement_list_ptr,
+                 aligned_vector<INDEX_TYPE> &&SpElement_list_ptr_fpga,
+                 vector<aligned_vector<unsigned long> > &&Matrix_A_fpga_data,
+                 vector<INDEX_TYPE> &&row_perm = vector<INDEX_TYPE>(),
+                 vector<INDEX_TYPE> &&col_perm = vector<INDEX_TYPE>()
+                )
+        : bitstream_(bitstream),
+          cpu_executor_(cpu_executor),
+          M_(M),
+          K_(K),
+          N_slices_(N_slices),
+          A_format_(A_format),
+          ptr_(std::move(SpElement_list_ptr)),
+          ptr_fpga_(std::move(SpElement_list_ptr_fpga)),
+          A_data_(std::move(Matrix_A_fpga_data)),
+          row_perm_(std::move(row_perm)),
+          col_perm_(std::move(col_perm)),
+          B_data_(HBM_CHANNEL_B_NUM),
+          C_data_(HBM_CHANNEL_C_NUM) {
+        Batch_num_ = ptr_.size() - 1;
+        Sparse_Matrix_len_ = ptr_[Batch_num_];
+    }
+
+    // C[i] = A * B[i] with B[i] column-major K x N[i] and C[i] column-major
+    // M x N[i], all in one kernel run; returns false when the kernel fails
+    bool Run(const vector<const vector<VALUE_TYPE> *> &B,
+             const vector<INDEX_TYPE> &N,
+             const vector<vector<VALUE_TYPE> *> &C
+            ) {
+        Session_Call call;
+        call.num_B = B.size();
+
+        vector<INDEX_TYPE> col_offset(B.size() + 1, 0);
+        for(size_t i = 0; i < B.size(); ++i) {
+            col_offset[i + 1] = col_offset[i] + N[i];
+        }
+        const INDEX_TYPE N_total = tapa::round_up<8>(col_offset[B.size()]);
+        call.N = N_total;
+
+        auto start = std::chrono::steady_clock::now();
+        Layout_B(B, col_offset, N_total);
+        auto B_end = std::chrono::steady_clock::now();
+
+        bool ok = Run_kernel(N_total);
+        auto run_end = std::chrono::steady_clock::now();
+
+        if(ok) {
+            Layout_C(C, col_offset);
+        }
+        auto C_end = std::chrono::steady_clock::now();
+
+        call.layout_B_time = std::chrono::duration<double>(B_end - start).count();
+        call.run_time      = std::chrono::duration<double>(run_end - B_end).count();
+        call.layout_C_time = std::chrono::duration<double>(C_end - run_end).count();
+        calls_.push_back(call);
+        return ok;
+    }
+
+    bool Run(const vector<VALUE_TYPE> &B, const INDEX_TYPE N, vector<VALUE_TYPE> &C) {
+        return Run(vector<const vector<VALUE_TYPE> *>(1, &B), vector<INDEX_TYPE>(1, N), vector<vector<VALUE_TYPE> *>(1, &C));
+    }
+
+    const vector<Session_Call> &Calls() const {
+        return calls_;
+    }
+
+    // every call loads the bitstream and moves A again, so no call is setup
+    // and all are reported alike; per B shows what grouping B saves
+    void Report(const INDEX_TYPE nnzR) const {
+        if(calls_.empty()) {
+            return;
+        }
+        double sum_B = 0, sum_run = 0, sum_C = 0, min_call = 1e30, max_call = 0;
+        double flops = 0;
+        INDEX_TYPE num_B = 0;
+        for(size_t i = 0; i < calls_.size(); ++i) {
+            const Session_Call &c = calls_[i];
+            double t = c.layout_B_time + c.run_time + c.layout_C_time;
+            sum_B += c.layout_B_time;
+            sum_run += c.run_time;
+            sum_C += c.layout_C_time;
+            min_call = min(min_call, t);
+            max_call = max(max_call, t);
+            flops += 2.0 * nnzR * c.N;
+            num_B += c.num_B;
+        }
+        double n = calls_.size();
+        double total = sum_B + sum_run + sum_C;
+        printf("Per call (%d calls, %d B): mean %f ms, min %f ms, max %f ms\n",
+               (INDEX_TYPE)n, num_B, total / n * 1000, min_call * 1000, max_call * 1000);
+        printf("  layout B %f ms, run %f ms, layout C %f ms\n",
+               sum_B / n * 1000, sum_run / n * 1000, sum_C / n * 1000);
+        printf("Per B: %f ms, %f GFLOPS\n", total / num_B * 1000, flops / 1e9 / total);
+    }
+
+private:
+    // B matrices side by side in the FPGA layout of Create_Matrix_B_data_FPGA;
+    // the buffers only grow, and the padding columns of the last pass are cleared
+    void Layout_B(const vector<const vector<VALUE_TYPE> *> &B,
+                  const vector<INDEX_TYPE> &col_offset,
+                  const INDEX_TYPE N_total
+                 ) {
+        const INDEX_TYPE column_size = ((K_ + 8 - 1) / 8) * 8 * 2;
+        const size_t chunk_size = ((size_t)column_size * (N_total / 8) + 1023) / 1024 * 1024;
+        for(INDEX_TYPE c = 0; c < HBM_CHANNEL_B_NUM; ++c) {
+            if(B_data_[c].size() < chunk_size) {
+                B_data_[c].resize(chunk_size, 0.0);
+            }
+        }
+
+#pragma omp parallel for schedule(dynamic)
+        for(INDEX_TYPE nn = 0; nn < N_total; ++nn) {
+            INDEX_TYPE i = std::upper_bound(col_offset.begin(), col_offset.end(), nn) - col_offset.begin() - 1;
+            const VALUE_TYPE *B_col = (i < (INDEX_TYPE)B.size()) ? B[i]->data() + (size_t)K_ * (nn - col_offset[i]) : NULL;
+            VALUE_TYPE *out = B_data_[(nn / 2) % 4].data() + (size_t)column_size * (nn / 8) + (nn % 2) * 8;
+            for(INDEX_TYPE kk = 0; kk < K_; ++kk) {
+                INDEX_TYPE row = col_perm_.empty() ? kk : col_perm_[kk];
+                out[(row / 8) * 16 + row % 8] = B_col ? B_col[kk] : 0.0;
+            }
+        }
+    }
+
+    void Layout_C(const vector<vector<VALUE_TYPE> *> &C,
+                  const vector<INDEX_TYPE> &col_offset
+                 ) {
+        const INDEX_TYPE column_size = ((M_ + 16 - 1) / 16) * 16;
+        for(size_t i = 0; i < C.size(); ++i) {
+            C[i]->resize((size_t)M_ * (col_offset[i + 1] - col_offset[i]));
+        }
+
+#pragma omp parallel for schedule(dynamic)
+        for(INDEX_TYPE nn = 0; nn < col_offset[C.size()]; ++nn) {
+            INDEX_TYPE i = std::upper_bound(col_offset.begin(), col_offset.end(), nn) - col_offset.begin() - 1;
+            const VALUE_TYPE *in = C_data_[nn % 8].data() + (size_t)column_size * (nn / 8);
+            VALUE_TYPE *out = C[i]->data() + (size_t)M_ * (nn - col_offset[i]);
+            if(row_perm_.empty()) {
+                std::copy(in, in + M_, out);
+            }
+            else {
+                for(INDEX_TYPE r = 0; r < M_; ++r) {
+                    out[r] = in[row_perm_[r]];
+                }
+            }
+        }
+    }
+
+    bool Run_kernel(const INDEX_TYPE N_total) {
+        const size_t chunk_size = ((size_t)((M_ + 16 - 1) / 16) * 16 * (N_total / 8) + 1023) / 1024 * 1024;
+        for(INDEX_TYPE c = 0; c < HBM_CHANNEL_C_NUM; ++c) {
+            if(C_data_[c].size() < chunk_size) {
+                C_data_[c].resize(chunk_size, 0.0);
+            }
+        }
+
+        if(cpu_executor_) {
+            return SpMM_FPGA_image_CPU(M_, K_, N_total, Batch_num_, ptr_fpga_, A_data_, B_data_, C_data_, N_slices_, A_format_);
+        }
+
+#ifdef LEDA_PERF_COUNTERS
+        aligned_vector<INDEX_TYPE> Perf_counters_fpga((size_t)Perf_record_num(Batch_num_, N_total, N_slices_) * PERF_WORDS, 0);
+#endif
+        tapa::invoke(Leda,
+                     bitstream_,
+                     tapa::read_only_mmap<INDEX_TYPE>(ptr_fpga_),
+                     tapa::read_only_mmaps<unsigned long, HBM_CHANNEL_A_NUM>(A_data_).reinterpret<ap_uint<512>>(),
+                     tapa::read_only_mmaps<VALUE_TYPE,    HBM_CHANNEL_B_NUM>(B_data_).reinterpret<VALUE_TYPE_v16>(),
+                     tapa::write_only_mmaps<VALUE_TYPE,   HBM_CHANNEL_C_NUM>(C_data_).reinterpret<VALUE_TYPE_v16>(),
+#ifdef LEDA_PERF_COUNTERS
+                     tapa::write_only_mmap<INDEX_TYPE>(Perf_counters_fpga).reinterpret<INDEX_TYPE_v16>(),
+#endif
+                     Batch_num_,
+                     Sparse_Matrix_len_,
+                     M_,
+                     K_,
+                     N_total,
+                     N_slices_,
+                     A_format_,
+                     1
+                    );
+        return true;
+    }
+
+    std::string bitstream_;
+    bool        cpu_executor_;
+    INDEX_TYPE  M_;
+    INDEX_TYPE  K_;
+    INDEX_TYPE  N_slices_;
+    INDEX_TYPE  A_format_;
+    INDEX_TYPE  Batch_num_;
+    INDEX_TYPE  Sparse_Matrix_len_;
+
+    vector<INDEX_TYPE>                     ptr_;
+    aligned_vector<INDEX_TYPE>             ptr_fpga_;
+    vector<aligned_vector<unsigned long> > A_data_;
+    vector<INDEX_TYPE>                     row_perm_;
+    vector<INDEX_TYPE>                     col_perm_;
+    vector<aligned_vector<VALUE_TYPE> >    B_data_;
+    vector<aligned_vector<VALUE_TYPE> >    C_data_;
+
+    vector<Session_Call> calls_;
+};
+
+#endif
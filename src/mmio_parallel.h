@@ -0,0 +1,366 @@
+#ifndef _MMIO_PARALLEL_
+#define _MMIO_PARALLEL_
+
+#ifndef VALUE_TYPE
+#define VALUE_TYPE float
+#endif
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mmio.h"
+
+// error codes on top of the MM_* codes of mmio.h
+#define MM_PARSE_ERROR          18
+#define MM_INDEX_OUT_OF_RANGE   19
+
+static const double mmio_pow10[23] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool mmio_is_space(const char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool mmio_is_digit(const char c) {
+    return c >= '0' && c <= '9';
+}
+
+// parse an unsigned decimal index, p is left on the first character after it
+inline bool mmio_scan_index(const char *&p, const char *end, long long &val) {
+    while(p < end && mmio_is_space(*p)) ++p;
+    if(p < end && *p == '+') ++p;
+    if(p >= end || !mmio_is_digit(*p)) return false;
+
+    long long x = 0;
+    while(p < end && mmio_is_digit(*p)) {
+        x = x * 10 + (*p - '0');
+        ++p;
+    }
+    val = x;
+    return true;
+}
+
+// parse a floating point value, the result matches strtod bit by bit:
+// short decimals are converted exactly (Clinger's fast path), everything
+// else (long mantissas, large exponents, hex, inf, nan) goes through strtod
+inline bool mmio_scan_double(const char *&p, const char *end, double &val) {
+    while(p < end && mmio_is_space(*p)) ++p;
+    const char *token = p;
+
+    bool neg = false;
+    if(p < end && (*p == '+' || *p == '-')) {
+        neg = (*p == '-');
+        ++p;
+    }
+
+    unsigned long long mant = 0;
+    int sig_digits = 0;
+    int exp10 = 0;
+    bool any_digit = false;
+    bool exact = true;
+
+    while(p < end && mmio_is_digit(*p)) {
+        any_digit = true;
+        if(mant != 0 || *p != '0') {
+            if(sig_digits < 19) {
+                mant = mant * 10 + (*p - '0');
+                sig_digits++;
+            }
+            else {
+                exact = false;
+            }
+        }
+        ++p;
+    }
+    if(p < end && *p == '.') {
+        ++p;
+        while(p < end && mmio_is_digit(*p)) {
+            any_digit = true;
+            if(mant != 0 || *p != '0') {
+                if(sig_digits < 19) {
+                    mant = mant * 10 + (*p - '0');
+                    sig_digits++;
+                    exp10--;
+                }
+                else {
+                    exact = false;
+                }
+            }
+            else {
+                exp10--;
+            }
+            ++p;
+        }
+    }
+    if(any_digit && p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool exp_neg = false;
+        if(q < end && (*q == '+' || *q == '-')) {
+            exp_neg = (*q == '-');
+            ++q;
+        }
+        if(q < end && mmio_is_digit(*q)) {
+            int e = 0;
+            while(q < end && mmio_is_digit(*q)) {
+                if(e < 100000) e = e * 10 + (*q - '0');
+                ++q;
+            }
+            exp10 += exp_neg ? -e : e;
+            p = q;
+        }
+        else {
+            exact = false;
+        }
+    }
+
+    bool token_end = (p >= end || mmio_is_space(*p) || *p == '\n');
+    if(any_digit && token_end && exact && mant <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+        double x = (double)mant;
+        x = (exp10 < 0) ? x / mmio_pow10[-exp10] : x * mmio_pow10[exp10];
+        val = neg ? -x : x;
+        return true;
+    }
+
+    // slow path, strtod needs a terminated copy of the token
+    const char *q = token;
+    while(q < end && !mmio_is_space(*q) && *q != '\n') ++q;
+    char buf[128];
+    int len = q - token;
+    if(len == 0 || len >= (int)sizeof(buf)) return false;
+    memcpy(buf, token, len);
+    buf[len] = '\0';
+
+    char *buf_end;
+    val = strtod(buf, &buf_end);
+    if(buf_end != buf + len) return false;
+    p = q;
+    return true;
+}
+
+// parse the entries of one line-aligned chunk [p, end) into thread-local arrays
+inline int mmio_parse_chunk(const char *p,
+                            const char *end,
+                            const int m,
+                            const int n,
+                            const int isReal,
+                            const int isComplex,
+                            const int isInteger,
+                            std::vector<int> &RowIdx,
+                            std::vector<int> &ColIdx,
+                            std::vector<VALUE_TYPE> &Val
+                           ) {
+    while(p < end) {
+        while(p < end && mmio_is_space(*p)) ++p;
+        if(p >= end) break;
+        if(*p == '\n' || *p == '%') {
+            while(p < end && *p != '\n') ++p;
+            ++p;
+            continue;
+        }
+
+        long long idxi, idxj;
+        double fval = 1.0;
+        if(!mmio_scan_index(p, end, idxi) || !mmio_scan_index(p, end, idxj))
+            return MM_PARSE_ERROR;
+
+        if(isReal || isComplex || isInteger) {
+            if(!mmio_scan_double(p, end, fval))
+                return MM_PARSE_ERROR;
+        }
+
+        if(idxi < 1 || idxi > m || idxj < 1 || idxj > n)
+            return MM_INDEX_OUT_OF_RANGE;
+
+        // adjust from 1-based to 0-based
+        RowIdx.push_back((int)(idxi - 1));
+        ColIdx.push_back((int)(idxj - 1));
+        Val.push_back((VALUE_TYPE)fval);
+
+        // imaginary part and trailing tokens are ignored
+        while(p < end && *p != '\n') ++p;
+        ++p;
+    }
+    return 0;
+}
+
+// read a coordinate Matrix Market file in a single pass: the file is mapped
+// into memory, split into line-aligned chunks parsed by all threads, and
+// symmetric entries are expanded in parallel. The COO output keeps file
+// order, with the mirrored entry right after its original.
+int mmio_parallel_coo(int *m,
+                      int *n,
+                      int *nnz,
+                      int *isSymmetric,
+                      std::vector<int> &RowIdx_COO,
+                      std::vector<int> &ColIdx_COO,
+                      std::vector<VALUE_TYPE> &Val_COO,
+                      char *filename
+                     ) {
+    int m_tmp, n_tmp, nnz_mtx_report;
+    MM_typecode matcode;
+    FILE *f;
+
+    if((f = fopen(filename, "r")) == NULL)
+        return -1;
+
+    if(mm_read_banner(f, &matcode) != 0) {
+        printf("Could not process Matrix Market banner.\n");
+        fclose(f);
+        return -2;
+    }
+
+    if(!mm_is_coordinate(matcode)) {
+        fclose(f);
+        return -3;
+    }
+
+    if(mm_read_mtx_crd_size(f, &m_tmp, &n_tmp, &nnz_mtx_report) != 0) {
+        fclose(f);
+        return -4;
+    }
+
+    long data_offset = ftell(f);
+    fclose(f);
+
+    int isReal    = mm_is_real(matcode);
+    int isComplex = mm_is_complex(matcode);
+    int isInteger = mm_is_integer(matcode);
+    int isSymmetric_tmp = mm_is_symmetric(matcode) || mm_is_hermitian(matcode);
+
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return -1;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t file_size = st.st_size;
+
+    const char *file_data = NULL;
+    if(file_size > (size_t)data_offset) {
+        void *addr = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(addr == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        madvise(addr, file_size, MADV_WILLNEED);
+        file_data = (const char *)addr;
+    }
+    close(fd);
+
+    const char *data_begin = (file_data == NULL) ? NULL : file_data + data_offset;
+    const char *data_end   = (file_data == NULL) ? NULL : file_data + file_size;
+    size_t data_size = data_end - data_begin;
+
+    int num_chunks = omp_get_max_threads();
+    if(data_size < ((size_t)1 << 20)) num_chunks = 1;
+
+    // chunk boundaries are moved forward to the next line start
+    std::vector<const char *> chunk_begin(num_chunks + 1, data_end);
+    chunk_begin[0] = data_begin;
+    for(int c = 1; c < num_chunks; ++c) {
+        const char *p = data_begin + data_size / num_chunks * c;
+        while(p < data_end && p[-1] != '\n') ++p;
+        chunk_begin[c] = std::max(p, chunk_begin[c - 1]);
+    }
+
+    std::vector<std::vector<int> > chunk_row(num_chunks);
+    std::vector<std::vector<int> > chunk_col(num_chunks);
+    std::vector<std::vector<VALUE_TYPE> > chunk_val(num_chunks);
+    std::vector<int> chunk_ret(num_chunks, 0);
+    std::vector<long long> chunk_nnz(num_chunks + 1, 0);
+    std::vector<long long> chunk_out(num_chunks + 1, 0);
+
+#pragma omp parallel for schedule(static, 1)
+    for(int c = 0; c < num_chunks; ++c) {
+        size_t estimate = (size_t)nnz_mtx_report / num_chunks + 16;
+        chunk_row[c].reserve(estimate);
+        chunk_col[c].reserve(estimate);
+        chunk_val[c].reserve(estimate);
+        chunk_ret[c] = mmio_parse_chunk(chunk_begin[c],
+                                        chunk_begin[c + 1],
+                                        m_tmp,
+                                        n_tmp,
+                                        isReal,
+                                        isComplex,
+                                        isInteger,
+                                        chunk_row[c],
+                                        chunk_col[c],
+                                        chunk_val[c]
+                                       );
+        long long out = chunk_row[c].size();
+        if(isSymmetric_tmp) {
+            for(size_t i = 0; i < chunk_row[c].size(); ++i) {
+                if(chunk_row[c][i] != chunk_col[c][i]) out++;
+            }
+        }
+        chunk_nnz[c + 1] = chunk_row[c].size();
+        chunk_out[c + 1] = out;
+    }
+
+    if(file_data != NULL)
+        munmap((void *)file_data, file_size);
+
+    for(int c = 0; c < num_chunks; ++c) {
+        if(chunk_ret[c] != 0) {
+            printf("Could not parse Matrix Market entries.\n");
+            return -chunk_ret[c];
+        }
+        chunk_nnz[c + 1] += chunk_nnz[c];
+        chunk_out[c + 1] += chunk_out[c];
+    }
+
+    if(chunk_nnz[num_chunks] != nnz_mtx_report) {
+        printf("Matrix Market file has %lld entries, %d expected.\n", chunk_nnz[num_chunks], nnz_mtx_report);
+        return -MM_PREMATURE_EOF;
+    }
+
+    long long nnz_tmp = chunk_out[num_chunks];
+    RowIdx_COO.resize(nnz_tmp);
+    ColIdx_COO.resize(nnz_tmp);
+    Val_COO.resize(nnz_tmp);
+
+#pragma omp parallel for schedule(static, 1)
+    for(int c = 0; c < num_chunks; ++c) {
+        long long pos = chunk_out[c];
+        for(size_t i = 0; i < chunk_row[c].size(); ++i) {
+            int row = chunk_row[c][i];
+            int col = chunk_col[c][i];
+            VALUE_TYPE val = chunk_val[c][i];
+
+            RowIdx_COO[pos] = row;
+            ColIdx_COO[pos] = col;
+            Val_COO[pos] = val;
+            pos++;
+
+            if(isSymmetric_tmp && row != col) {
+                RowIdx_COO[pos] = col;
+                ColIdx_COO[pos] = row;
+                Val_COO[pos] = val;
+                pos++;
+            }
+        }
+        std::vector<int>().swap(chunk_row[c]);
+        std::vector<int>().swap(chunk_col[c]);
+        std::vector<VALUE_TYPE>().swap(chunk_val[c]);
+    }
+
+    *m = m_tmp;
+    *n = n_tmp;
+    *nnz = (int)nnz_tmp;
+    *isSymmetric = isSymmetric_tmp;
+
+    return 0;
+}
+
+#endif